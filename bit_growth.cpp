@@ -0,0 +1,344 @@
+/*
+ * This file is part of pcb2gcode.
+ *
+ * Copyright (C) 2016 the pcb2gcode developers
+ *
+ * pcb2gcode is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * pcb2gcode is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with pcb2gcode.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "bit_growth.hpp"
+#include "parallel.hpp"
+
+#include <algorithm>
+
+#include <boost/foreach.hpp>
+
+// colours of the label plane, see surface.cpp
+#define OPAQUE 0xFF000000
+#define BLACK 0xFF000000
+#define MASKED 0xFFFF00FF   // RED | BLUE
+
+/******************************************************************************/
+/*
+ 3x1 dilation of the word of a row, with the carries from the words beside it
+ */
+/******************************************************************************/
+static inline uint64_t dilate(uint64_t left, uint64_t middle, uint64_t right)
+{
+    return middle | (middle << 1) | (middle >> 1) | (left >> 63) | (right << 63);
+}
+
+/******************************************************************************/
+/*
+ sets the bits [first, last] of a row
+ */
+/******************************************************************************/
+static void set_bits(uint64_t* row, int first, int last)
+{
+    for (int x = first; x <= last; )
+    {
+        const int end = std::min(last + 1, (x & ~63) + 64);
+        const int count = end - x;
+
+        row[x >> 6] |= (count == 64 ? ~uint64_t(0) : ((uint64_t(1) << count) - 1)) << (x & 63);
+        x = end;
+    }
+}
+
+/******************************************************************************/
+/*
+ */
+/******************************************************************************/
+bit_growth::bit_growth(const labelplane& labels) :
+    width(labels.get_width()), height(labels.get_height()),
+    words_per_row((width + 63) / 64), occupied(words_per_row * height, 0),
+    masked(words_per_row * height, 0)
+{
+    parallel::for_chunks(height, boost::bind(&bit_growth::occupy_rows, this,
+                         &labels, _1, _2));
+}
+
+/******************************************************************************/
+/*
+ */
+/******************************************************************************/
+void bit_growth::occupy_rows(const labelplane* labels, int begin, int end)
+{
+    vector<uint32_t> row(width);
+
+    for (int y = begin; y < end; y++)
+    {
+        uint64_t* bits = &occupied[y * words_per_row];
+        uint64_t* masked_bits = &masked[y * words_per_row];
+
+        labels->get_span(y, 0, width, &row[0]);
+
+        for (int x = 0; x < width; x++)
+        {
+            if ((row[x] | OPAQUE) != BLACK)
+                bits[x >> 6] |= uint64_t(1) << (x & 63);
+
+            if (row[x] == MASKED)
+                masked_bits[x >> 6] |= uint64_t(1) << (x & 63);
+        }
+    }
+}
+
+/******************************************************************************/
+/*
+ the window covers the component and all its rings, plus the candidates
+ around the last one
+ */
+/******************************************************************************/
+void bit_growth::add_component(uint32_t color, const run_set& pixels,
+                               const run_set& candidates, int rings)
+{
+    const vector<pixel_run>& runs = pixels.get_runs();
+
+    int left = width;
+    int right = -1;
+
+    BOOST_FOREACH(const pixel_run& run, runs)
+    {
+        left = std::min(left, run.first);
+        right = std::max(right, run.last);
+    }
+
+    components.push_back(component());
+    component& c = components.back();
+
+    c.color = color;
+    c.first_row = std::max(runs.front().y - rings - 1, 0);
+    c.rows = std::min(runs.back().y + rings + 1, height - 1) - c.first_row + 1;
+    c.first_word = std::max(left - rings - 1, 0) / 64;
+    c.words = std::min(right + rings + 1, width - 1) / 64 - c.first_word + 1;
+    c.own.assign(c.words * c.rows, 0);
+    c.candidates.assign(c.words * c.rows, 0);
+
+    const int offset = c.first_word * 64;
+
+    BOOST_FOREACH(const pixel_run& run, runs)
+    {
+        set_bits(&c.own[(run.y - c.first_row) * c.words],
+                 run.first - offset, run.last - offset);
+    }
+
+    BOOST_FOREACH(const pixel_run& run, candidates.get_runs())
+    {
+        const int y = run.y - c.first_row;
+
+        set_bits(&c.candidates[y * c.words], run.first - offset, run.last - offset);
+
+        // the runs are in raster order, a word can only be shared with the
+        // previous run
+        for (int w = (run.first - offset) >> 6; w <= (run.last - offset) >> 6; w++)
+        {
+            const word_position position = { y, w };
+
+            if (c.active.empty() || c.active.back().row != y || c.active.back().word != w)
+                c.active.push_back(position);
+        }
+    }
+
+    if (claims.size() < c.own.size())
+    {
+        claims.resize(c.own.size(), 0);
+        marks.resize(c.own.size(), false);
+    }
+}
+
+/******************************************************************************/
+/*
+ */
+/******************************************************************************/
+unsigned int bit_growth::grow(labelplane& labels, int& contentions)
+{
+    unsigned int pixels_changed = 0;
+
+    BOOST_FOREACH(component& c, components)
+    {
+        pixels_changed += grow(c, labels, contentions);
+    }
+
+    return pixels_changed;
+}
+
+/******************************************************************************/
+/*
+ */
+/******************************************************************************/
+uint64_t bit_growth::interior(int word) const
+{
+    uint64_t mask = ~uint64_t(0);
+
+    if (word == 0)
+        mask &= ~uint64_t(1);
+
+    // the last column and the ones past it
+    const int last = width - 1 - word * 64;
+
+    if (last < 64)
+        mask &= last <= 0 ? 0 : (uint64_t(1) << last) - 1;
+
+    return mask;
+}
+
+/******************************************************************************/
+/*
+ one ring of a component: the free candidates far enough from the other
+ components are claimed, and the free pixels around them are the next
+ candidates. A rejected candidate is tried again only if a later ring claims
+ a pixel next to it, like in Surface::grow_frontier().
+ Only the words holding candidates are visited, so a ring costs about its
+ length in pixels along the columns and its length in words along the rows.
+ */
+/******************************************************************************/
+unsigned int bit_growth::grow(component& c, labelplane& labels, int& contentions)
+{
+    if (c.active.empty())
+        return 0;
+
+    unsigned int pixels_changed = 0;
+
+    claimed.clear();
+
+    BOOST_FOREACH(const word_position& position, c.active)
+    {
+        const int y = position.row;
+        const int w = position.word;
+        const int index = y * c.words + w;
+        const int image_y = c.first_row + y;
+        uint64_t& occupied_word = occupied[image_y * words_per_row + c.first_word + w];
+        const uint64_t candidates = c.candidates[index] & ~occupied_word;
+        uint64_t claim = 0;
+
+        c.candidates[index] = 0;
+
+        // the first and last rows can't be claimed, whatever is around; only
+        // the candidates near another component, rather than the masked
+        // area, are contended
+        if (candidates && image_y > 0 && image_y < height - 1)
+        {
+            uint64_t near = 0;
+            uint64_t near_component = 0;
+
+            for (int row = y - 1; row <= y + 1; row++)
+            {
+                const uint64_t left = foreign(c, w - 1, row);
+                const uint64_t middle = foreign(c, w, row);
+                const uint64_t right = foreign(c, w + 1, row);
+
+                near |= dilate(left, middle, right);
+                near_component |= dilate(left & ~masked_word(c, w - 1, row),
+                                         middle & ~masked_word(c, w, row),
+                                         right & ~masked_word(c, w + 1, row));
+            }
+
+            const uint64_t inside = candidates & interior(c.first_word + w);
+
+            claim = inside & ~near;
+            contentions += __builtin_popcountll(inside & near_component);
+        }
+
+        if (!claim)
+            continue;
+
+        claims[index] = claim;
+        claimed.push_back(position);
+        c.own[index] |= claim;
+        occupied_word |= claim;
+
+        // paint the runs of claimed pixels
+        const int offset = (c.first_word + w) * 64;
+
+        for (int i = 0; i < 64; )
+        {
+            const uint64_t rest = claim >> i;
+
+            if (!rest)
+                break;
+
+            const int first = i + __builtin_ctzll(rest);
+            const uint64_t gap = ~claim >> first;
+            const int end = gap ? first + __builtin_ctzll(gap) : 64;
+
+            labels.fill_span(image_y, offset + first, offset + end, c.color);
+            pixels_changed += end - first;
+            i = end;
+        }
+    }
+
+    // the next candidates are the free pixels around the claims: in the
+    // words above, on and below the claims, and in the ones beside them
+    // when the claims touch their first or last bit
+    next.clear();
+
+    BOOST_FOREACH(const word_position& position, claimed)
+    {
+        const uint64_t claim = claims[position.row * c.words + position.word];
+
+        for (int row = position.row - 1; row <= position.row + 1; row++)
+        {
+            if (claim & 1)
+                mark(c, position.word - 1, row);
+
+            mark(c, position.word, row);
+
+            if (claim >> 63)
+                mark(c, position.word + 1, row);
+        }
+    }
+
+    c.active.clear();
+
+    BOOST_FOREACH(const word_position& position, next)
+    {
+        const int y = position.row;
+        const int w = position.word;
+        uint64_t candidates = 0;
+
+        for (int row = std::max(y - 1, 0); row <= std::min(y + 1, c.rows - 1); row++)
+        {
+            const uint64_t* claim_row = &claims[row * c.words];
+
+            candidates |= dilate(w > 0 ? claim_row[w - 1] : 0, claim_row[w],
+                                 w + 1 < c.words ? claim_row[w + 1] : 0);
+        }
+
+        candidates &= ~occupied[(c.first_row + y) * words_per_row + c.first_word + w];
+
+        if (candidates)
+        {
+            c.candidates[y * c.words + w] = candidates;
+            c.active.push_back(position);
+        }
+
+        marks[y * c.words + w] = false;
+    }
+
+    BOOST_FOREACH(const word_position& position, claimed)
+    {
+        claims[position.row * c.words + position.word] = 0;
+    }
+
+    // a saturated component can't grow any more
+    if (c.active.empty())
+    {
+        vector<uint64_t>().swap(c.own);
+        vector<uint64_t>().swap(c.candidates);
+    }
+
+    return pixels_changed;
+}
@@ -20,6 +20,8 @@
 
 #include "board.hpp"
 
+#include <algorithm>
+
 typedef pair<string, shared_ptr<Layer> > layer_t;
 
 /******************************************************************************/
@@ -28,6 +30,7 @@ typedef pair<string, shared_ptr<Layer> > layer_t;
 /******************************************************************************/
 Board::Board(int dpi, bool fill_outline, double outline_width, string outputdir) :
     margin(0.0),
+    max_memory(0),
     dpi(dpi),
     fill_outline(fill_outline),
     outline_width(outline_width),
@@ -42,7 +45,7 @@ Board::Board(int dpi, bool fill_outline, double outline_width, string outputdir)
 /******************************************************************************/
 double Board::get_width()
 {
-    return layers.begin()->second->surface->get_width_in();
+    return max_x - min_x;
 }
 
 /******************************************************************************/
@@ -51,7 +54,7 @@ double Board::get_width()
 /******************************************************************************/
 double Board::get_height()
 {
-    return layers.begin()->second->surface->get_height_in();
+    return max_y - min_y;
 }
 
 /******************************************************************************/
@@ -142,13 +145,79 @@ void Board::createLayers()
     min_y -= quantization_error;
     max_y += quantization_error;
 
-    // board size calculated. create layers
+    // board size calculated. Each layer only needs its own area plus the
+    // room its tool grows into, and nothing beyond the outline is milled
+    map<string, roi_t> rois;
+
+    for( map<string, prep_t>::iterator it = prepared_layers.begin(); it != prepared_layers.end(); it++ )
+    {
+        shared_ptr<LayerImporter> importer = it->second.get<0>();
+        shared_ptr<RoutingMill> mill = it->second.get<1>();
+        shared_ptr<Isolator> isolator = boost::dynamic_pointer_cast<Isolator>(mill);
+        const ivalue_t room = (isolator ? mill->tool_diameter / 2 * (isolator->extra_passes + 1) :
+                               mill->tool_diameter / 2) + quantization_error;
+
+        rois[it->first] = roi_t(importer->get_min_x() - room, importer->get_max_x() + room,
+                                importer->get_min_y() - room, importer->get_max_y() + room);
+    }
+
+    if (rois.find("outline") != rois.end())
+    {
+        const roi_t outline = rois.at("outline");
+
+        for (map<string, roi_t>::iterator it = rois.begin(); it != rois.end(); it++)
+        {
+            it->second.get<0>() = std::max(it->second.get<0>(), outline.get<0>());
+            it->second.get<1>() = std::min(it->second.get<1>(), outline.get<1>());
+            it->second.get<2>() = std::max(it->second.get<2>(), outline.get<2>());
+            it->second.get<3>() = std::min(it->second.get<3>(), outline.get<3>());
+        }
+    }
+
+    // create layers
     for( map<string, prep_t>::iterator it = prepared_layers.begin(); it != prepared_layers.end(); it++ )
     {
+        // the vector engine only isolates, and needs the polygons of the
+        // layer; otherwise the layer is rasterised
+        if (it->second.get<1>()->growth_engine == GROWTH_VECTOR &&
+                boost::dynamic_pointer_cast<Isolator>(it->second.get<1>()))
+        {
+            imulti_polygon copper;
+
+            if (it->second.get<0>()->vectorise(copper, vector_isolation::get_tolerance()))
+            {
+                shared_ptr<vector_isolation> vectors(new vector_isolation(copper, min_x, max_x));
+                shared_ptr<Layer> layer(new Layer(it->first, vectors, it->second.get<1>(), it->second.get<2>(), it->second.get<3>()));
+
+                layers.insert(std::make_pair(layer->get_name(), layer));
+                continue;
+            }
+        }
+
         // prepare the surface
-        shared_ptr<Surface> surface(new Surface(dpi, min_x, max_x, min_y, max_y, outputdir));
+        const roi_t& roi = rois.at(it->first);
+        shared_ptr<Surface> surface(new Surface(dpi, min_x, max_x, min_y, max_y,
+                                                roi.get<0>(), roi.get<1>(),
+                                                roi.get<2>(), roi.get<3>(), outputdir));
         shared_ptr<LayerImporter> importer = it->second.get<0>();
-        surface->render(importer);
+        // the planes of the whole layer are paid first, the render bands get
+        // what is left
+        const size_t planes = surface->get_plane_bytes(it->second.get<1>(),
+                              it->first != "outline" &&
+                              prepared_layers.find("outline") != prepared_layers.end());
+
+        if (max_memory != 0 && planes >= max_memory)
+        {
+            std::stringstream msg;
+            msg << "the " << it->first << " layer needs "
+                << ((planes + (1 << 20) - 1) >> 20)
+                << " MB, more than the --max-memory budget";
+            throw memory_exception() << errorstring(msg.str());
+        }
+
+        surface->render(importer,
+                        it->second.get<1>()->contour_mode == CONTOUR_SUBPIXEL,
+                        max_memory != 0 ? max_memory - planes : 0);
 
         shared_ptr<Layer> layer(new Layer(it->first, surface, it->second.get<1>(), it->second.get<2>(), it->second.get<3>())); // see comment for prep_t in board.hpp
 
@@ -158,7 +227,8 @@ void Board::createLayers()
     // DEBUG output
     BOOST_FOREACH( layer_t layer, layers )
     {
-        layer.second->surface->save_debug_image(string("original_") + layer.second->get_name());
+        if (layer.second->surface)
+            layer.second->surface->save_debug_image(string("original_") + layer.second->get_name());
     }
 
     // mask layers with outline
@@ -171,17 +241,82 @@ void Board::createLayers()
             outline_layer->surface->fill_outline(outline_width);
         }
 
+        vector<shared_ptr<Surface> > masked_surfaces;
+        shared_ptr<imulti_polygon> outline_area;
+
         for (map<string, shared_ptr<Layer> >::iterator it = layers.begin(); it != layers.end(); it++)
         {
-            if (it->second != outline_layer)
+            if (it->second == outline_layer)
+                continue;
+
+            // the vector engine and the offset passes clip their polygons
+            shared_ptr<Isolator> iso =
+                boost::dynamic_pointer_cast<Isolator>(it->second->manufacturer);
+            const bool offset = iso && iso->offset_passes && iso->extra_passes > 0;
+
+            if ((!it->second->surface || offset) && !outline_area)
+                outline_area = shared_ptr<imulti_polygon>(
+                                   new imulti_polygon(get_outline_area(rois.at("outline"))));
+
+            if (!it->second->surface)
+                it->second->vectors->set_mask(*outline_area);
+            else
             {
-                it->second->add_mask(outline_layer);
-                it->second->surface->save_debug_image("masked");
+                masked_surfaces.push_back(it->second->surface);
+
+                if (offset)
+                    it->second->surface->set_mask_area(*outline_area);
             }
         }
+
+        Surface::add_mask(masked_surfaces, outline_layer->surface);
+
+        BOOST_FOREACH(const shared_ptr<Surface>& surface, masked_surfaces)
+        {
+            surface->save_debug_image("masked");
+        }
     }
 }
 
+/******************************************************************************/
+/*
+ the area inside the outline, for the layers isolated by the vector engine
+ and the offset passes: the polygons of the outline layer, filled like
+ fill_outline() does, or its bounding box if the outline can only be rendered
+ */
+/******************************************************************************/
+imulti_polygon Board::get_outline_area(const roi_t& outline_roi)
+{
+    imulti_polygon area;
+
+    if (prepared_layers.at("outline").get<0>()->vectorise(area, vector_isolation::get_tolerance()))
+    {
+        if (fill_outline)
+        {
+            vector<imulti_polygon> filled;
+
+            BOOST_FOREACH(const ipolygon& polygon, area)
+            {
+                filled.push_back(imulti_polygon());
+                filled.back().resize(1);
+                filled.back().front().outer() = polygon.outer();
+            }
+
+            vector_isolation::unite(filled, area);
+        }
+    }
+    else
+    {
+        ipolygon box;
+
+        boost::geometry::convert(ibox(icoordpair(outline_roi.get<0>(), outline_roi.get<2>()),
+                                      icoordpair(outline_roi.get<1>(), outline_roi.get<3>())), box);
+        area.assign(1, box);
+    }
+
+    return area;
+}
+
 /******************************************************************************/
 /*
  */
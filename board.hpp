@@ -66,6 +66,9 @@ public:
                       shared_ptr<RoutingMill> manufacturer, bool backside,
                       bool mirror_absolute);
     void set_margins(double margins) { margin = margins;	};
+    // memory budget of each rasterised layer, in bytes (0 = none);
+    // createLayers() throws memory_exception if a layer doesn't fit in it
+    void set_max_memory(size_t bytes) { max_memory = bytes; };
     ivalue_t get_width();
     ivalue_t get_height();
     ivalue_t get_min_x() {	return min_x; };
@@ -83,6 +86,7 @@ public:
 
 private:
     ivalue_t margin;
+    size_t max_memory;
     const unsigned int dpi;
     const bool fill_outline;
     const double outline_width;
@@ -102,8 +106,13 @@ private:
      * signature of Layer.
      */
     typedef tuple<shared_ptr<LayerImporter>, shared_ptr<RoutingMill>, bool, bool> prep_t;
+
+    // area of the board each layer covers: min_x, max_x, min_y, max_y
+    typedef tuple<ivalue_t, ivalue_t, ivalue_t, ivalue_t> roi_t;
     map<string, prep_t> prepared_layers;
     map<string, shared_ptr<Layer> > layers;
+
+    imulti_polygon get_outline_area(const roi_t& outline_roi);
 };
 
 #endif // BOARD_H
@@ -59,3 +59,23 @@ bool workSide( const boost::program_options::variables_map &options, string type
         }
     }
 }
+
+GrowthEngine growthEngine( const boost::program_options::variables_map &options )
+{
+    if( boost::iequals( options["growth-engine"].as<string>(), "edt" ) )
+        return GROWTH_EDT;
+    else if( boost::iequals( options["growth-engine"].as<string>(), "bitplane" ) )
+        return GROWTH_BITPLANE;
+    else if( boost::iequals( options["growth-engine"].as<string>(), "vector" ) )
+        return GROWTH_VECTOR;
+    else
+        return GROWTH_OUTLINE;
+}
+
+ContourMode contourMode( const boost::program_options::variables_map &options )
+{
+    if( boost::iequals( options["contour-mode"].as<string>(), "subpixel" ) )
+        return CONTOUR_SUBPIXEL;
+    else
+        return CONTOUR_PIXEL;
+}
@@ -25,11 +25,15 @@ using std::string;
 
 #include <boost/program_options.hpp>
 
+#include "mill.hpp"
+
 // This enum contains the software codes. Note that all the items (except for CUSTOM)
 // must start from 0 and be consecutive, as they are used as array indexes
 enum Software { CUSTOM = -1, LINUXCNC = 0, MACH4 = 1, MACH3 = 2 };
 
 string getSoftwareString( Software software );
 bool workSide( const boost::program_options::variables_map &options, string type );
+GrowthEngine growthEngine( const boost::program_options::variables_map &options );
+ContourMode contourMode( const boost::program_options::variables_map &options );
 
 #endif // COMMON_H
@@ -0,0 +1,300 @@
+/*
+ * This file is part of pcb2gcode.
+ *
+ * Copyright (C) 2016 the pcb2gcode developers
+ *
+ * pcb2gcode is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * pcb2gcode is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with pcb2gcode.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "component_labelling.hpp"
+#include "parallel.hpp"
+
+#include <algorithm>
+
+/******************************************************************************/
+/*
+ */
+/******************************************************************************/
+component_labelling::component_labelling(const labelplane& pixels,
+        uint32_t foreground, uint32_t ignored_bits) :
+    width(pixels.get_width()), height(pixels.get_height()),
+    foreground(foreground), ignored_bits(ignored_bits)
+{
+    const int strips_num = std::max(std::min<int>(parallel::threads(), height), 1);
+
+    strips.resize(strips_num);
+    for (int i = 0; i < strips_num; i++)
+    {
+        strips[i].first_row = height * i / strips_num;
+        strips[i].end_row = height * (i + 1) / strips_num;
+    }
+
+    // label each strip on its own
+    parallel::for_chunks(strips_num, boost::bind(&component_labelling::label_strips,
+                         this, &pixels, _1, _2));
+
+    uint32_t runs_num = 0;
+    for (int i = 0; i < strips_num; i++)
+    {
+        strips[i].offset = runs_num;
+        runs_num += strips[i].runs.size();
+    }
+
+    // move the local union-find forests in the global one
+    parent.resize(runs_num);
+    parallel::for_chunks(strips_num, boost::bind(&component_labelling::globalise_strips,
+                         this, _1, _2));
+
+    merge_seams();
+
+    // the roots are the first runs of their components, hence a raster order
+    // visit finds them in the same order as a serial scan
+    component.resize(runs_num);
+    for (int i = 0; i < strips_num; i++)
+    {
+        const strip& current = strips[i];
+
+        for (uint32_t j = 0; j < current.runs.size(); j++)
+        {
+            const uint32_t index = current.offset + j;
+            const uint32_t root = find(parent, index);
+
+            if (root == index)
+            {
+                component[index] = seeds.size();
+                seeds.push_back(pair<int, int>(current.runs[j].first, current.runs[j].y));
+            }
+            else
+                component[index] = component[root];
+        }
+    }
+
+    vector<uint32_t>().swap(parent);
+}
+
+/******************************************************************************/
+/*
+ */
+/******************************************************************************/
+void component_labelling::label_strips(const labelplane* pixels, int begin, int end)
+{
+    for (int i = begin; i < end; i++)
+        label_strip(*pixels, &strips[i]);
+}
+
+/******************************************************************************/
+/*
+ collects the runs of a strip and joins the ones overlapping (diagonals
+ included) with the runs of the previous row
+ */
+/******************************************************************************/
+void component_labelling::label_strip(const labelplane& pixels, strip* current)
+{
+    vector<uint32_t> row(width);
+    uint32_t previous_begin = 0;
+    uint32_t previous_end = 0;
+
+    current->first_row_end = 0;
+    current->last_row_begin = 0;
+
+    for (int y = current->first_row; y < current->end_row; y++)
+    {
+        pixels.get_span(y, 0, width, &row[0]);
+        const uint32_t begin = current->runs.size();
+
+        for (int x = 0; x < width; x++)
+        {
+            if ((row[x] | ignored_bits) == foreground)
+            {
+                run new_run;
+                new_run.y = y;
+                new_run.first = x;
+
+                while (x + 1 < width && (row[x + 1] | ignored_bits) == foreground)
+                    x++;
+
+                new_run.last = x;
+                current->parent.push_back(current->runs.size());
+                current->runs.push_back(new_run);
+            }
+        }
+
+        const uint32_t end = current->runs.size();
+
+        if (y > current->first_row)
+            join_rows(current->parent, current->runs, previous_begin, previous_end,
+                      current->runs, begin, end, 0, 0);
+        else
+            current->first_row_end = end;
+
+        current->last_row_begin = begin;
+        previous_begin = begin;
+        previous_end = end;
+    }
+}
+
+/******************************************************************************/
+/*
+ */
+/******************************************************************************/
+void component_labelling::globalise_strips(int begin, int end)
+{
+    for (int i = begin; i < end; i++)
+    {
+        strip& current = strips[i];
+
+        for (uint32_t j = 0; j < current.parent.size(); j++)
+            parent[current.offset + j] = current.offset + current.parent[j];
+
+        vector<uint32_t>().swap(current.parent);
+    }
+}
+
+/******************************************************************************/
+/*
+ joins the components touching across the strip boundaries
+ */
+/******************************************************************************/
+void component_labelling::merge_seams()
+{
+    for (unsigned int i = 1; i < strips.size(); i++)
+    {
+        const strip& upper = strips[i - 1];
+        const strip& lower = strips[i];
+
+        join_rows(parent, upper.runs, upper.last_row_begin, upper.runs.size(),
+                  lower.runs, 0, lower.first_row_end, upper.offset, lower.offset);
+    }
+}
+
+/******************************************************************************/
+/*
+ */
+/******************************************************************************/
+void component_labelling::paint(labelplane& pixels, const vector<uint32_t>& labels)
+{
+    parallel::for_chunks(strips.size(), boost::bind(&component_labelling::paint_strips,
+                         this, &pixels, &labels, _1, _2));
+}
+
+/******************************************************************************/
+/*
+ */
+/******************************************************************************/
+void component_labelling::paint_strips(labelplane* pixels,
+                                       const vector<uint32_t>* labels,
+                                       int begin, int end)
+{
+    for (int i = begin; i < end; i++)
+    {
+        const strip& current = strips[i];
+
+        for (uint32_t j = 0; j < current.runs.size(); j++)
+        {
+            const run& r = current.runs[j];
+
+            pixels->fill_span(r.y, r.first, r.last + 1,
+                              (*labels)[component[current.offset + j]]);
+        }
+    }
+}
+
+/******************************************************************************/
+/*
+ the strips and their runs are in raster order, so are the runs appended to
+ each component
+ */
+/******************************************************************************/
+void component_labelling::get_runs(vector<run_set>& components) const
+{
+    components.clear();
+    components.resize(seeds.size());
+
+    for (unsigned int i = 0; i < strips.size(); i++)
+    {
+        const strip& current = strips[i];
+
+        for (uint32_t j = 0; j < current.runs.size(); j++)
+        {
+            const run& r = current.runs[j];
+
+            components[component[current.offset + j]].append(r.y, r.first, r.last);
+        }
+    }
+}
+
+/******************************************************************************/
+/*
+ */
+/******************************************************************************/
+uint32_t component_labelling::find(vector<uint32_t>& parent, uint32_t i)
+{
+    while (parent[i] != i)
+    {
+        parent[i] = parent[parent[i]];
+        i = parent[i];
+    }
+
+    return i;
+}
+
+/******************************************************************************/
+/*
+ the lowest index always becomes the root
+ */
+/******************************************************************************/
+void component_labelling::join(vector<uint32_t>& parent, uint32_t a, uint32_t b)
+{
+    a = find(parent, a);
+    b = find(parent, b);
+
+    if (a < b)
+        parent[b] = a;
+    else if (b < a)
+        parent[a] = b;
+}
+
+/******************************************************************************/
+/*
+ joins the runs of two consecutive rows touching each other (diagonals
+ included); both the ranges are sorted by column
+ */
+/******************************************************************************/
+void component_labelling::join_rows(vector<uint32_t>& parent,
+                                    const vector<run>& upper,
+                                    uint32_t upper_begin, uint32_t upper_end,
+                                    const vector<run>& lower,
+                                    uint32_t lower_begin, uint32_t lower_end,
+                                    uint32_t upper_offset, uint32_t lower_offset)
+{
+    uint32_t i = upper_begin;
+    uint32_t j = lower_begin;
+
+    while (i < upper_end && j < lower_end)
+    {
+        if (upper[i].last + 1 < lower[j].first)
+            i++;
+        else if (lower[j].last + 1 < upper[i].first)
+            j++;
+        else
+        {
+            join(parent, upper_offset + i, lower_offset + j);
+
+            if (upper[i].last < lower[j].last)
+                i++;
+            else
+                j++;
+        }
+    }
+}
@@ -0,0 +1,112 @@
+/*
+ * This file is part of pcb2gcode.
+ *
+ * Copyright (C) 2016 the pcb2gcode developers
+ *
+ * pcb2gcode is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * pcb2gcode is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with pcb2gcode.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef COMPONENT_LABELLING_HPP
+#define COMPONENT_LABELLING_HPP
+
+#include <stdint.h>
+
+#include <vector>
+using std::vector;
+using std::pair;
+
+#include <boost/noncopyable.hpp>
+
+#include "raster.hpp"
+#include "run_set.hpp"
+
+/******************************************************************************/
+/*
+ Multi-threaded 8-connected component labelling.
+
+ The image is split in horizontal strips which are labelled in parallel,
+ collecting the horizontal runs of foreground pixels and joining the
+ overlapping ones with a union-find structure; the runs touching across the
+ strip seams are then merged. Runs are numbered in raster order and each
+ union keeps the lowest index as root, so the root of every component is its
+ first run, i.e. the same seed a serial raster scan would find.
+ */
+/******************************************************************************/
+class component_labelling: boost::noncopyable
+{
+public:
+    // A pixel is foreground when (pixel | ignored_bits) == foreground.
+    component_labelling(const labelplane& pixels, uint32_t foreground,
+                        uint32_t ignored_bits);
+
+    // first pixel (in raster order) of each component, in raster order
+    const vector<pair<int, int> >& get_seeds()
+    {
+        return seeds;
+    };
+
+    // paints the i-th component with labels[i]. Only the foreground pixels
+    // are written, so their tiles are already allocated and the strips can
+    // be painted concurrently
+    void paint(labelplane& pixels, const vector<uint32_t>& labels);
+
+    // run-length encoding of each component, in the order of the seeds
+    void get_runs(vector<run_set>& components) const;
+
+protected:
+    struct run
+    {
+        int y;
+        int first;
+        int last;
+    };
+
+    struct strip
+    {
+        int first_row;
+        int end_row;
+        vector<run> runs;
+        vector<uint32_t> parent;    // local indexes while labelling the strip
+        uint32_t offset;            // index of the first run of the strip
+        uint32_t first_row_end;     // local index past the runs of first_row
+        uint32_t last_row_begin;    // local index of the first run of end_row - 1
+    };
+
+    const int width;
+    const int height;
+    const uint32_t foreground;
+    const uint32_t ignored_bits;
+
+    vector<strip> strips;
+    vector<uint32_t> parent;        // global union-find forest
+    vector<uint32_t> component;     // component index of each run
+    vector<pair<int, int> > seeds;
+
+    void label_strips(const labelplane* pixels, int begin, int end);
+    void label_strip(const labelplane& pixels, strip* current);
+    void merge_seams();
+    void paint_strips(labelplane* pixels, const vector<uint32_t>* labels,
+                      int begin, int end);
+    void globalise_strips(int begin, int end);
+
+    static uint32_t find(vector<uint32_t>& parent, uint32_t i);
+    static void join(vector<uint32_t>& parent, uint32_t a, uint32_t b);
+    static void join_rows(vector<uint32_t>& parent, const vector<run>& upper,
+                          uint32_t upper_begin, uint32_t upper_end,
+                          const vector<run>& lower, uint32_t lower_begin,
+                          uint32_t lower_end, uint32_t upper_offset,
+                          uint32_t lower_offset);
+};
+
+#endif // COMPONENT_LABELLING_HPP
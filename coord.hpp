@@ -40,4 +40,9 @@ BOOST_GEOMETRY_REGISTER_POINT_2D(icoordpair, ivalue_t, cs::cartesian, first, sec
 // Adaptation of icoords to Boost Geometry (ring)
 BOOST_GEOMETRY_REGISTER_RING(icoords)
 
+// areas with holes, clockwise and closed (Boost Geometry defaults)
+typedef boost::geometry::model::polygon<icoordpair> ipolygon;
+typedef boost::geometry::model::multi_polygon<ipolygon> imulti_polygon;
+typedef boost::geometry::model::box<icoordpair> ibox;
+
 #endif // COORD_H
@@ -0,0 +1,314 @@
+/*
+ * This file is part of pcb2gcode.
+ *
+ * Copyright (C) 2016 the pcb2gcode developers
+ *
+ * pcb2gcode is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * pcb2gcode is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with pcb2gcode.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "distance_transform.hpp"
+
+#include <algorithm>
+
+static const int offset8[8][2] = { { 1, 0 }, { 1, 1 }, { 0, 1 }, { -1, 1 },
+    { -1, 0 }, { -1, -1 }, { 0, -1 }, { 1, -1 }
+};
+
+/******************************************************************************/
+/*
+ */
+/******************************************************************************/
+distance_transform::distance_transform(const labelplane& pixels,
+                                       const vector<uint32_t>& components,
+                                       bool keep_features, bool square_rings) :
+    width(pixels.get_width()), height(pixels.get_height()),
+    background(pixels.get_background()),
+    nearest(width * height, background), sqdist(width * height, far),
+    reached(-1)
+{
+    if (keep_features)
+        feature.resize(width * height, 0);
+
+    int32_image feature_row(width * height);
+
+    column_pass(pixels, components, feature_row);
+    row_pass(pixels, feature_row);
+
+    if (square_rings)
+    {
+        // the rows of the nearest pixels aren't needed any more
+        chessboard.swap(feature_row);
+        chessboard_passes();
+    }
+}
+
+/******************************************************************************/
+/*
+ First phase: for each pixel, find the row of the nearest component pixel in
+ the same column (-1 if there is none). The columns are scanned row by row
+ to keep the memory accesses sequential.
+ */
+/******************************************************************************/
+void distance_transform::column_pass(const labelplane& pixels,
+                                     const vector<uint32_t>& components,
+                                     int32_image& feature_row)
+{
+    vector<uint32_t> sorted_components(components);
+    std::sort(sorted_components.begin(), sorted_components.end());
+
+    vector<uint32_t> row(width);
+
+    // top-down: nearest component pixel above or at the current one
+    for (int y = 0; y < height; y++)
+    {
+        pixels.get_span(y, 0, width, &row[0]);
+        int32_t* out = &feature_row[y * width];
+        const int32_t* above = y > 0 ? &feature_row[(y - 1) * width] : NULL;
+
+        for (int x = 0; x < width; x++)
+        {
+            if (row[x] != background &&
+                    std::binary_search(sorted_components.begin(),
+                                       sorted_components.end(), row[x]))
+                out[x] = y;
+            else
+                out[x] = above ? above[x] : -1;
+        }
+    }
+
+    // bottom-up: keep the nearest between the one above and the one below
+    for (int y = height - 2; y >= 0; y--)
+    {
+        int32_t* out = &feature_row[y * width];
+        const int32_t* below = &feature_row[(y + 1) * width];
+
+        for (int x = 0; x < width; x++)
+        {
+            if (below[x] > y && (out[x] < 0 || below[x] - y < y - out[x]))
+                out[x] = below[x];
+        }
+    }
+}
+
+/******************************************************************************/
+/*
+ Second phase: for each row, compute the lower envelope of the parabolas
+ (x - u)^2 + g(u)^2, where g(u) is the vertical distance found by the first
+ phase, and store the label and the squared distance of the nearest pixel.
+ */
+/******************************************************************************/
+void distance_transform::row_pass(const labelplane& pixels,
+                                  const int32_image& feature_row)
+{
+    const int64_t inf = width + height;
+    vector<int64_t> g(width);
+    vector<int> s(width);   // column of each parabola of the envelope
+    vector<int> t(width);   // starting point of each parabola
+
+    for (int y = 0; y < height; y++)
+    {
+        const int32_t* row = &feature_row[y * width];
+
+        for (int u = 0; u < width; u++)
+            g[u] = row[u] < 0 ? inf : (row[u] > y ? row[u] - y : y - row[u]);
+
+        int q = 0;
+        s[0] = 0;
+        t[0] = 0;
+
+        for (int u = 1; u < width; u++)
+        {
+            while (q >= 0 && (t[q] - s[q]) * int64_t(t[q] - s[q]) + g[s[q]] * g[s[q]]
+                    > (t[q] - u) * int64_t(t[q] - u) + g[u] * g[u])
+                q--;
+
+            if (q < 0)
+            {
+                q = 0;
+                s[0] = u;
+            }
+            else
+            {
+                const int i = s[q];
+                const int64_t sep = (int64_t(u) * u - int64_t(i) * i
+                                     + g[u] * g[u] - g[i] * g[i]) / (2 * (u - i));
+                const int64_t w = 1 + sep;
+
+                if (w < width)
+                {
+                    q++;
+                    s[q] = u;
+                    t[q] = w;
+                }
+            }
+        }
+
+        uint32_t* nearest_row = &nearest[y * width];
+        uint32_t* sqdist_row = &sqdist[y * width];
+
+        for (int u = width - 1; u >= 0; u--)
+        {
+            const int i = s[q];
+
+            if (row[i] >= 0)
+            {
+                const int64_t d = (u - i) * int64_t(u - i) + g[i] * g[i];
+
+                nearest_row[u] = pixels.get(i, row[i]);
+                sqdist_row[u] = d < far ? d : far;
+
+                if (!feature.empty())
+                    feature[y * width + u] = row[i] * width + i;
+            }
+
+            if (u == t[q])
+                q--;
+        }
+    }
+}
+
+/******************************************************************************/
+/*
+ Chessboard distance from the component pixels (the ones at a null euclidean
+ distance): a forward and a backward pass, each one looking at the 4
+ neighbours already visited, are exact for this metric.
+ */
+/******************************************************************************/
+void distance_transform::chessboard_passes()
+{
+    const int32_t unreached = width + height;
+
+    for (int y = 0; y < height; y++)
+    {
+        int32_t* row = &chessboard[y * width];
+        const int32_t* above = y > 0 ? row - width : NULL;
+        const uint32_t* distances = &sqdist[y * width];
+
+        for (int x = 0; x < width; x++)
+        {
+            int32_t d = distances[x] == 0 ? 0 : unreached;
+
+            if (x > 0)
+                d = std::min(d, row[x - 1] + 1);
+            if (above)
+            {
+                d = std::min(d, above[x] + 1);
+                if (x > 0)
+                    d = std::min(d, above[x - 1] + 1);
+                if (x < width - 1)
+                    d = std::min(d, above[x + 1] + 1);
+            }
+
+            row[x] = d;
+        }
+    }
+
+    for (int y = height - 1; y >= 0; y--)
+    {
+        int32_t* row = &chessboard[y * width];
+        const int32_t* below = y < height - 1 ? row + width : NULL;
+
+        for (int x = width - 1; x >= 0; x--)
+        {
+            int32_t d = row[x];
+
+            if (x < width - 1)
+                d = std::min(d, row[x + 1] + 1);
+            if (below)
+            {
+                d = std::min(d, below[x] + 1);
+                if (x > 0)
+                    d = std::min(d, below[x - 1] + 1);
+                if (x < width - 1)
+                    d = std::min(d, below[x + 1] + 1);
+            }
+
+            row[x] = d;
+        }
+    }
+}
+
+/******************************************************************************/
+/*
+ */
+/******************************************************************************/
+unsigned int distance_transform::grow(labelplane& pixels, double radius,
+                                      int& contentions)
+{
+    unsigned int pixels_changed = 0;
+
+    for (int y = 1; y < height - 1; y++)
+    {
+        for (int x = 1; x < width - 1; x++)
+        {
+            const int i = y * width + x;
+            const uint32_t pixel = pixels.get(x, y);
+            const uint32_t label = nearest[i];
+            const uint32_t dist = sqdist[i];
+
+            // component pixels, obstacles and pixels out of reach
+            if (dist == 0 || !reaches(i, radius) ||
+                    (pixel != background && pixel != label))
+                continue;
+
+            // blocked by anything, or by another component
+            bool blocked = false;
+            bool contended = false;
+
+            for (int j = 0; j < 8 && !contended; j++)
+            {
+                const int nx = x + offset8[j][0];
+                const int ny = y + offset8[j][1];
+                const int n = ny * width + nx;
+                const uint32_t other = pixels.get(nx, ny);
+
+                if (sqdist[n] != 0 && reaches(n, radius) &&
+                        nx > 0 && ny > 0 && nx < width - 1 && ny < height - 1 &&
+                        (other == background || other == nearest[n]))
+                {
+                    // the neighbour is going to be claimed too: the nearest
+                    // one wins, the lower label breaks the ties
+                    contended = nearest[n] != label &&
+                                (sqdist[n] < dist ||
+                                 (sqdist[n] == dist && nearest[n] < label));
+                    blocked |= contended;
+                }
+                else if (other != background && other != label)
+                {
+                    // anything that is not background or ours blocks us, but
+                    // only the pixels of the components (their own nearest
+                    // label) contend for it, not the obstacles
+                    blocked = true;
+                    contended = other == nearest[n];
+                }
+            }
+
+            if (blocked)
+            {
+                // counted once, when first reached
+                if (contended && (reached < 0 || !reaches(i, reached)))
+                    contentions++;
+            }
+            else if (pixel == background)
+            {
+                pixels.set(x, y, label);
+                pixels_changed++;
+            }
+        }
+    }
+
+    reached = std::max(reached, radius);
+
+    return pixels_changed;
+}
@@ -0,0 +1,125 @@
+/*
+ * This file is part of pcb2gcode.
+ *
+ * Copyright (C) 2016 the pcb2gcode developers
+ *
+ * pcb2gcode is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * pcb2gcode is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with pcb2gcode.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef DISTANCE_TRANSFORM_HPP
+#define DISTANCE_TRANSFORM_HPP
+
+#include <stdint.h>
+
+#include <vector>
+using std::vector;
+
+#include <boost/noncopyable.hpp>
+
+#include "raster.hpp"
+#include "scratch_memory.hpp"
+
+/******************************************************************************/
+/*
+ Labelled euclidean distance transform (feature transform).
+
+ For every pixel of a label image, the nearest pixel belonging to one of the
+ given component labels is computed in linear time (Meijster, Roerdink and
+ Hesselink, "A general algorithm for computing distance transforms in linear
+ time"). The squared distance and the label of that nearest pixel are stored,
+ so that the isolation area of all the components can be obtained for any
+ radius by a simple thresholding, without retracing the outlines.
+
+ The outline engine grows the components by square rings of pixels, so its
+ isolation areas reach the pixels within a chessboard distance of the
+ copper. With square_rings the same chessboard distance is computed (by two
+ chamfer passes) and thresholded instead of the euclidean one, which keeps
+ the corners of the areas square like the ones of the outline engine; the
+ euclidean transform still decides which component owns a pixel.
+
+ The images take 8 bytes per pixel, plus 4 for the chessboard distance or
+ the features, and 4 more during the construction.
+
+ Pixels that are neither background nor component (e.g. the masked area
+ outside the outline) are obstacles: they are never claimed and no component
+ is allowed to touch them, exactly like in Surface::allow_grow.
+ */
+/******************************************************************************/
+class distance_transform: boost::noncopyable
+{
+public:
+    // components must contain the label of every component that has to grow;
+    // keep_features also stores the position of the nearest component pixel,
+    // square_rings the chessboard distance from the components
+    distance_transform(const labelplane& pixels,
+                       const vector<uint32_t>& components,
+                       bool keep_features = false, bool square_rings = false);
+
+    // Assigns every background pixel within radius (in pixels, euclidean or
+    // chessboard with square_rings) to its nearest component, leaving a 1-pixel gap where two labels meet.
+    // Returns the number of pixels changed; the number of pixels that could
+    // not be claimed because of a nearer (or equally near) neighbour is
+    // added to contentions.
+    // grow() can be called multiple times with increasing radii (for the
+    // extra passes) on the same image; each contended pixel is only counted
+    // by the first call that reaches it.
+    unsigned int grow(labelplane& pixels, double radius, int& contentions);
+
+    // label of the nearest component pixel and squared distance from it
+    // (the background label and 0xFFFFFFFF if no component is reachable)
+    uint32_t get_nearest(int x, int y) const
+    {
+        return nearest[y * width + x];
+    }
+    uint32_t get_sqdist(int x, int y) const
+    {
+        return sqdist[y * width + x];
+    }
+    // position of the nearest component pixel, if keep_features was set
+    void get_feature(int x, int y, int& feature_x, int& feature_y) const
+    {
+        feature_x = feature[y * width + x] % width;
+        feature_y = feature[y * width + x] / width;
+    }
+
+protected:
+    const int width;
+    const int height;
+    const uint32_t background;
+
+    // whole images, kept in the scratch memory
+    typedef vector<uint32_t, scratch_allocator<uint32_t> > uint32_image;
+    typedef vector<int32_t, scratch_allocator<int32_t> > int32_image;
+
+    uint32_image nearest;       // label of the nearest component pixel
+    uint32_image sqdist;        // squared distance from it
+    uint32_image feature;       // its index (y * width + x), if requested
+    int32_image chessboard;     // chessboard distance, if requested
+    double reached;             // radius of the last grow(), -1 before it
+
+    static const uint32_t far = 0xFFFFFFFF;
+
+    void column_pass(const labelplane& pixels, const vector<uint32_t>& components,
+                     int32_image& feature_row);
+    void row_pass(const labelplane& pixels, const int32_image& feature_row);
+    void chessboard_passes();
+    // the pixel i is within radius of its nearest component
+    bool reaches(int i, double radius) const
+    {
+        return chessboard.empty() ? sqdist[i] <= radius * radius :
+               chessboard[i] <= radius;
+    }
+};
+
+#endif // DISTANCE_TRANSFORM_HPP
@@ -17,25 +17,436 @@
  * along with pcb2gcode.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <algorithm>
+#include <cmath>
 #include <iostream>
+using std::cerr;
 #include "gerberimporter.hpp"
+#include "shapes.hpp"
+#include "vector_isolation.hpp"
+#include <boost/foreach.hpp>
 #include <boost/scoped_array.hpp>
+#include <boost/shared_ptr.hpp>
+using boost::shared_ptr;
+
+namespace
+{
+
+using shapes::affine;
+
+/******************************************************************************/
+/*
+ the primitives of a macro aperture, simplified by gerbv: their parameters
+ are evaluated and converted to inches, and each rotation is around the
+ centre of the aperture
+ */
+/******************************************************************************/
+void macro_flash(const gerbv_simplified_amacro_t* primitive, double tolerance,
+                 imulti_polygon& result)
+{
+    result.clear();
+
+    for (; primitive; primitive = primitive->next)
+    {
+        imulti_polygon shape;
+        bool on;
+        int code;
+
+        switch (primitive->type)
+        {
+        case GERBV_APTYPE_MACRO_CIRCLE:
+            code = 1;
+            break;
+        case GERBV_APTYPE_MACRO_OUTLINE:
+            code = 4;
+            break;
+        case GERBV_APTYPE_MACRO_POLYGON:
+            code = 5;
+            break;
+        case GERBV_APTYPE_MACRO_MOIRE:
+            code = 6;
+            break;
+        case GERBV_APTYPE_MACRO_THERMAL:
+            code = 7;
+            break;
+        case GERBV_APTYPE_MACRO_LINE20:
+            code = 20;
+            break;
+        case GERBV_APTYPE_MACRO_LINE21:
+            code = 21;
+            break;
+        case GERBV_APTYPE_MACRO_LINE22:
+            code = 22;
+            break;
+        default:
+            continue;
+        }
+
+        if (shapes::macro_primitive(code, primitive->parameter, tolerance, shape, on))
+            shapes::expose(shape, on, result);
+    }
+}
+
+/******************************************************************************/
+/*
+ the shape flashed by an aperture, centred on the origin
+ */
+/******************************************************************************/
+void flash(const gerbv_aperture_t* aperture, double tolerance, imulti_polygon& result)
+{
+    shapes::aperture_type type;
+
+    result.clear();
+
+    switch (aperture->type)
+    {
+    case GERBV_APTYPE_CIRCLE:
+        type = shapes::APERTURE_CIRCLE;
+        break;
+
+    case GERBV_APTYPE_RECTANGLE:
+        type = shapes::APERTURE_RECTANGLE;
+        break;
+
+    case GERBV_APTYPE_OVAL:
+        type = shapes::APERTURE_OVAL;
+        break;
+
+    case GERBV_APTYPE_POLYGON:
+        type = shapes::APERTURE_POLYGON;
+        break;
+
+    case GERBV_APTYPE_MACRO:
+        macro_flash(aperture->simplified, tolerance, result);
+        return;
+
+    default:
+        return;
+    }
+
+    shapes::standard_flash(type, aperture->parameter, aperture->nuf_parameters,
+                           tolerance, result);
+}
+
+/******************************************************************************/
+/*
+ the area drawn by an aperture along a linear or circular segment
+ */
+/******************************************************************************/
+void stroke(const gerbv_net_t* net, const gerbv_aperture_t* aperture,
+            double tolerance, imulti_polygon& result)
+{
+    const bool circular = net->interpolation == GERBV_INTERPOLATION_CW_CIRCULAR ||
+                          net->interpolation == GERBV_INTERPOLATION_CCW_CIRCULAR;
+    const gerbv_cirseg_t* cirseg = net->cirseg;
+
+    result.clear();
+
+    if (circular && cirseg)
+        shapes::arc_stroke(cirseg->cp_x, cirseg->cp_y, cirseg->width / 2,
+                           cirseg->angle1 * M_PI / 180, cirseg->angle2 * M_PI / 180,
+                           aperture->parameter[0], tolerance, result);
+    else if (aperture->type == GERBV_APTYPE_RECTANGLE)
+        result.push_back(shapes::rectangle_stroke(net->start_x, net->start_y,
+                                                  net->stop_x, net->stop_y,
+                                                  aperture->parameter[0],
+                                                  aperture->parameter[1]));
+    else
+        result.push_back(shapes::round_stroke(net->start_x, net->start_y, net->stop_x,
+                                              net->stop_y, aperture->parameter[0],
+                                              tolerance));
+}
+
+/******************************************************************************/
+/*
+ the area of the region starting with the PAREA_START net start; a move
+ closes the current contour and starts the next one. Returns the PAREA_END
+ net, or NULL at the end of the netlist.
+ */
+/******************************************************************************/
+const gerbv_net_t* region(const gerbv_net_t* start, double tolerance,
+                          imulti_polygon& result)
+{
+    const gerbv_net_t* net;
+    ipolygon contour;
+
+    result.clear();
+
+    for (net = start->next; net && net->interpolation != GERBV_INTERPOLATION_PAREA_END;
+            net = net->next)
+    {
+        ipolygon::ring_type& ring = contour.outer();
+
+        if (net->interpolation == GERBV_INTERPOLATION_DELETED)
+            continue;
+
+        if (net->aperture_state != GERBV_APERTURE_STATE_ON)
+        {
+            shapes::add_contour(contour, result);
+            contour.outer().push_back(icoordpair(net->stop_x, net->stop_y));
+            continue;
+        }
+
+        if (ring.empty())
+            ring.push_back(icoordpair(net->start_x, net->start_y));
+
+        if ((net->interpolation == GERBV_INTERPOLATION_CW_CIRCULAR ||
+                net->interpolation == GERBV_INTERPOLATION_CCW_CIRCULAR) && net->cirseg)
+        {
+            shapes::append_arc(ring, net->cirseg->cp_x, net->cirseg->cp_y,
+                               net->cirseg->width / 2, net->cirseg->angle1 * M_PI / 180,
+                               net->cirseg->angle2 * M_PI / 180, tolerance, false);
+            ring.back() = icoordpair(net->stop_x, net->stop_y);
+        }
+        else
+            ring.push_back(icoordpair(net->stop_x, net->stop_y));
+    }
+
+    shapes::add_contour(contour, result);
+
+    return net;
+}
+
+/******************************************************************************/
+/*
+ where a net drawn by the i-th step along x and the j-th step along y of its
+ layer ends up: gerbv applies the transformations of the net state (axis
+ select, mirroring, offset, scaling), then the rotation of the layer, then
+ the rotation and the offset of the image
+ */
+/******************************************************************************/
+affine placement(const gerbv_image_t* image, const gerbv_net_t* net, int i, int j)
+{
+    affine t = affine::translation(i * net->layer->stepAndRepeat.dist_X,
+                                   j * net->layer->stepAndRepeat.dist_Y);
+    const gerbv_netstate_t* state = net->state;
+
+    if (state)
+    {
+        if (state->axisSelect == GERBV_AXIS_SELECT_SWAPAB)
+        {
+            const affine swap = { 0, 1, 0, 1, 0, 0 };
+            t = t.then(swap);
+        }
+
+        t = t.then(affine::scaling(
+                       state->mirrorState == GERBV_MIRROR_STATE_FLIPA ||
+                       state->mirrorState == GERBV_MIRROR_STATE_FLIPAB ? -1 : 1,
+                       state->mirrorState == GERBV_MIRROR_STATE_FLIPB ||
+                       state->mirrorState == GERBV_MIRROR_STATE_FLIPAB ? -1 : 1));
+        t = t.then(affine::translation(state->offsetA, state->offsetB));
+        t = t.then(affine::scaling(state->scaleA, state->scaleB));
+    }
+
+    t = t.then(affine::rotation(net->layer->rotation));
+    t = t.then(affine::rotation(image->info->imageRotation));
+
+    return t.then(affine::translation(image->info->offsetA, image->info->offsetB));
+}
+
+/******************************************************************************/
+/*
+ appends to batch the copies of the shape of a net made by the step and
+ repeat of its layer
+ */
+/******************************************************************************/
+void place(const gerbv_image_t* image, const gerbv_net_t* net,
+           const imulti_polygon& shape, vector<imulti_polygon>& batch)
+{
+    const int repeat_x = std::max(net->layer->stepAndRepeat.X, 1);
+    const int repeat_y = std::max(net->layer->stepAndRepeat.Y, 1);
+
+    for (int i = 0; i < repeat_x; i++)
+        for (int j = 0; j < repeat_y; j++)
+        {
+            batch.push_back(shape);
+            shapes::transform(placement(image, net, i, j), batch.back());
+        }
+}
+
+}
+
+/******************************************************************************/
+/*
+ */
+/******************************************************************************/
+GerberImporter::GerberImporter(const string path) : path(path)
+{
+    project = open_project();
+
+    if (!project)
+        throw gerber_exception();
+
+    copies.push_back(project);
+    idle.push_back(project);
+
+    prepare_stamps();
+}
 
 /******************************************************************************/
 /*
+ the flashes are only stamped, after everything else, when drawing them in
+ another order can't change the image: a positive image whose layers are all
+ dark, without knockouts
  */
 /******************************************************************************/
-GerberImporter::GerberImporter(const string path)
+void GerberImporter::prepare_stamps()
 {
-    project = gerbv_create_project();
+    const gerbv_image_t* image = project->file[0]->image;
+
+    if (image->info->polarity == GERBV_POLARITY_NEGATIVE)
+        return;
+
+    for (const gerbv_net_t* net = image->netlist; net; net = net->next)
+    {
+        if (net->layer && (net->layer->polarity == GERBV_POLARITY_CLEAR ||
+                           net->layer->knockout.type != GERBV_KNOCKOUT_TYPE_NOKNOCKOUT))
+            return;
+    }
+
+    flash_shapes.resize(APERTURE_MAX);
+    flash_diameters.resize(APERTURE_MAX, 0);
+
+    for (int i = 0; i < APERTURE_MAX; i++)
+    {
+        const gerbv_aperture_t* aperture = image->aperture[i];
+
+        if (!aperture)
+            continue;
+
+        flash(aperture, vector_isolation::get_tolerance(), flash_shapes[i]);
+
+        // a circle without a hole
+        if (aperture->type == GERBV_APTYPE_CIRCLE &&
+                (aperture->nuf_parameters < 2 || aperture->parameter[1] <= 0))
+            flash_diameters[i] = aperture->parameter[0];
+    }
+}
+
+/******************************************************************************/
+/*
+ a flash is only hidden if all its step and repeats have a stamp, i.e. if
+ they are only translated and small enough
+ */
+/******************************************************************************/
+void GerberImporter::stamp_flashes(gerbv_project_t* copy,
+                                   Cairo::RefPtr<Cairo::ImageSurface> surface,
+                                   const guint dpi, const double min_x,
+                                   const double min_y, const bool antialias,
+                                   vector<gerbv_net_t*>& hidden,
+                                   vector<stamped_flash>& flashes)
+{
+    const gerbv_image_t* image = copy->file[0]->image;
+
+    for (gerbv_net_t* net = image->netlist; net; net = net->next)
+    {
+        if (net->aperture_state != GERBV_APERTURE_STATE_FLASH ||
+                net->interpolation == GERBV_INTERPOLATION_DELETED || !net->layer ||
+                net->aperture < 0 || net->aperture >= APERTURE_MAX ||
+                flash_shapes[net->aperture].empty())
+            continue;
+
+        const unsigned int first = flashes.size();
+        const int repeat_x = std::max(net->layer->stepAndRepeat.X, 1);
+        const int repeat_y = std::max(net->layer->stepAndRepeat.Y, 1);
+        bool stamped = true;
+
+        for (int i = 0; i < repeat_x && stamped; i++)
+            for (int j = 0; j < repeat_y && stamped; j++)
+            {
+                const affine t = placement(image, net, i, j);
+                icoordpair centre(net->stop_x, net->stop_y);
+                stamped_flash flash;
+
+                // the stamps are only cached in the coordinates of the image
+                if (t.xx != 1 || t.xy != 0 || t.yx != 0 || t.yy != 1)
+                {
+                    stamped = false;
+                    break;
+                }
+
+                t(centre);
+                flash.stamp = stamps.get(net->aperture, flash_shapes[net->aperture],
+                                         flash_diameters[net->aperture], dpi,
+                                         (centre.first - min_x) * dpi,
+                                         surface->get_height() - (centre.second - min_y) * dpi,
+                                         antialias, flash.x, flash.y);
+                stamped = flash.stamp.get() != NULL;
+
+                if (stamped)
+                    flashes.push_back(flash);
+            }
+
+        if (stamped)
+        {
+            net->aperture_state = GERBV_APERTURE_STATE_OFF;
+            hidden.push_back(net);
+        }
+        else
+            flashes.resize(first);
+    }
+}
+
+/******************************************************************************/
+/*
+ NULL if the file can't be imported
+ */
+/******************************************************************************/
+gerbv_project_t* GerberImporter::open_project()
+{
+    gerbv_project_t* new_project = gerbv_create_project();
 
     const char* cfilename = path.c_str();
     boost::scoped_array<char> filename(new char[strlen(cfilename) + 1]);
     strcpy(filename.get(), cfilename);
 
-    gerbv_open_layer_from_filename(project, filename.get());
-    if (project->file[0] == NULL)
-        throw gerber_exception();
+    gerbv_open_layer_from_filename(new_project, filename.get());
+    if (new_project->file[0] == NULL)
+    {
+        gerbv_destroy_project(new_project);
+        return NULL;
+    }
+
+    return new_project;
+}
+
+/******************************************************************************/
+/*
+ the copies are parsed here, one at a time, as the gerbv parser isn't
+ reentrant
+ */
+/******************************************************************************/
+unsigned int GerberImporter::prepare_concurrent_render(unsigned int count)
+{
+    boost::mutex::scoped_lock lock(idle_mutex);
+
+    while (copies.size() < count)
+    {
+        gerbv_project_t* copy = open_project();
+
+        if (!copy)
+            break;
+
+        copies.push_back(copy);
+        idle.push_back(copy);
+    }
+
+    return std::min<unsigned int>(copies.size(), count);
+}
+
+/******************************************************************************/
+/*
+ the nets take most of the memory of a project, a copy at least that much
+ */
+/******************************************************************************/
+size_t GerberImporter::get_render_copy_bytes()
+{
+    size_t nets = 0;
+
+    for (const gerbv_net_t* net = project->file[0]->image->netlist; net; net = net->next)
+        nets++;
+
+    return nets * sizeof(gerbv_net_t);
 }
 
 /******************************************************************************/
@@ -115,8 +526,28 @@ gdouble GerberImporter::get_max_y()
 /*
  */
 /******************************************************************************/
-void GerberImporter::render(Cairo::RefPtr<Cairo::ImageSurface> surface, const guint dpi, const double min_x, const double min_y) throw (import_exception)
+void GerberImporter::render(Cairo::RefPtr<Cairo::ImageSurface> surface, const guint dpi, const double min_x, const double min_y, const bool antialias) throw (import_exception)
 {
+    gerbv_project_t* copy;
+
+    {
+        boost::mutex::scoped_lock lock(idle_mutex);
+
+        while (idle.empty())
+            idle_changed.wait(lock);
+
+        copy = idle.back();
+        idle.pop_back();
+    }
+
+    // the flashes that can be stamped are hidden from libgerbv, in this
+    // copy only, while it renders the other nets
+    vector<gerbv_net_t*> hidden;
+    vector<stamped_flash> flashes;
+
+    if (!flash_shapes.empty())
+        stamp_flashes(copy, surface, dpi, min_x, min_y, antialias, hidden, flashes);
+
     gerbv_render_info_t render_info;
 
     render_info.scaleFactorX = dpi;
@@ -125,24 +556,151 @@ void GerberImporter::render(Cairo::RefPtr<Cairo::ImageSurface> surface, const gu
     render_info.lowerLeftY = min_y;
     render_info.displayWidth = surface->get_width();
     render_info.displayHeight = surface->get_height();
-    render_info.renderType = GERBV_RENDER_TYPE_CAIRO_NORMAL;
+    // the normal mode doesn't antialias
+    render_info.renderType = antialias ? GERBV_RENDER_TYPE_CAIRO_HIGH_QUALITY :
+                             GERBV_RENDER_TYPE_CAIRO_NORMAL;
 
     GdkColor color_saturated_white = { 0xFFFFFFFF, 0xFFFF, 0xFFFF, 0xFFFF };
-    project->file[0]->color = color_saturated_white;
+    copy->file[0]->color = color_saturated_white;
 
     cairo_t* cr = cairo_create(surface->cobj());
-    gerbv_render_layer_to_cairo_target(cr, project->file[0], &render_info);
+    gerbv_render_layer_to_cairo_target(cr, copy->file[0], &render_info);
 
     cairo_destroy(cr);
 
+    BOOST_FOREACH(gerbv_net_t* net, hidden)
+    {
+        net->aperture_state = GERBV_APERTURE_STATE_FLASH;
+    }
+
+    if (!flashes.empty())
+    {
+        surface->flush();
+
+        BOOST_FOREACH(const stamped_flash& flash, flashes)
+        {
+            stamp_cache::blit(*flash.stamp, flash.x, flash.y, false, surface);
+        }
+
+        surface->mark_dirty();
+    }
+
+    {
+        boost::mutex::scoped_lock lock(idle_mutex);
+
+        idle.push_back(copy);
+    }
+
+    idle_changed.notify_one();
+
     /// @todo check wheter importing was successful
 }
 
+/******************************************************************************/
+/*
+ the shapes are united in batches of nets with the same polarity, and each
+ flashed aperture is only built once
+ */
+/******************************************************************************/
+bool GerberImporter::vectorise(imulti_polygon& copper, double tolerance)
+{
+    if (!project || !project->file[0])
+        throw gerber_exception();
+
+    const gerbv_image_t* image = project->file[0]->image;
+    vector<shared_ptr<imulti_polygon> > flashes(APERTURE_MAX);
+    vector<imulti_polygon> batch;
+    bool batch_clear = false;
+
+    copper.clear();
+
+    try
+    {
+        for (const gerbv_net_t* net = image->netlist; net; net = net->next)
+        {
+            if (net->interpolation == GERBV_INTERPOLATION_DELETED || !net->layer)
+                continue;
+
+            const bool clear = net->layer->polarity == GERBV_POLARITY_CLEAR;
+            imulti_polygon shape;
+
+            if (clear != batch_clear)
+            {
+                shapes::merge_batch(batch, batch_clear, copper);
+                batch_clear = clear;
+            }
+
+            if (net->interpolation == GERBV_INTERPOLATION_PAREA_START)
+            {
+                const gerbv_net_t* end = region(net, tolerance, shape);
+
+                place(image, net, shape, batch);
+
+                if (!end)
+                    break;
+
+                net = end;
+                continue;
+            }
+
+            if (net->aperture < 0 || net->aperture >= APERTURE_MAX ||
+                    !image->aperture[net->aperture])
+                continue;
+
+            const gerbv_aperture_t* aperture = image->aperture[net->aperture];
+
+            if (net->aperture_state == GERBV_APERTURE_STATE_FLASH)
+            {
+                shared_ptr<imulti_polygon>& stamp = flashes[net->aperture];
+
+                if (!stamp)
+                {
+                    stamp = shared_ptr<imulti_polygon>(new imulti_polygon());
+                    flash(aperture, tolerance, *stamp);
+                }
+
+                shape = *stamp;
+                shapes::transform(affine::translation(net->stop_x, net->stop_y), shape);
+            }
+            else if (net->aperture_state == GERBV_APERTURE_STATE_ON)
+                stroke(net, aperture, tolerance, shape);
+            else
+                continue;
+
+            place(image, net, shape, batch);
+        }
+
+        shapes::merge_batch(batch, batch_clear, copper);
+
+        // a negative image is clear where the nets are drawn
+        if (image->info->polarity == GERBV_POLARITY_NEGATIVE)
+        {
+            imulti_polygon board =
+                shapes::single(shapes::rectangle((get_min_x() + get_max_x()) / 2,
+                                                 (get_min_y() + get_max_y()) / 2,
+                                                 get_width(), get_height()));
+
+            shapes::expose(copper, false, board);
+            copper.swap(board);
+        }
+    }
+    catch (const boost::geometry::exception& e)
+    {
+        cerr << "\nWarning: the polygons of " << path << " can't be built ("
+             << e.what() << "); the layer will be rasterised.\n";
+        copper.clear();
+        return false;
+    }
+
+    return true;
+}
+
 /******************************************************************************/
 /*
  */
 /******************************************************************************/
 GerberImporter::~GerberImporter()
 {
-    gerbv_destroy_project(project);
+    for (unsigned int i = 0; i < copies.size(); i++)
+        gerbv_destroy_project(copies[i]);
 }
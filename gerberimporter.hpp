@@ -22,8 +22,14 @@
 
 #include <string>
 using std::string;
+#include <vector>
+using std::vector;
+
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
 
 #include "importer.hpp"
+#include "stamp_cache.hpp"
 
 extern "C" {
 #include <gerbv.h>
@@ -39,6 +45,12 @@ struct gerber_exception: virtual import_exception
 
  GerberImporter is using libgerbv and hence features its suberb support for
  different file formats and gerber dialects.
+
+ When all the nets of the image are dark, the order they are drawn in
+ doesn't matter: libgerbv then draws everything but the flashes, and the
+ flashes are copied from a stamp_cache afterwards, like the native importer
+ does. The flashes transformed by more than a translation, or too large for
+ a stamp, are left to libgerbv.
  */
 /******************************************************************************/
 class GerberImporter: virtual public LayerImporter
@@ -53,15 +65,52 @@ public:
     virtual gdouble get_min_y();
     virtual gdouble get_max_y();
 
+    // render() can run concurrently on different surfaces, each call using
+    // its own copy of the gerbv project
     virtual void render(Cairo::RefPtr<Cairo::ImageSurface> surface,
                         const guint dpi, const double min_x,
-                        const double min_y) throw (import_exception);
+                        const double min_y, const bool antialias)
+    throw (import_exception);
+    virtual unsigned int prepare_concurrent_render(unsigned int count);
+    // estimated from the size of the netlist
+    virtual size_t get_render_copy_bytes();
+    // draws, flashes and regions of the netlist, with their polarities, step
+    // and repeats and transformations
+    virtual bool vectorise(imulti_polygon& copper, double tolerance);
 
     virtual ~GerberImporter();
 protected:
+    gerbv_project_t* open_project();
+    // a flash copied from its stamp, with its centre in the pixel x, y
+    struct stamped_flash
+    {
+        shared_ptr<const stamp_cache::stamp> stamp;
+        int x, y;
+    };
+
+    // the shapes of the flashed apertures, if the flashes can be stamped
+    void prepare_stamps();
+    // hides from libgerbv the flashes of the image of copy that can be
+    // stamped, appending them to hidden and their stamps to flashes
+    void stamp_flashes(gerbv_project_t* copy, Cairo::RefPtr<Cairo::ImageSurface> surface,
+                       const guint dpi, const double min_x, const double min_y,
+                       const bool antialias, vector<gerbv_net_t*>& hidden,
+                       vector<stamped_flash>& flashes);
+
 private:
+    const string path;
 
     gerbv_project_t* project;
+    // the copies of the project, and the ones no render() is using
+    vector<gerbv_project_t*> copies;
+    vector<gerbv_project_t*> idle;
+    boost::mutex idle_mutex;
+    boost::condition_variable idle_changed;
+
+    // indexed by aperture, empty if the flashes can't be stamped
+    vector<imulti_polygon> flash_shapes;
+    vector<double> flash_diameters;     // of the round apertures, 0 otherwise
+    stamp_cache stamps;
 };
 
 #endif // GERBERIMPORTER_H
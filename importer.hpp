@@ -28,6 +28,8 @@ using Glib::ustring;
 #include <gdk/gdkcairo.h>
 
 #include <boost/exception/all.hpp>
+
+#include "coord.hpp"
 struct import_exception: virtual std::exception, virtual boost::exception
 {
 };
@@ -48,10 +50,33 @@ public:
     virtual gdouble get_min_y() = 0;
     virtual gdouble get_max_y() = 0;
 
+    // antialias selects an anti-aliased rendering, for the coverage buffers
     virtual void render(Cairo::RefPtr<Cairo::ImageSurface> surface,
-                        const guint dpi, const double xoff, const double yoff)
+                        const guint dpi, const double xoff, const double yoff,
+                        const bool antialias)
     throw (import_exception) = 0;
 
+    // Prepares up to count render() calls running at the same time on
+    // different surfaces, and returns how many can; by default render() is
+    // not reentrant.
+    virtual unsigned int prepare_concurrent_render(unsigned int count)
+    {
+        return 1;
+    }
+    // memory taken by each render() prepared beyond the first one, when they
+    // need their own copy of the layer
+    virtual size_t get_render_copy_bytes()
+    {
+        return 0;
+    }
+
+    // Builds the copper of the layer as polygons, in board coordinates, with
+    // the curves approximated within tolerance, for the vector growth
+    // engine. Returns false if the layer can only be rendered.
+    virtual bool vectorise(imulti_polygon& copper, double tolerance)
+    {
+        return false;
+    }
 };
 
 #endif // IMPORTER_H
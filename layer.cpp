@@ -35,6 +35,21 @@ Layer::Layer(const string& name, shared_ptr<Surface> surface,
     this->manufacturer = manufacturer;
 }
 
+/******************************************************************************/
+/*
+ */
+/******************************************************************************/
+Layer::Layer(const string& name, shared_ptr<vector_isolation> vectors,
+             shared_ptr<RoutingMill> manufacturer, bool backside,
+             bool mirror_absolute)
+{
+    this->name = name;
+    this->mirrored = backside;
+    this->mirror_absolute = mirror_absolute;
+    this->vectors = vectors;
+    this->manufacturer = manufacturer;
+}
+
 #include <iostream>
 
 /******************************************************************************/
@@ -43,6 +58,9 @@ Layer::Layer(const string& name, shared_ptr<Surface> surface,
 /******************************************************************************/
 vector<shared_ptr<icoords> > Layer::get_toolpaths()
 {
+    if (vectors)
+        return vectors->get_toolpath(manufacturer, mirrored, mirror_absolute);
+
     return surface->get_toolpath(manufacturer, mirrored, mirror_absolute);
 }
 
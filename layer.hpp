@@ -30,6 +30,7 @@ using std::vector;
 
 #include "coord.hpp"
 #include "surface.hpp"
+#include "vector_isolation.hpp"
 #include "mill.hpp"
 
 /******************************************************************************/
@@ -42,6 +43,10 @@ public:
     Layer(const string& name, shared_ptr<Surface> surface,
           shared_ptr<RoutingMill> manufacturer, bool backside,
           bool mirror_absolute);
+    // a layer isolated by the vector engine, which has no surface
+    Layer(const string& name, shared_ptr<vector_isolation> vectors,
+          shared_ptr<RoutingMill> manufacturer, bool backside,
+          bool mirror_absolute);
 
     vector<shared_ptr<icoords> > get_toolpaths();
     shared_ptr<RoutingMill> get_manufacturer();
@@ -58,6 +63,7 @@ private:
     bool mirrored;
     bool mirror_absolute;
     shared_ptr<Surface> surface;
+    shared_ptr<vector_isolation> vectors;
     shared_ptr<RoutingMill> manufacturer;
 
     friend class Board;
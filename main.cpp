@@ -38,12 +38,15 @@ using Glib::ustring;
 using Glib::build_filename;
 
 #include "gerberimporter.hpp"
+#include "rs274ximporter.hpp"
 #include "surface.hpp"
 #include "ngc_exporter.hpp"
 #include "board.hpp"
 #include "drill.hpp"
 #include "options.hpp"
 #include "svg_exporter.hpp"
+#include "parallel.hpp"
+#include "scratch_memory.hpp"
 
 #include <boost/shared_ptr.hpp>
 #include <boost/foreach.hpp>
@@ -52,6 +55,21 @@ using Glib::build_filename;
 #include <fstream>
 #include <sstream>
 
+/******************************************************************************/
+/*
+ the importer of a gerber layer, as selected by --gerber-parser
+ */
+/******************************************************************************/
+static boost::shared_ptr<LayerImporter> import_layer(const po::variables_map& vm,
+        const string& path)
+{
+    if (boost::iequals(vm["gerber-parser"].as<string>(), "native"))
+        return boost::shared_ptr<LayerImporter>(new RS274XImporter(path,
+                boost::iequals(vm["rasteriser"].as<string>(), "scanline")));
+    else
+        return boost::shared_ptr<LayerImporter>(new GerberImporter(path));
+}
+
 /******************************************************************************/
 /*
  */
@@ -90,7 +108,13 @@ int main(int argc, char* argv[])
     //---------------------------------------------------------------------------
     //prepare environment:
 
+    parallel::set_threads(vm["threads"].as<unsigned int>());
+
     const string outputdir = vm["output-dir"].as<string>();
+
+    if (vm["mmap-scratch"].as<bool>())
+        scratch_memory::set_directory(outputdir.empty() ? "." : outputdir);
+
     shared_ptr<Isolator> isolator;
 
     if (vm.count("front") || vm.count("back"))
@@ -107,7 +131,11 @@ int main(int argc, char* argv[])
         isolator->speed = vm["mill-speed"].as<int>();
         isolator->zchange = vm["zchange"].as<double>() * unit;
         isolator->extra_passes = vm["extra-passes"].as<int>();
+        isolator->offset_passes = vm["offset-passes"].as<bool>();
         isolator->optimise = vm["optimise"].as<bool>();
+        isolator->growth_engine = growthEngine(vm);
+        isolator->contour_mode = contourMode(vm);
+        isolator->refine_dpi = vm["refine-dpi"].as<int>();
     }
 
     shared_ptr<Cutter> cutter;
@@ -128,6 +156,8 @@ int main(int argc, char* argv[])
         cutter->do_steps = true;
         cutter->stepsize = vm["cut-infeed"].as<double>() * unit;
         cutter->optimise = vm["optimise"].as<bool>();
+        cutter->growth_engine = growthEngine(vm);
+        cutter->contour_mode = contourMode(vm);
         cutter->bridges_num = vm["bridgesnum"].as<unsigned int>();
         cutter->bridges_width = vm["bridges"].as<double>() * unit;
         if (vm.count("zbridges"))
@@ -237,6 +267,8 @@ int main(int argc, char* argv[])
             INFINITY,
             outputdir));
 
+    board->set_max_memory(size_t(vm["max-memory"].as<unsigned int>()) << 20);
+
     // this is currently disabled, use --outline instead
     if (vm.count("margins"))
     {
@@ -255,8 +287,7 @@ int main(int argc, char* argv[])
         try
         {
             string frontfile = vm["front"].as<string>();
-            boost::shared_ptr<LayerImporter> importer(
-                new GerberImporter(frontfile));
+            boost::shared_ptr<LayerImporter> importer = import_layer(vm, frontfile);
             board->prepareLayer("front", importer, isolator, false,
                                 vm["mirror-absolute"].as<bool>());
             cout << "DONE.\n";
@@ -276,8 +307,7 @@ int main(int argc, char* argv[])
         try
         {
             string backfile = vm["back"].as<string>();
-            boost::shared_ptr<LayerImporter> importer(
-                new GerberImporter(backfile));
+            boost::shared_ptr<LayerImporter> importer = import_layer(vm, backfile);
             board->prepareLayer("back", importer, isolator, true,
                                 vm["mirror-absolute"].as<bool>());
             cout << "DONE.\n";
@@ -297,7 +327,7 @@ int main(int argc, char* argv[])
         try
         {
             string outline = vm["outline"].as<string>();                               //Filename
-            boost::shared_ptr<LayerImporter> importer(new GerberImporter(outline));
+            boost::shared_ptr<LayerImporter> importer = import_layer(vm, outline);
             board->prepareLayer("outline", importer, cutter, !workSide(vm, "cut"),
                                 vm["mirror-absolute"].as<bool>());
 
@@ -362,6 +392,13 @@ int main(int argc, char* argv[])
         tileInfo = new Tiling::TileInfo;
         *tileInfo = exporter->getTileInfo();
     }
+    catch (memory_exception& me)
+    {
+        if (ustring const* mes = boost::get_error_info<errorstring>(me))
+            cerr << "Error: " << *mes << "\n";
+
+        exit(ERR_MAXMEMORY);
+    }
     catch (std::logic_error& le)
     {
         cout << "Internal Error: " << le.what() << endl;
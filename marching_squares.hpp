@@ -0,0 +1,134 @@
+/*
+ * This file is part of pcb2gcode.
+ *
+ * Copyright (C) 2016 the pcb2gcode developers
+ *
+ * pcb2gcode is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * pcb2gcode is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with pcb2gcode.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MARCHING_SQUARES_HPP
+#define MARCHING_SQUARES_HPP
+
+#include <stdexcept>
+
+#include <vector>
+using std::vector;
+using std::pair;
+
+/******************************************************************************/
+/*
+ Sub-pixel iso-contour following (marching squares).
+
+ The field is sampled at the pixel centres, which are at integer coordinates;
+ a pixel is inside when its value is positive. The square cells between 4
+ pixel centres are visited along the contour, and the contour crosses each
+ cell edge where the linear interpolation of the field between its two
+ corners is 0. Saddle cells are resolved with the average of the 4 corners.
+ */
+/******************************************************************************/
+class marching_squares
+{
+public:
+    // Follows the contour passing between the pixels x - 1, y (inside) and
+    // x, y (outside), until it is closed; the first point is repeated at the
+    // end. field(x, y) must be defined on every pixel the contour can reach.
+    template <typename Field>
+    static void trace(const Field& field, int x, int y, size_t max_steps,
+                      vector<pair<double, double> >& contour)
+    {
+        // the corners of a cell are numbered clockwise (with y pointing
+        // down) from the top left one; the edge i goes from the corner i to
+        // the corner i + 1
+        static const int corner[4][2] = { { 0, 0 }, { 1, 0 }, { 1, 1 }, { 0, 1 } };
+        // cell beyond each edge, and the edge it is entered from
+        static const int next_cell[4][2] = { { 0, -1 }, { 1, 0 }, { 0, 1 }, { -1, 0 } };
+
+        const int start_x = x - 1;
+        const int start_y = y;
+        const int start_edge = 0;
+
+        int cell_x = start_x;
+        int cell_y = start_y;
+        int edge = start_edge;
+
+        contour.clear();
+
+        for (size_t steps = 0; steps < max_steps; steps++)
+        {
+            double value[4];
+            bool inside[4];
+
+            for (int i = 0; i < 4; i++)
+            {
+                value[i] = field(cell_x + corner[i][0], cell_y + corner[i][1]);
+                inside[i] = value[i] > 0;
+            }
+
+            // crossing on the entry edge
+            const int a = edge;
+            const int b = (edge + 1) % 4;
+            const double t = value[a] / (value[a] - value[b]);
+
+            contour.push_back(pair<double, double>(
+                                  cell_x + corner[a][0] + t * (corner[b][0] - corner[a][0]),
+                                  cell_y + corner[a][1] + t * (corner[b][1] - corner[a][1])));
+
+            // exit edge
+            int exit;
+
+            if (inside[0] == inside[2] && inside[1] == inside[3] && inside[0] != inside[1])
+            {
+                // saddle: when the centre is inside the inside corners are
+                // joined, so the contour turns around the outside corner of
+                // the entry edge; otherwise around its inside corner
+                const bool centre = value[0] + value[1] + value[2] + value[3] > 0;
+                const int turn_corner = (inside[a] == centre) ? b : a;
+
+                exit = turn_corner == a ? (edge + 3) % 4 : (edge + 1) % 4;
+            }
+            else
+            {
+                exit = -1;
+
+                for (int i = 1; i < 4; i++)
+                {
+                    const int e = (edge + i) % 4;
+
+                    if (inside[e] != inside[(e + 1) % 4])
+                    {
+                        exit = e;
+                        break;
+                    }
+                }
+
+                if (exit < 0)
+                    throw std::logic_error("marching_squares: the contour has no exit.");
+            }
+
+            cell_x += next_cell[exit][0];
+            cell_y += next_cell[exit][1];
+            edge = (exit + 2) % 4;
+
+            if (cell_x == start_x && cell_y == start_y && edge == start_edge)
+            {
+                contour.push_back(contour.front());
+                return;
+            }
+        }
+
+        throw std::logic_error("marching_squares: the contour doesn't close.");
+    }
+};
+
+#endif // MARCHING_SQUARES_HPP
@@ -23,6 +23,15 @@
 
 #include <stdint.h>
 
+// Algorithms used to grow the copper areas until they are as wide as the tool;
+// the vector one offsets the copper polygons instead of rasterising them
+enum GrowthEngine { GROWTH_OUTLINE = 0, GROWTH_EDT = 1, GROWTH_BITPLANE = 2,
+                    GROWTH_VECTOR = 3 };
+
+// How the toolpaths are extracted from the grown areas: following the pixel
+// borders or interpolating between the pixels (marching squares)
+enum ContourMode { CONTOUR_PIXEL = 0, CONTOUR_SUBPIXEL = 1 };
+
 /******************************************************************************/
 /*
  */
@@ -52,6 +61,8 @@ class RoutingMill: public Mill
 public:
     double tool_diameter;
     bool optimise;
+    GrowthEngine growth_engine;
+    ContourMode contour_mode;
 };
 
 /******************************************************************************/
@@ -62,6 +73,11 @@ class Isolator: public RoutingMill
 {
 public:
     int extra_passes;
+    // the extra passes offset the toolpaths of the first one instead of
+    // growing the copper areas again
+    bool offset_passes;
+    // resolution of the adaptive refinement, 0 if disabled
+    unsigned int refine_dpi;
 };
 
 /******************************************************************************/
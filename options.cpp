@@ -181,6 +181,9 @@ options::options()
             "milldrill", po::value<bool>()->default_value(false)->implicit_value(true), "drill using the mill head")(
             "nog81", po::value<bool>()->default_value(false)->implicit_value(true), "replace G81 with G0+G1")(
             "extra-passes", po::value<int>()->default_value(0), "specify the the number of extra isolation passes, increasing the isolation width half the tool diameter with each pass")(
+            "offset-passes", po::value<bool>()->default_value(false)->implicit_value(true), "compute the extra passes by offsetting the toolpaths of the first pass, instead of growing the copper areas again")(
+            "growth-engine", po::value<string>()->default_value("outline"), "algorithm used to grow the copper areas by the tool radius; valid choices are outline (default), edt (distance transform, faster at high dpi), bitplane (same result as outline, 64 pixels at a time) or vector (offsets the copper polygons, without rasterising the isolated layers)")(
+            "contour-mode", po::value<string>()->default_value("pixel"), "how the toolpaths are extracted; valid choices are pixel (default) or subpixel (anti-aliased rendering and marching squares, as accurate as pixel at about a quarter of the dpi)")(
             "fill-outline", po::value<bool>()->default_value(false)->implicit_value(true), "accept a contour instead of a polygon as outline (you likely want to enable this one)")(
             "outline-width", po::value<double>(), "width of the outline")(
             "cutter-diameter", po::value<double>(), "diameter of the end mill used for cutting out the PCB")(
@@ -221,6 +224,12 @@ options::options()
             "al-probevar", po::value<unsigned int>()->default_value(2002), "number of the variable where the result of the probing is saved (default is 2002)")(
             "al-setzzero", po::value<string>()->default_value("G92 Z0"), "gcode for setting the actual position as zero (default is G92 Z0)")(
             "dpi", po::value<int>()->default_value(1000), "virtual photoplot resolution")(
+            "refine-dpi", po::value<int>()->default_value(0), "resolution of the areas where the isolation paths come close, computed again after the whole layers (default is 0, disabled)")(
+            "threads", po::value<unsigned int>()->default_value(0), "number of threads used for the image processing (default is 0, one per core)")(
+            "max-memory", po::value<unsigned int>()->default_value(0), "memory budget of each rasterised layer, in MB: its image planes and its render bands, which are as high as the rest allows; pcb2gcode fails if a layer doesn't fit in it (default is 0, unlimited)")(
+            "mmap-scratch", po::value<bool>()->default_value(false)->implicit_value(true), "keep the image planes in memory-mapped scratch files in the output directory")(
+            "gerber-parser", po::value<string>()->default_value("gerbv"), "how the gerber files are imported; valid choices are gerbv (default) or native (memory-mapped single pass parser, without libgerbv)")(
+            "rasteriser", po::value<string>()->default_value("cairo"), "how the native gerber parser renders the layers; valid choices are cairo (default) or scanline (fills the primitives straight into the image planes, needs gerber-parser=native)")(
             "zero-start", po::value<bool>()->default_value(false)->implicit_value(true), "set the starting point of the project at (0,0)")(
             "g64", po::value<double>(), "maximum deviation from toolpath, overrides internal calculation")(
             "mirror-absolute", po::value<bool>()->default_value(false)->implicit_value(true), "mirror back side along absolute zero instead of board center\n")(
@@ -255,6 +264,13 @@ static void check_generic_parameters(po::variables_map const& vm)
              << endl;
     }
 
+    if (vm["refine-dpi"].as<int>() != 0 &&
+            vm["refine-dpi"].as<int>() <= vm["dpi"].as<int>())
+    {
+        cerr << "refine-dpi must be higher than dpi!\n";
+        exit(ERR_LOWREFINEDPI);
+    }
+
     //---------------------------------------------------------------------------
     //Check g64 parameter:
 
@@ -304,6 +320,75 @@ static void check_generic_parameters(po::variables_map const& vm)
         exit(ERR_NEGATIVETILEY);
     }
 
+    //---------------------------------------------------------------------------
+    //Check for the growth engine
+
+    if (!vm["growth-engine"].defaulted())
+    {
+        const string engine = vm["growth-engine"].as<string>();
+
+        if( !boost::iequals( engine, "outline" ) &&
+            !boost::iequals( engine, "edt" ) &&
+            !boost::iequals( engine, "bitplane" ) &&
+            !boost::iequals( engine, "vector" ) )
+        {
+            cerr << "growth-engine can only be outline, edt, bitplane or vector\n";
+            exit(ERR_UNKNOWNGROWTHENGINE);
+        }
+    }
+
+    //---------------------------------------------------------------------------
+    //Check for the contour mode
+
+    if (!vm["contour-mode"].defaulted())
+    {
+        const string mode = vm["contour-mode"].as<string>();
+
+        if( !boost::iequals( mode, "pixel" ) &&
+            !boost::iequals( mode, "subpixel" ) )
+        {
+            cerr << "contour-mode can only be pixel or subpixel\n";
+            exit(ERR_UNKNOWNCONTOURMODE);
+        }
+    }
+
+    //---------------------------------------------------------------------------
+    //Check for the gerber parser
+
+    if (!vm["gerber-parser"].defaulted())
+    {
+        const string parser = vm["gerber-parser"].as<string>();
+
+        if( !boost::iequals( parser, "gerbv" ) &&
+            !boost::iequals( parser, "native" ) )
+        {
+            cerr << "gerber-parser can only be gerbv or native\n";
+            exit(ERR_UNKNOWNGERBERPARSER);
+        }
+    }
+
+    //---------------------------------------------------------------------------
+    //Check for the rasteriser
+
+    if (!vm["rasteriser"].defaulted())
+    {
+        const string rasteriser = vm["rasteriser"].as<string>();
+
+        if( !boost::iequals( rasteriser, "cairo" ) &&
+            !boost::iequals( rasteriser, "scanline" ) )
+        {
+            cerr << "rasteriser can only be cairo or scanline\n";
+            exit(ERR_UNKNOWNRASTERISER);
+        }
+
+        if( boost::iequals( rasteriser, "scanline" ) &&
+            !boost::iequals( vm["gerber-parser"].as<string>(), "native" ) )
+        {
+            cerr << "rasteriser=scanline needs gerber-parser=native\n";
+            exit(ERR_SCANLINEWITHOUTNATIVE);
+        }
+    }
+
     //---------------------------------------------------------------------------
     //Check for safety height parameter:
 
@@ -83,6 +83,13 @@ enum ErrorCodes
     ERR_UNKNOWNDRILLSIDE = 44,
     ERR_BOTHCUTFRONTSIDE = 45,
     ERR_UNKNOWNCUTSIDE = 46,
+    ERR_UNKNOWNGROWTHENGINE = 47,
+    ERR_UNKNOWNCONTOURMODE = 48,
+    ERR_LOWREFINEDPI = 49,
+    ERR_UNKNOWNGERBERPARSER = 50,
+    ERR_UNKNOWNRASTERISER = 51,
+    ERR_SCANLINEWITHOUTNATIVE = 52,
+    ERR_MAXMEMORY = 53,
     ERR_INVALIDPARAMETER = 100,
     ERR_UNKNOWNPARAMETER = 101
 };
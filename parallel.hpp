@@ -0,0 +1,151 @@
+/*
+ * This file is part of pcb2gcode.
+ *
+ * Copyright (C) 2016 the pcb2gcode developers
+ *
+ * pcb2gcode is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * pcb2gcode is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with pcb2gcode.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef PARALLEL_HPP
+#define PARALLEL_HPP
+
+#include <stdint.h>
+#include <algorithm>
+
+#include <boost/thread.hpp>
+#include <boost/bind.hpp>
+
+/******************************************************************************/
+/*
+ Minimal helper to split the image processing work over multiple threads.
+ The number of threads is a process-wide setting (--threads); 0 means one
+ thread per core.
+ */
+/******************************************************************************/
+class parallel
+{
+public:
+    static void set_threads(unsigned int threads)
+    {
+        thread_count() = threads;
+    }
+
+    static unsigned int threads()
+    {
+        if (thread_count() == 0)
+            return std::max(boost::thread::hardware_concurrency(), 1u);
+        else
+            return thread_count();
+    }
+
+    // Splits [0, size) in (at most) threads() consecutive chunks and calls
+    // function(begin, end) on each of them from its own thread. The function
+    // must not throw.
+    template <typename F> static void for_chunks(int size, F function)
+    {
+        const int chunks = std::min<int>(threads(), size);
+
+        if (chunks <= 1)
+        {
+            if (size > 0)
+                function(0, size);
+        }
+        else
+        {
+            boost::thread_group group;
+
+            for (int i = 0; i < chunks; i++)
+                group.create_thread(boost::bind<void>(function,
+                                                      int(int64_t(size) * i / chunks),
+                                                      int(int64_t(size) * (i + 1) / chunks)));
+
+            group.join_all();
+        }
+    }
+
+    // Like for_chunks(), but [0, size) is split in many small batches which
+    // are handed out to the threads as soon as they are done with the
+    // previous ones, for items of very different costs. The batches are
+    // consecutive, but they can be processed in any order.
+    template <typename F> static void for_batches(int size, F function)
+    {
+        const int workers = std::min<int>(threads(), size);
+
+        if (workers <= 1)
+        {
+            if (size > 0)
+                function(0, size);
+        }
+        else
+        {
+            batch_queue queue(size, std::max(size / (workers * 8), 1));
+            boost::thread_group group;
+
+            for (int i = 0; i < workers; i++)
+                group.create_thread(batch_worker<F>(&queue, function));
+
+            group.join_all();
+        }
+    }
+
+private:
+    struct batch_queue
+    {
+        batch_queue(int size, int batch) : next(0), size(size), batch(batch)
+        {
+        }
+
+        boost::mutex mutex;
+        int next;
+        const int size;
+        const int batch;
+    };
+
+    template <typename F> struct batch_worker
+    {
+        batch_worker(batch_queue* queue, F function) : queue(queue), function(function)
+        {
+        }
+
+        void operator()()
+        {
+            while (true)
+            {
+                int begin;
+
+                {
+                    boost::mutex::scoped_lock lock(queue->mutex);
+                    begin = queue->next;
+                    queue->next = std::min(begin + queue->batch, queue->size);
+                }
+
+                if (begin >= queue->size)
+                    return;
+
+                function(begin, std::min(begin + queue->batch, queue->size));
+            }
+        }
+
+        batch_queue* queue;
+        F function;
+    };
+
+    static unsigned int& thread_count()
+    {
+        static unsigned int count = 0;
+        return count;
+    }
+};
+
+#endif // PARALLEL_HPP
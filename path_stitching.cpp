@@ -0,0 +1,288 @@
+/*
+ * This file is part of pcb2gcode.
+ *
+ * Copyright (C) 2016 the pcb2gcode developers
+ *
+ * pcb2gcode is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * pcb2gcode is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with pcb2gcode.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "path_stitching.hpp"
+
+#include <algorithm>
+#include <limits>
+
+#include <boost/foreach.hpp>
+#include <boost/geometry/algorithms/distance.hpp>
+
+/******************************************************************************/
+/*
+ interval [t0, t1] of the segment a + t * (b - a), 0 <= t <= 1, inside area
+ (Liang-Barsky clipping); false if it's empty or a single point
+ */
+/******************************************************************************/
+static bool clip(const icoordpair& a, const icoordpair& b,
+                 const path_stitching::rectangle& area, double& t0, double& t1)
+{
+    const double direction[2] = { b.first - a.first, b.second - a.second };
+    const double low[2] = { area.min_x - a.first, area.min_y - a.second };
+    const double high[2] = { area.max_x - a.first, area.max_y - a.second };
+
+    t0 = 0;
+    t1 = 1;
+
+    for (int i = 0; i < 2; i++)
+    {
+        // a segment along the border is outside
+        if (direction[i] == 0)
+        {
+            if (low[i] >= 0 || high[i] <= 0)
+                return false;
+        }
+        else
+        {
+            double enter = low[i] / direction[i];
+            double leave = high[i] / direction[i];
+
+            if (enter > leave)
+                std::swap(enter, leave);
+
+            t0 = std::max(t0, enter);
+            t1 = std::min(t1, leave);
+        }
+    }
+
+    return t0 < t1;
+}
+
+static icoordpair point_at(const icoordpair& a, const icoordpair& b, double t)
+{
+    return icoordpair(a.first + t * (b.first - a.first),
+                      a.second + t * (b.second - a.second));
+}
+
+/******************************************************************************/
+/*
+ appends points to path, without repeating the point they are joined on
+ */
+/******************************************************************************/
+static void append(icoords& path, const icoords& points)
+{
+    icoords::const_iterator first = points.begin();
+
+    if (!path.empty() && first != points.end() && *first == path.back())
+        ++first;
+
+    path.insert(path.end(), first, points.end());
+}
+
+/******************************************************************************/
+/*
+ strictly inside: the points on the border belong to the pieces outside
+ */
+/******************************************************************************/
+bool path_stitching::is_inside(const icoordpair& point, const rectangle& area)
+{
+    return point.first > area.min_x && point.first < area.max_x &&
+           point.second > area.min_y && point.second < area.max_y;
+}
+
+/******************************************************************************/
+/*
+ the walk starts from a point outside, so the first and the last pieces are
+ outside and the path is rebuilt by joining the pieces in order
+ */
+/******************************************************************************/
+void path_stitching::split(const icoords& path, const rectangle& area,
+                           vector<piece>& pieces)
+{
+    const size_t size = path.size() - 1;    // the last point repeats the first
+    size_t start = 0;
+
+    pieces.clear();
+
+    while (start < size && is_inside(path[start], area))
+        start++;
+
+    pieces.push_back(piece());
+    pieces.back().inside = false;
+
+    // inside, or a single point
+    if (start == size)
+    {
+        pieces.back().points = path;
+        pieces.back().inside = size > 0;
+        return;
+    }
+
+    pieces.back().points.push_back(path[start]);
+
+    for (size_t i = 0; i < size; i++)
+    {
+        const icoordpair& a = path[(start + i) % size];
+        const icoordpair& b = path[(start + i + 1) % size];
+        double t0;
+        double t1;
+
+        if (clip(a, b, area, t0, t1))
+        {
+            if (!pieces.back().inside)
+            {
+                const icoordpair enter = point_at(a, b, t0);
+
+                if (enter != a)
+                    pieces.back().points.push_back(enter);
+
+                pieces.push_back(piece());
+                pieces.back().inside = true;
+                pieces.back().points.push_back(enter);
+            }
+
+            if (t1 < 1)
+            {
+                const icoordpair leave = point_at(a, b, t1);
+
+                pieces.back().points.push_back(leave);
+                pieces.push_back(piece());
+                pieces.back().inside = false;
+                pieces.back().points.push_back(leave);
+            }
+        }
+        else if (pieces.back().inside)
+        {
+            // a was on the border and the segment goes out straight away
+            pieces.push_back(piece());
+            pieces.back().inside = false;
+            pieces.back().points.push_back(a);
+        }
+
+        pieces.back().points.push_back(b);
+    }
+
+    // a single piece is a path that only touches the border from outside
+    if (pieces.size() == 1)
+        pieces.back().points = path;
+}
+
+/******************************************************************************/
+/*
+ */
+/******************************************************************************/
+bool path_stitching::stitch(vector<shared_ptr<icoords> >& paths,
+                            const vector<shared_ptr<icoords> >& refined,
+                            const rectangle& area, double tolerance)
+{
+    vector<shared_ptr<icoords> > stitched;
+    vector<shared_ptr<icoords> > enclosed;
+    vector<piece> pieces;
+    // refined pieces crossing the border, and whether they have been used
+    vector<piece> crossing;
+    vector<bool> used;
+
+    BOOST_FOREACH(const shared_ptr<icoords>& path, refined)
+    {
+        if (path->empty())
+            continue;
+
+        split(*path, area, pieces);
+
+        if (pieces.size() == 1)
+        {
+            if (pieces.front().inside)
+                enclosed.push_back(path);
+        }
+        else
+        {
+            BOOST_FOREACH(const piece& current, pieces)
+            {
+                if (current.inside)
+                    crossing.push_back(current);
+            }
+        }
+    }
+
+    used.resize(crossing.size(), false);
+
+    BOOST_FOREACH(const shared_ptr<icoords>& path, paths)
+    {
+        if (path->empty())
+            continue;
+
+        split(*path, area, pieces);
+
+        if (pieces.size() == 1)
+        {
+            if (!pieces.front().inside)
+                stitched.push_back(path);
+
+            continue;
+        }
+
+        shared_ptr<icoords> joined(new icoords());
+
+        BOOST_FOREACH(const piece& current, pieces)
+        {
+            if (!current.inside)
+            {
+                append(*joined, current.points);
+                continue;
+            }
+
+            // the refined piece entering and leaving nearest to this one
+            size_t best = crossing.size();
+            double best_distance = std::numeric_limits<double>::infinity();
+
+            for (size_t i = 0; i < crossing.size(); i++)
+            {
+                if (used[i])
+                    continue;
+
+                const double enter = boost::geometry::distance(
+                                         crossing[i].points.front(), current.points.front());
+                const double leave = boost::geometry::distance(
+                                         crossing[i].points.back(), current.points.back());
+
+                if (enter <= tolerance && leave <= tolerance &&
+                        enter + leave < best_distance)
+                {
+                    best = i;
+                    best_distance = enter + leave;
+                }
+            }
+
+            if (best == crossing.size())
+                return false;
+
+            // the refined piece is moved onto the cut points of the original
+            // path, where the pieces outside end, instead of being joined to
+            // them by an unchecked segment
+            icoords spliced(crossing[best].points);
+
+            spliced.front() = current.points.front();
+            spliced.back() = current.points.back();
+
+            used[best] = true;
+            append(*joined, spliced);
+        }
+
+        stitched.push_back(joined);
+    }
+
+    if (std::find(used.begin(), used.end(), false) != used.end())
+        return false;
+
+    stitched.insert(stitched.end(), enclosed.begin(), enclosed.end());
+    paths.swap(stitched);
+    return true;
+}
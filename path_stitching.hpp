@@ -0,0 +1,77 @@
+/*
+ * This file is part of pcb2gcode.
+ *
+ * Copyright (C) 2016 the pcb2gcode developers
+ *
+ * pcb2gcode is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * pcb2gcode is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with pcb2gcode.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef PATH_STITCHING_HPP
+#define PATH_STITCHING_HPP
+
+#include <vector>
+using std::vector;
+
+#include <boost/shared_ptr.hpp>
+using boost::shared_ptr;
+
+#include "coord.hpp"
+
+/******************************************************************************/
+/*
+ Replaces the parts of a set of closed toolpaths falling inside a rectangle
+ with the ones of another set, computed for the same layer at a higher
+ resolution.
+
+ Both sets are cut on the border of the rectangle. Each piece of the original
+ paths inside it must be matched by a refined piece entering and leaving the
+ rectangle at the same places (within a tolerance), and the other way round;
+ the matched pieces are swapped, with their ends moved onto the cut points of
+ the original paths, and the paths closed by the remaining pieces outside. The paths entirely inside the rectangle are replaced by the refined
+ ones entirely inside it, whatever their number, since the higher resolution
+ can separate areas merged at the lower one. If the pieces can't be matched
+ (e.g. the refined paths have a different topology near the border) nothing
+ is changed.
+ */
+/******************************************************************************/
+class path_stitching
+{
+public:
+    struct rectangle
+    {
+        ivalue_t min_x, max_x, min_y, max_y;
+    };
+
+    // returns false (leaving paths unchanged) if the refined paths can't be
+    // stitched
+    static bool stitch(vector<shared_ptr<icoords> >& paths,
+                       const vector<shared_ptr<icoords> >& refined,
+                       const rectangle& area, double tolerance);
+
+protected:
+    struct piece
+    {
+        icoords points;     // the first and last are on the border, if cut
+        bool inside;
+    };
+
+    // splits a closed path in alternate pieces outside and inside area; a
+    // path that doesn't cross the border of area gives a single piece
+    static void split(const icoords& path, const rectangle& area,
+                      vector<piece>& pieces);
+    static bool is_inside(const icoordpair& point, const rectangle& area);
+};
+
+#endif // PATH_STITCHING_HPP
@@ -0,0 +1,209 @@
+/*
+ * This file is part of pcb2gcode.
+ *
+ * Copyright (C) 2016 the pcb2gcode developers
+ *
+ * pcb2gcode is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * pcb2gcode is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with pcb2gcode.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef PIXEL_KERNELS_HPP
+#define PIXEL_KERNELS_HPP
+
+#include "raster.hpp"
+
+/******************************************************************************/
+/*
+ Neighbourhoods known at compile time.
+
+ The neighbours are numbered clockwise (with y pointing down) from the one on
+ the right; at<i> gives the offsets of the i-th one as constants, so the loops
+ over a neighbourhood can be unrolled, and dx(i), dy(i) give them at runtime
+ for the walks around a pixel (e.g. the outline tracer).
+ */
+/******************************************************************************/
+template <int Connectivity> struct neighbourhood;
+
+template <> struct neighbourhood<4>
+{
+    static const int size = 4;
+
+    template <int I> struct at
+    {
+        static const int dx = I == 0 ? 1 : (I == 2 ? -1 : 0);
+        static const int dy = I == 1 ? 1 : (I == 3 ? -1 : 0);
+    };
+
+    static int dx(int i)
+    {
+        static const int offsets[4] = { 1, 0, -1, 0 };
+        return offsets[i & 3];
+    }
+    static int dy(int i)
+    {
+        static const int offsets[4] = { 0, 1, 0, -1 };
+        return offsets[i & 3];
+    }
+};
+
+template <> struct neighbourhood<8>
+{
+    static const int size = 8;
+
+    template <int I> struct at
+    {
+        static const int dx = (I == 0 || I == 1 || I == 7) ? 1 : ((I >= 3 && I <= 5) ? -1 : 0);
+        static const int dy = (I >= 1 && I <= 3) ? 1 : (I >= 5 ? -1 : 0);
+    };
+
+    static int dx(int i)
+    {
+        static const int offsets[8] = { 1, 1, 0, -1, -1, -1, 0, 1 };
+        return offsets[i & 7];
+    }
+    static int dy(int i)
+    {
+        static const int offsets[8] = { 0, 1, 1, 1, 0, -1, -1, -1 };
+        return offsets[i & 7];
+    }
+    // index of the neighbour at dx, dy (which can't both be 0)
+    static int index(int dx, int dy)
+    {
+        static const int indexes[3][3] = { { 5, 6, 7 }, { 4, -1, 0 }, { 3, 2, 1 } };
+        return indexes[dy + 1][dx + 1];
+    }
+};
+
+/******************************************************************************/
+/*
+ Reads the pixels around x, y of a plane. The generic version goes through
+ Plane::get(); the pixels are never checked against the image bounds, which
+ is the caller's job (Surface keeps a guard band of procmargin pixels around
+ the board, so the neighbours of the pixels near the copper are always
+ inside the image).
+ */
+/******************************************************************************/
+template <typename Plane> class neighbour_reader
+{
+public:
+    typedef typename Plane::pixel_type pixel_type;
+
+    neighbour_reader(const Plane& plane, int x, int y) :
+        plane(plane), x(x), y(y)
+    {
+    }
+
+    template <int DX, int DY> pixel_type get() const
+    {
+        return plane.get(x + DX, y + DY);
+    }
+
+protected:
+    const Plane& plane;
+    const int x;
+    const int y;
+};
+
+// the labels are read straight from the tile, unless x, y is on its border
+template <> class neighbour_reader<labelplane>
+{
+public:
+    typedef labelplane::pixel_type pixel_type;
+
+    neighbour_reader(const labelplane& plane, int x, int y) :
+        plane(plane), x(x), y(y), pixel(plane.get_neighbourhood(x, y))
+    {
+    }
+
+    template <int DX, int DY> pixel_type get() const
+    {
+        if (pixel)
+            return pixel[DY * labelplane::tile_size + DX];
+        else
+            return plane.get(x + DX, y + DY);
+    }
+
+protected:
+    const labelplane& plane;
+    const int x;
+    const int y;
+    const uint32_t* const pixel;
+};
+
+/******************************************************************************/
+/*
+ Unrolled loops over the neighbourhood of a pixel. The predicates get the
+ pixel values, e.g.
+     neighbour_kernel<8, labelplane>::any(labels, x, y, foreign_pixel(color))
+ */
+/******************************************************************************/
+template <int Connectivity, typename Plane> class neighbour_kernel
+{
+public:
+    typedef typename Plane::pixel_type pixel_type;
+
+    // true if predicate is true for at least one neighbour
+    template <typename Predicate>
+    static bool any(const Plane& plane, int x, int y, Predicate predicate)
+    {
+        return step<0>::any(neighbour_reader<Plane>(plane, x, y), predicate);
+    }
+
+    // true if predicate is true for all the neighbours
+    template <typename Predicate>
+    static bool all(const Plane& plane, int x, int y, Predicate predicate)
+    {
+        negation<Predicate> opposite(predicate);
+
+        return !step<0>::any(neighbour_reader<Plane>(plane, x, y), opposite);
+    }
+
+protected:
+    template <int I, bool End = (I == neighbourhood<Connectivity>::size)> struct step
+    {
+        typedef typename neighbourhood<Connectivity>::template at<I> offset;
+
+        template <typename Predicate>
+        static bool any(const neighbour_reader<Plane>& reader, Predicate& predicate)
+        {
+            return predicate(reader.template get<offset::dx, offset::dy>()) ||
+                   step<I + 1>::any(reader, predicate);
+        }
+    };
+
+    template <int I> struct step<I, true>
+    {
+        template <typename Predicate>
+        static bool any(const neighbour_reader<Plane>&, Predicate&)
+        {
+            return false;
+        }
+    };
+
+    template <typename Predicate> struct negation
+    {
+        negation(const Predicate& predicate) : predicate(predicate)
+        {
+        }
+
+        bool operator()(pixel_type pixel)
+        {
+            return !predicate(pixel);
+        }
+
+        Predicate predicate;
+    };
+};
+
+#endif // PIXEL_KERNELS_HPP
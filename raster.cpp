@@ -0,0 +1,325 @@
+/*
+ * This file is part of pcb2gcode.
+ *
+ * Copyright (C) 2016 the pcb2gcode developers
+ *
+ * pcb2gcode is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * pcb2gcode is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with pcb2gcode.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "raster.hpp"
+#include "row_kernels.hpp"
+#include "parallel.hpp"
+
+#include <sys/mman.h>
+
+#include <algorithm>
+#include <new>
+#include <stdexcept>
+
+/******************************************************************************/
+/*
+ */
+/******************************************************************************/
+bitplane::bitplane(int width, int height) :
+    width(width), height(height), words_per_row((width + 31) / 32),
+    words(static_cast<uint32_t*>(scratch_memory::allocate(get_bytes())))
+{
+}
+
+/******************************************************************************/
+/*
+ */
+/******************************************************************************/
+bitplane::~bitplane()
+{
+    scratch_memory::release(words, get_bytes());
+}
+
+/******************************************************************************/
+/*
+ */
+/******************************************************************************/
+void bitplane::advise(scratch_memory::access_pattern pattern) const
+{
+    scratch_memory::advise(words, get_bytes(), pattern);
+}
+
+/******************************************************************************/
+/*
+ */
+/******************************************************************************/
+uint32_t bitplane::last_word_mask() const
+{
+    uint32_t mask = 0;
+
+    for (int x = (words_per_row - 1) * 32; x < width; x++)
+        mask |= bit(x);
+
+    return mask;
+}
+
+/******************************************************************************/
+/*
+ */
+/******************************************************************************/
+void bitplane::and_with(const bitplane& other)
+{
+    if (!same_shape(other))
+        throw std::logic_error("Surface shapes don't match.");
+
+    parallel::for_chunks(height, boost::bind(&bitplane::and_rows, this, &other, _1, _2));
+}
+
+/******************************************************************************/
+/*
+ */
+/******************************************************************************/
+void bitplane::or_not_with(const bitplane& other)
+{
+    if (!same_shape(other))
+        throw std::logic_error("Surface shapes don't match.");
+
+    parallel::for_chunks(height, boost::bind(&bitplane::or_not_rows, this, &other, _1, _2));
+}
+
+/******************************************************************************/
+/*
+ */
+/******************************************************************************/
+void bitplane::and_rows(const bitplane* other, int begin, int end)
+{
+    row_kernels::and_words(get_row(begin), other->get_row(begin),
+                           (end - begin) * words_per_row);
+}
+
+/******************************************************************************/
+/*
+ the bits past the end of each row must stay clear
+ */
+/******************************************************************************/
+void bitplane::or_not_rows(const bitplane* other, int begin, int end)
+{
+    const uint32_t last_word = last_word_mask();
+
+    for (int y = begin; y < end; y++)
+    {
+        uint32_t* row = get_row(y);
+
+        row_kernels::or_not_words(row, other->get_row(y), words_per_row);
+        row[words_per_row - 1] &= last_word;
+    }
+}
+
+/******************************************************************************/
+/*
+ */
+/******************************************************************************/
+coverageplane::coverageplane(const bitplane& copper) :
+    copper(copper), width(copper.get_width()), height(copper.get_height()),
+    tiles_per_row((width + tile_size - 1) / tile_size),
+    tiles(tiles_per_row * ((height + tile_size - 1) / tile_size), NULL)
+{
+}
+
+/******************************************************************************/
+/*
+ */
+/******************************************************************************/
+coverageplane::~coverageplane()
+{
+    for (unsigned int i = 0; i < tiles.size(); i++)
+        delete[] tiles[i];
+}
+
+/******************************************************************************/
+/*
+ a new tile starts from the copper, which is what the rows already stored
+ without partial coverage held
+ */
+/******************************************************************************/
+unsigned char* coverageplane::allocate_tile(int index)
+{
+    unsigned char* tile = new unsigned char[tile_size * tile_size];
+    const int first_x = (index % tiles_per_row) * tile_size;
+    const int first_y = (index / tiles_per_row) * tile_size;
+
+    for (int y = 0; y < tile_size; y++)
+        for (int x = 0; x < tile_size; x++)
+            tile[(y << tile_shift) + x] = first_x + x < width && first_y + y < height &&
+                                          copper.get(first_x + x, first_y + y) ? 255 : 0;
+
+    return tile;
+}
+
+/******************************************************************************/
+/*
+ */
+/******************************************************************************/
+void coverageplane::store_rows(int first, int count, const unsigned char* bytes,
+                               int stride)
+{
+    for (int y = first; y < first + count; y++)
+    {
+        const unsigned char* row = bytes + (y - first) * stride;
+
+        for (int x = 0; x < width; x += tile_size)
+        {
+            const int end = std::min(x + tile_size, width);
+            const int index = tile_index(x, y);
+
+            if (!tiles[index])
+            {
+                bool partial = false;
+
+                for (int i = x; i < end && !partial; i++)
+                    partial = row[i] != 0 && row[i] != 255;
+
+                if (!partial)
+                    continue;
+
+                tiles[index] = allocate_tile(index);
+            }
+
+            std::copy(row + x, row + end, tiles[index] + pixel_index(x, y));
+        }
+    }
+}
+
+/******************************************************************************/
+/*
+ */
+/******************************************************************************/
+labelplane::labelplane(int width, int height, uint32_t background) :
+    width(width), height(height), background(background),
+    tiles_per_row((width + tile_size - 1) / tile_size), tile_pool(NULL)
+{
+    // a page of its own, protected once filled: a stray write through a
+    // tile that wasn't allocated faults instead of changing all of them
+    void* page = mmap(NULL, tile_bytes, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (page == MAP_FAILED)
+        throw std::bad_alloc();
+
+    background_tile = static_cast<uint32_t*>(page);
+    std::fill(background_tile, background_tile + tile_size * tile_size, background);
+    mprotect(page, tile_bytes, PROT_READ);
+
+    tiles.resize(tiles_per_row * ((height + tile_size - 1) / tile_size),
+                 background_tile);
+
+    if (scratch_memory::is_mapped())
+        tile_pool = static_cast<uint32_t*>(scratch_memory::allocate(get_tile_pool_bytes()));
+}
+
+/******************************************************************************/
+/*
+ */
+/******************************************************************************/
+labelplane::~labelplane()
+{
+    if (tile_pool)
+        scratch_memory::release(tile_pool, get_tile_pool_bytes());
+    else
+        for (unsigned int i = 0; i < tiles.size(); i++)
+            if (tiles[i] != background_tile)
+                delete[] tiles[i];
+
+    munmap(background_tile, tile_bytes);
+}
+
+/******************************************************************************/
+/*
+ */
+/******************************************************************************/
+uint32_t* labelplane::allocate_tile(int index)
+{
+    uint32_t* tile = tile_pool ? tile_pool + size_t(index) * tile_size * tile_size
+                     : new uint32_t[tile_size * tile_size];
+    std::copy(background_tile, background_tile + tile_size * tile_size, tile);
+
+    return tile;
+}
+
+/******************************************************************************/
+/*
+ */
+/******************************************************************************/
+void labelplane::advise(scratch_memory::access_pattern pattern) const
+{
+    if (tile_pool)
+        scratch_memory::advise(tile_pool, get_tile_pool_bytes(), pattern);
+}
+
+/******************************************************************************/
+/*
+ */
+/******************************************************************************/
+void labelplane::get_span(int y, int begin, int end, uint32_t* buffer) const
+{
+    while (begin < end)
+    {
+        const int tile_end = std::min((begin | (tile_size - 1)) + 1, end);
+        const uint32_t* pixels = tiles[tile_index(begin, y)] + pixel_index(begin, y);
+
+        // most of the spans read by the growth are a few pixels long, and a
+        // plain loop is faster than a memmove call on them
+        for (int i = 0; i < tile_end - begin; i++)
+            *buffer++ = pixels[i];
+        begin = tile_end;
+    }
+}
+
+/******************************************************************************/
+/*
+ */
+/******************************************************************************/
+void labelplane::fill_span(int y, int begin, int end, uint32_t value)
+{
+    while (begin < end)
+    {
+        const int tile_end = std::min((begin | (tile_size - 1)) + 1, end);
+        uint32_t*& tile = tiles[tile_index(begin, y)];
+
+        if (tile == background_tile)
+        {
+            if (value == background)
+            {
+                begin = tile_end;
+                continue;
+            }
+
+            tile = allocate_tile(tile_index(begin, y));
+        }
+
+        std::fill(tile + pixel_index(begin, y), tile + pixel_index(tile_end - 1, y) + 1,
+                  value);
+        begin = tile_end;
+    }
+}
+
+/******************************************************************************/
+/*
+ */
+/******************************************************************************/
+void labelplane::allocate_span(int y, int begin, int end)
+{
+    for (int x = begin & ~(tile_size - 1); x < end; x += tile_size)
+    {
+        uint32_t*& tile = tiles[tile_index(x, y)];
+
+        if (tile == background_tile)
+            tile = allocate_tile(tile_index(x, y));
+    }
+}
@@ -0,0 +1,331 @@
+/*
+ * This file is part of pcb2gcode.
+ *
+ * Copyright (C) 2016 the pcb2gcode developers
+ *
+ * pcb2gcode is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * pcb2gcode is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with pcb2gcode.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef RASTER_HPP
+#define RASTER_HPP
+
+#include <stdint.h>
+
+#include <vector>
+using std::vector;
+
+#include <boost/noncopyable.hpp>
+
+#include "scratch_memory.hpp"
+
+/******************************************************************************/
+/*
+ Bit-packed occupancy plane (1 bit per pixel).
+
+ The memory layout is the one of cairo's FORMAT_A1 image surfaces (rows of
+ 32-bit words, first pixel in the least significant bit on little-endian
+ machines and in the most significant one on big-endian machines), so the
+ importers can render directly into it.
+ */
+/******************************************************************************/
+class bitplane: boost::noncopyable
+{
+public:
+    typedef bool pixel_type;
+
+    // all the pixels are initially clear
+    bitplane(int width, int height);
+    ~bitplane();
+
+    int get_width() const
+    {
+        return width;
+    }
+    int get_height() const
+    {
+        return height;
+    }
+    // in bytes
+    int get_stride() const
+    {
+        return words_per_row * 4;
+    }
+    int get_words_per_row() const
+    {
+        return words_per_row;
+    }
+    unsigned char* get_data()
+    {
+        return reinterpret_cast<unsigned char*>(words);
+    }
+    uint32_t* get_row(int y)
+    {
+        return &words[y * words_per_row];
+    }
+    const uint32_t* get_row(int y) const
+    {
+        return &words[y * words_per_row];
+    }
+
+    bool get(int x, int y) const
+    {
+        return words[y * words_per_row + x / 32] & bit(x);
+    }
+    void set(int x, int y, bool value)
+    {
+        if (value)
+            words[y * words_per_row + x / 32] |= bit(x);
+        else
+            words[y * words_per_row + x / 32] &= ~bit(x);
+    }
+
+    // mask of the pixel x inside its word
+    static uint32_t bit(int x)
+    {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+        return 0x80000000u >> (x & 31);
+#else
+        return 1u << (x & 31);
+#endif
+    }
+
+    bool same_shape(const bitplane& other) const
+    {
+        return width == other.width && height == other.height;
+    }
+
+    // bits of the last word of each row that hold pixels; the others must
+    // stay clear
+    uint32_t last_word_mask() const;
+
+    // hint on the order in which the rows are going to be accessed
+    void advise(scratch_memory::access_pattern pattern) const;
+
+    // this &= other
+    void and_with(const bitplane& other);
+    // this |= ~other
+    void or_not_with(const bitplane& other);
+
+protected:
+    const int width;
+    const int height;
+    const int words_per_row;
+    // a zero-filled scratch block, which isn't written again: in a mapped
+    // file the pages never drawn on stay holes
+    uint32_t* const words;
+
+    size_t get_bytes() const
+    {
+        return size_t(words_per_row) * height * sizeof(uint32_t);
+    }
+
+    void and_rows(const bitplane* other, int begin, int end);
+    void or_not_rows(const bitplane* other, int begin, int end);
+};
+
+/******************************************************************************/
+/*
+ 8-bit anti-aliased coverage of the rendered layer.
+
+ Only the edges of the copper are partially covered, so the coverage is kept
+ in square tiles which are only allocated when they hold a pixel that is
+ neither empty nor fully covered; elsewhere the coverage is the one of the
+ thresholded copper plane.
+ */
+/******************************************************************************/
+class coverageplane: boost::noncopyable
+{
+public:
+    // copper holds the pixels covered at least by half, and must outlive
+    // the coverage
+    coverageplane(const bitplane& copper);
+    ~coverageplane();
+
+    static const int tile_shift = 6;
+    static const int tile_size = 1 << tile_shift;
+
+    int get_width() const
+    {
+        return width;
+    }
+    int get_height() const
+    {
+        return height;
+    }
+
+    // between 0 (empty) and 1 (fully covered)
+    double get(int x, int y) const
+    {
+        const unsigned char* tile = tiles[tile_index(x, y)];
+
+        if (tile)
+            return tile[pixel_index(x, y)] / 255.0;
+        else
+            return copper.get(x, y) ? 1.0 : 0.0;
+    }
+    // the copper of the pixel must be cleared as well
+    void clear(int x, int y)
+    {
+        unsigned char* tile = tiles[tile_index(x, y)];
+
+        if (tile)
+            tile[pixel_index(x, y)] = 0;
+    }
+
+    // Keeps the rows [first, first + count) of a rendered band of the layer,
+    // in cairo's FORMAT_A8 layout; they must already be thresholded in the
+    // copper plane.
+    void store_rows(int first, int count, const unsigned char* bytes, int stride);
+
+protected:
+    const bitplane& copper;
+    const int width;
+    const int height;
+    const int tiles_per_row;
+
+    vector<unsigned char*> tiles;   // NULL where the copper is enough
+
+    int tile_index(int x, int y) const
+    {
+        return (y >> tile_shift) * tiles_per_row + (x >> tile_shift);
+    }
+    static int pixel_index(int x, int y)
+    {
+        return ((y & (tile_size - 1)) << tile_shift) + (x & (tile_size - 1));
+    }
+
+    unsigned char* allocate_tile(int index);
+};
+
+/******************************************************************************/
+/*
+ 32-bit per pixel plane holding the component labels while the toolpaths are
+ computed.
+
+ Most of a board is empty substrate, so the plane is split in square tiles
+ which are only allocated when a pixel different from the background is
+ written into them; all the other tiles share a single read-only page filled
+ with the background value. Reading a pixel is a tile lookup plus an offset.
+
+ When the scratch memory is mapped, the tiles are reserved at once in a single
+ block, each at the position of its index: the tiles of a row are contiguous
+ and the untouched ones are holes of the scratch file.
+
+ Allocating a tile is not thread safe: concurrent writers must either only
+ modify pixels whose tile has already been allocated, or work on disjoint
+ rows of tiles.
+ */
+/******************************************************************************/
+class labelplane: boost::noncopyable
+{
+public:
+    typedef uint32_t pixel_type;
+
+    // all the pixels are initially equal to background
+    labelplane(int width, int height, uint32_t background);
+    ~labelplane();
+
+    static const int tile_shift = 7;
+    static const int tile_size = 1 << tile_shift;
+    static const size_t tile_bytes = tile_size * tile_size * sizeof(uint32_t);
+
+    int get_width() const
+    {
+        return width;
+    }
+    int get_height() const
+    {
+        return height;
+    }
+    uint32_t get_background() const
+    {
+        return background;
+    }
+
+    uint32_t get(int x, int y) const
+    {
+        return tiles[tile_index(x, y)][pixel_index(x, y)];
+    }
+    void set(int x, int y, uint32_t value)
+    {
+        uint32_t*& tile = tiles[tile_index(x, y)];
+
+        if (tile == background_tile)
+        {
+            if (value == background)
+                return;
+
+            tile = allocate_tile(tile_index(x, y));
+        }
+
+        tile[pixel_index(x, y)] = value;
+    }
+
+    // The pixels up to 1 away from x, y are at [dy * tile_size + dx] from
+    // the returned pointer, which is NULL when x, y is on the border of its
+    // tile. No bounds are checked.
+    const uint32_t* get_neighbourhood(int x, int y) const
+    {
+        if (((x + 1) & (tile_size - 1)) < 2 || ((y + 1) & (tile_size - 1)) < 2)
+            return NULL;
+
+        return tiles[tile_index(x, y)] + pixel_index(x, y);
+    }
+
+    // copies the pixels [begin, end) of the row y to buffer
+    void get_span(int y, int begin, int end, uint32_t* buffer) const;
+    // sets the pixels [begin, end) of the row y to value
+    void fill_span(int y, int begin, int end, uint32_t value);
+    // allocates the tiles of the pixels [begin, end) of the row y, so that
+    // they can be written concurrently
+    void allocate_span(int y, int begin, int end);
+
+    // atomically replaces the pixel x, y with value if it's still equal to
+    // expected; its tile must be allocated
+    bool compare_and_swap(int x, int y, uint32_t expected, uint32_t value)
+    {
+        return __sync_bool_compare_and_swap(&tiles[tile_index(x, y)][pixel_index(x, y)],
+                                            expected, value);
+    }
+
+    // hint on the order in which the tiles are going to be accessed
+    void advise(scratch_memory::access_pattern pattern) const;
+
+protected:
+    const int width;
+    const int height;
+    const uint32_t background;
+    const int tiles_per_row;
+
+    vector<uint32_t*> tiles;
+    uint32_t* background_tile;
+    uint32_t* tile_pool;        // NULL when each tile is allocated on its own
+
+    int tile_index(int x, int y) const
+    {
+        return (y >> tile_shift) * tiles_per_row + (x >> tile_shift);
+    }
+    static int pixel_index(int x, int y)
+    {
+        return ((y & (tile_size - 1)) << tile_shift) + (x & (tile_size - 1));
+    }
+
+    size_t get_tile_pool_bytes() const
+    {
+        return tiles.size() * tile_size * tile_size * sizeof(uint32_t);
+    }
+    uint32_t* allocate_tile(int index);
+};
+
+#endif // RASTER_HPP
@@ -0,0 +1,376 @@
+/*
+ * This file is part of pcb2gcode.
+ *
+ * Copyright (C) 2016 the pcb2gcode developers
+ *
+ * pcb2gcode is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * pcb2gcode is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with pcb2gcode.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "row_kernels.hpp"
+#include "raster.hpp"
+
+#include <algorithm>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define ROW_KERNELS_X86
+#include <immintrin.h>
+#endif
+
+namespace
+{
+
+struct kernel_set
+{
+    void (*and_words)(uint32_t*, const uint32_t*, int);
+    void (*or_not_words)(uint32_t*, const uint32_t*, int);
+    void (*threshold_bytes)(const unsigned char*, int, uint32_t*);
+    void (*not_equal_bits)(const uint32_t*, int, uint32_t, uint32_t*);
+};
+
+/******************************************************************************/
+/*
+ portable kernels, also used for the row tails by the vector ones
+ */
+/******************************************************************************/
+void and_words_generic(uint32_t* dst, const uint32_t* src, int count)
+{
+    for (int i = 0; i < count; i++)
+        dst[i] &= src[i];
+}
+
+void or_not_words_generic(uint32_t* dst, const uint32_t* src, int count)
+{
+    for (int i = 0; i < count; i++)
+        dst[i] |= ~src[i];
+}
+
+void threshold_bytes_generic(const unsigned char* bytes, int count, uint32_t* bits)
+{
+    for (int x = 0; x < count; x += 32)
+    {
+        const int end = std::min(x + 32, count);
+        uint32_t word = 0;
+
+        for (int i = x; i < end; i++)
+            if (bytes[i] >= 128)
+                word |= bitplane::bit(i);
+
+        bits[x / 32] = word;
+    }
+}
+
+void not_equal_bits_generic(const uint32_t* pixels, int count, uint32_t value,
+                            uint32_t* bits)
+{
+    for (int x = 0; x < count; x += 32)
+    {
+        const int end = std::min(x + 32, count);
+        uint32_t word = 0;
+
+        for (int i = x; i < end; i++)
+            if (pixels[i] != value)
+                word |= bitplane::bit(i);
+
+        bits[x / 32] = word;
+    }
+}
+
+#ifdef ROW_KERNELS_X86
+
+/******************************************************************************/
+/*
+ SSE2 kernels; x86 is little-endian, so pixel x is bit x & 31 of its word
+ */
+/******************************************************************************/
+__attribute__((target("sse2")))
+void and_words_sse2(uint32_t* dst, const uint32_t* src, int count)
+{
+    int i = 0;
+
+    for (; i + 4 <= count; i += 4)
+    {
+        __m128i* d = reinterpret_cast<__m128i*>(dst + i);
+        const __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+
+        _mm_storeu_si128(d, _mm_and_si128(_mm_loadu_si128(d), s));
+    }
+
+    and_words_generic(dst + i, src + i, count - i);
+}
+
+__attribute__((target("sse2")))
+void or_not_words_sse2(uint32_t* dst, const uint32_t* src, int count)
+{
+    const __m128i ones = _mm_set1_epi32(-1);
+    int i = 0;
+
+    for (; i + 4 <= count; i += 4)
+    {
+        __m128i* d = reinterpret_cast<__m128i*>(dst + i);
+        const __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+
+        _mm_storeu_si128(d, _mm_or_si128(_mm_loadu_si128(d), _mm_andnot_si128(s, ones)));
+    }
+
+    or_not_words_generic(dst + i, src + i, count - i);
+}
+
+__attribute__((target("sse2")))
+void threshold_bytes_sse2(const unsigned char* bytes, int count, uint32_t* bits)
+{
+    int x = 0;
+
+    // the sign bit of each byte is its >= 128 test
+    for (; x + 32 <= count; x += 32)
+    {
+        const uint32_t low = _mm_movemask_epi8(
+                                 _mm_loadu_si128(reinterpret_cast<const __m128i*>(bytes + x)));
+        const uint32_t high = _mm_movemask_epi8(
+                                  _mm_loadu_si128(reinterpret_cast<const __m128i*>(bytes + x + 16)));
+
+        bits[x / 32] = low | (high << 16);
+    }
+
+    threshold_bytes_generic(bytes + x, count - x, bits + x / 32);
+}
+
+__attribute__((target("sse2")))
+void not_equal_bits_sse2(const uint32_t* pixels, int count, uint32_t value,
+                         uint32_t* bits)
+{
+    const __m128i values = _mm_set1_epi32(value);
+    int x = 0;
+
+    for (; x + 32 <= count; x += 32)
+    {
+        uint32_t equal = 0;
+
+        for (int i = 0; i < 32; i += 4)
+        {
+            const __m128i p = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pixels + x + i));
+
+            equal |= uint32_t(_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(p, values)))) << i;
+        }
+
+        bits[x / 32] = ~equal;
+    }
+
+    not_equal_bits_generic(pixels + x, count - x, value, bits + x / 32);
+}
+
+/******************************************************************************/
+/*
+ AVX2 kernels
+ */
+/******************************************************************************/
+__attribute__((target("avx2")))
+void and_words_avx2(uint32_t* dst, const uint32_t* src, int count)
+{
+    int i = 0;
+
+    for (; i + 8 <= count; i += 8)
+    {
+        __m256i* d = reinterpret_cast<__m256i*>(dst + i);
+        const __m256i s = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+
+        _mm256_storeu_si256(d, _mm256_and_si256(_mm256_loadu_si256(d), s));
+    }
+
+    and_words_generic(dst + i, src + i, count - i);
+}
+
+__attribute__((target("avx2")))
+void or_not_words_avx2(uint32_t* dst, const uint32_t* src, int count)
+{
+    const __m256i ones = _mm256_set1_epi32(-1);
+    int i = 0;
+
+    for (; i + 8 <= count; i += 8)
+    {
+        __m256i* d = reinterpret_cast<__m256i*>(dst + i);
+        const __m256i s = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+
+        _mm256_storeu_si256(d, _mm256_or_si256(_mm256_loadu_si256(d),
+                                               _mm256_andnot_si256(s, ones)));
+    }
+
+    or_not_words_generic(dst + i, src + i, count - i);
+}
+
+__attribute__((target("avx2")))
+void threshold_bytes_avx2(const unsigned char* bytes, int count, uint32_t* bits)
+{
+    int x = 0;
+
+    for (; x + 32 <= count; x += 32)
+        bits[x / 32] = _mm256_movemask_epi8(
+                           _mm256_loadu_si256(reinterpret_cast<const __m256i*>(bytes + x)));
+
+    threshold_bytes_generic(bytes + x, count - x, bits + x / 32);
+}
+
+__attribute__((target("avx2")))
+void not_equal_bits_avx2(const uint32_t* pixels, int count, uint32_t value,
+                         uint32_t* bits)
+{
+    const __m256i values = _mm256_set1_epi32(value);
+    int x = 0;
+
+    for (; x + 32 <= count; x += 32)
+    {
+        uint32_t equal = 0;
+
+        for (int i = 0; i < 32; i += 8)
+        {
+            const __m256i p = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(pixels + x + i));
+
+            equal |= uint32_t(_mm256_movemask_ps(
+                                  _mm256_castsi256_ps(_mm256_cmpeq_epi32(p, values)))) << i;
+        }
+
+        bits[x / 32] = ~equal;
+    }
+
+    not_equal_bits_generic(pixels + x, count - x, value, bits + x / 32);
+}
+
+#endif // ROW_KERNELS_X86
+
+kernel_set select_kernels()
+{
+#ifdef ROW_KERNELS_X86
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("avx2"))
+    {
+        const kernel_set avx2 = { and_words_avx2, or_not_words_avx2,
+                                  threshold_bytes_avx2, not_equal_bits_avx2
+                                };
+        return avx2;
+    }
+
+    if (__builtin_cpu_supports("sse2"))
+    {
+        const kernel_set sse2 = { and_words_sse2, or_not_words_sse2,
+                                  threshold_bytes_sse2, not_equal_bits_sse2
+                                };
+        return sse2;
+    }
+#endif
+
+    const kernel_set generic = { and_words_generic, or_not_words_generic,
+                                 threshold_bytes_generic, not_equal_bits_generic
+                               };
+    return generic;
+}
+
+const kernel_set& kernels()
+{
+    static const kernel_set selected = select_kernels();
+    return selected;
+}
+
+// mask of the first count pixels of a word
+uint32_t first_pixels(int count)
+{
+    uint32_t mask = 0;
+
+    for (int x = 0; x < count; x++)
+        mask |= bitplane::bit(x);
+
+    return mask;
+}
+
+}
+
+/******************************************************************************/
+/*
+ */
+/******************************************************************************/
+void row_kernels::and_words(uint32_t* dst, const uint32_t* src, int count)
+{
+    kernels().and_words(dst, src, count);
+}
+
+/******************************************************************************/
+/*
+ */
+/******************************************************************************/
+void row_kernels::or_not_words(uint32_t* dst, const uint32_t* src, int count)
+{
+    kernels().or_not_words(dst, src, count);
+}
+
+/******************************************************************************/
+/*
+ */
+/******************************************************************************/
+void row_kernels::threshold_bytes(const unsigned char* bytes, int count,
+                                  uint32_t* bits)
+{
+    kernels().threshold_bytes(bytes, count, bits);
+}
+
+/******************************************************************************/
+/*
+ */
+/******************************************************************************/
+void row_kernels::not_equal_bits(const uint32_t* pixels, int count, uint32_t value,
+                                 uint32_t* bits)
+{
+    kernels().not_equal_bits(pixels, count, value, bits);
+}
+
+/******************************************************************************/
+/*
+ the pixels are in increasing bit order on little-endian machines and in
+ decreasing one on big-endian machines, so the words are joined the other way
+ round
+ */
+/******************************************************************************/
+void row_kernels::shift_bits(const uint32_t* src, int src_count, int shift,
+                             uint32_t* dst, int count)
+{
+    const int src_words = (src_count + 31) / 32;
+    const int words = (count + 31) / 32;
+    const uint32_t src_last = first_pixels(src_count % 32);
+    const uint32_t last = first_pixels(count % 32);
+
+    for (int i = 0; i < words; i++)
+    {
+        const int first = 32 * i + shift;
+        const int word = first >= 0 ? first / 32 : -((31 - first) / 32);
+        const int offset = first - 32 * word;
+        uint32_t part[2];
+
+        for (int j = 0; j < 2; j++)
+        {
+            const int w = word + j;
+
+            part[j] = w >= 0 && w < src_words ? src[w] : 0;
+            if (w == src_words - 1 && src_count % 32)
+                part[j] &= src_last;
+        }
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+        dst[i] = offset ? (part[0] << offset) | (part[1] >> (32 - offset)) : part[0];
+#else
+        dst[i] = offset ? (part[0] >> offset) | (part[1] << (32 - offset)) : part[0];
+#endif
+    }
+
+    if (count % 32)
+        dst[words - 1] &= last;
+}
@@ -0,0 +1,56 @@
+/*
+ * This file is part of pcb2gcode.
+ *
+ * Copyright (C) 2016 the pcb2gcode developers
+ *
+ * pcb2gcode is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * pcb2gcode is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with pcb2gcode.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef ROW_KERNELS_HPP
+#define ROW_KERNELS_HPP
+
+#include <stdint.h>
+
+/******************************************************************************/
+/*
+ Whole-row kernels of the raster passes (masking, thresholding, recolouring).
+
+ The x86 builds carry AVX2 and SSE2 versions of each kernel next to the
+ portable one; the fastest set supported by the CPU is picked at the first
+ call. The bit rows have the bitplane layout, and all the words covering
+ count pixels are written, the bits past count being cleared.
+ */
+/******************************************************************************/
+class row_kernels
+{
+public:
+    // dst[i] &= src[i]
+    static void and_words(uint32_t* dst, const uint32_t* src, int count);
+    // dst[i] |= ~src[i]
+    static void or_not_words(uint32_t* dst, const uint32_t* src, int count);
+    // sets the bit of each pixel whose coverage byte is at least 128 (half
+    // covered), clears the others
+    static void threshold_bytes(const unsigned char* bytes, int count,
+                                uint32_t* bits);
+    // sets the bit of each pixel different from value, clears the others
+    static void not_equal_bits(const uint32_t* pixels, int count, uint32_t value,
+                               uint32_t* bits);
+    // pixel x of dst is the pixel x + shift of src, or clear when that is
+    // outside of the src_count pixels of src (portable only)
+    static void shift_bits(const uint32_t* src, int src_count, int shift,
+                           uint32_t* dst, int count);
+};
+
+#endif // ROW_KERNELS_HPP
@@ -0,0 +1,1698 @@
+/*
+ * This file is part of pcb2gcode.
+ *
+ * Copyright (C) 2016 the pcb2gcode developers
+ *
+ * pcb2gcode is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * pcb2gcode is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with pcb2gcode.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "rs274ximporter.hpp"
+#include "scanline_rasteriser.hpp"
+#include "shapes.hpp"
+#include "stamp_cache.hpp"
+#include "vector_isolation.hpp"
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+using std::cerr;
+
+#include <boost/noncopyable.hpp>
+
+namespace
+{
+
+namespace bg = boost::geometry;
+
+/******************************************************************************/
+/*
+ read-only mapping of a whole file, unmapped by the destructor
+ */
+/******************************************************************************/
+class mapped_file: boost::noncopyable
+{
+public:
+    mapped_file(const string& path) : data(NULL), size(0)
+    {
+        const int fd = open(path.c_str(), O_RDONLY);
+        struct stat status;
+
+        if (fd < 0)
+            return;
+
+        if (fstat(fd, &status) == 0 && status.st_size > 0)
+        {
+            void* block = mmap(NULL, status.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+            if (block != MAP_FAILED)
+            {
+                data = static_cast<const char*>(block);
+                size = status.st_size;
+                madvise(block, size, MADV_SEQUENTIAL);
+            }
+        }
+
+        close(fd);
+    }
+    ~mapped_file()
+    {
+        if (data)
+            munmap(const_cast<char*>(data), size);
+    }
+
+    const char* data;
+    size_t size;
+};
+
+/******************************************************************************/
+/*
+ arithmetic expression of an aperture macro: numbers, $n variables (0 if
+ undefined), + - x / and parentheses, without whitespace
+ */
+/******************************************************************************/
+class expression
+{
+public:
+    expression(const string& text, const vector<double>& variables) :
+        text(text), variables(variables), position(0)
+    {
+    }
+
+    double evaluate()
+    {
+        return sum();
+    }
+
+private:
+    double sum()
+    {
+        double value = product();
+
+        while (position < text.size() && (text[position] == '+' || text[position] == '-'))
+        {
+            if (text[position++] == '+')
+                value += product();
+            else
+                value -= product();
+        }
+
+        return value;
+    }
+
+    double product()
+    {
+        double value = factor();
+
+        while (position < text.size() &&
+                (text[position] == 'x' || text[position] == 'X' || text[position] == '/'))
+        {
+            if (text[position++] == '/')
+                value /= factor();
+            else
+                value *= factor();
+        }
+
+        return value;
+    }
+
+    double factor()
+    {
+        if (position >= text.size())
+            return 0;
+
+        const char c = text[position];
+
+        if (c == '-' || c == '+')
+        {
+            position++;
+            return c == '-' ? -factor() : factor();
+        }
+
+        if (c == '(')
+        {
+            position++;
+            const double value = sum();
+
+            if (position < text.size() && text[position] == ')')
+                position++;
+
+            return value;
+        }
+
+        const char* begin = text.c_str() + position;
+        char* end;
+
+        if (c == '$')
+        {
+            const long variable = strtol(begin + 1, &end, 10);
+
+            position += end - begin;
+            return variable >= 0 && size_t(variable) < variables.size() ?
+                   variables[variable] : 0;
+        }
+
+        const double value = strtod(begin, &end);
+
+        // an unexpected character ends the expression
+        position = end == begin ? text.size() : position + (end - begin);
+
+        return value;
+    }
+
+    const string& text;
+    const vector<double>& variables;
+    size_t position;
+};
+
+/******************************************************************************/
+/*
+ pads the parameters of a macro primitive to the number its code takes, and
+ converts its lengths to inches. Returns false if the code is unknown.
+ */
+/******************************************************************************/
+bool convert_primitive(int code, vector<double>& p, double unit)
+{
+    // the indexes of the first length, and after the last one
+    int first = 1;
+    int last;
+    int count;
+
+    switch (code)
+    {
+    case 1:
+        last = 4;
+        count = 5;
+        break;
+
+    case 2:
+    case 20:
+        last = 6;
+        count = 7;
+        break;
+
+    case 21:
+    case 22:
+        last = 5;
+        count = 6;
+        break;
+
+    case 4:
+        first = 2;
+        last = p.size() > 1 ? 2 + 2 * (std::max(int(p[1]), 0) + 1) : 2;
+        count = last + 1;
+        break;
+
+    case 5:
+        first = 2;
+        last = 5;
+        count = 6;
+        break;
+
+    case 6:
+        first = 0;
+        last = 8;
+        count = 9;
+        break;
+
+    case 7:
+        first = 0;
+        last = 5;
+        count = 6;
+        break;
+
+    default:
+        return false;
+    }
+
+    p.resize(std::max<size_t>(p.size(), count), 0);
+
+    for (int i = first; i < last; i++)
+    {
+        // the number of rings of a moire
+        if (code == 6 && i == 5)
+            continue;
+
+        p[i] *= unit;
+    }
+
+    return true;
+}
+
+/******************************************************************************/
+/*
+ the number following letter in the value of an image parameter, or
+ fallback if there is none
+ */
+/******************************************************************************/
+double parameter_value(const string& value, char letter, double fallback)
+{
+    const size_t at = value.find(letter);
+
+    if (at == string::npos)
+        return fallback;
+
+    return atof(value.c_str() + at + 1);
+}
+
+/******************************************************************************/
+/*
+ */
+/******************************************************************************/
+bool is_space(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+/******************************************************************************/
+/*
+ */
+/******************************************************************************/
+bool is_number(char c)
+{
+    return (c >= '0' && c <= '9') || c == '.' || c == '+' || c == '-';
+}
+
+}
+
+/******************************************************************************/
+/*
+ the default format is the one gerbv assumes, 2.4 with the leading zeros
+ omitted
+ */
+/******************************************************************************/
+RS274XImporter::RS274XImporter(const string path, bool scanline) :
+    path(path), scanline(scanline), negative(false), unit(1), integer_digits(2), decimal_digits(4),
+    trailing_zeros(false), incremental(false), interpolation(1),
+    multi_quadrant(false), in_region(false), clear(false), finished(false),
+    current_aperture(-1), last_operation(0), x(0), y(0), contour_first(0),
+    repeat_first(0), repeat_x(1), repeat_y(1), repeat_dx(0), repeat_dy(0),
+    swap_axes(false), mirror_a(false), mirror_b(false), offset_a(0), offset_b(0),
+    scale_a(1), scale_b(1), rotation(0), transformed(false)
+{
+    mapped_file file(path);
+
+    if (!file.data)
+        throw import_exception() << errorstring("can't read " + path);
+
+    bg::assign_inverse(box);
+    bg::assign_inverse(repeat_box);
+
+    parse(file.data, file.data + file.size);
+
+    if (primitives.empty())
+        throw import_exception() << errorstring(path + " draws nothing");
+}
+
+/******************************************************************************/
+/*
+ the extended parameters are between percent signs, the other blocks end with
+ an asterisk
+ */
+/******************************************************************************/
+void RS274XImporter::parse(const char* begin, const char* end)
+{
+    const char* p = begin;
+
+    while (p < end && !finished)
+    {
+        if (is_space(*p))
+        {
+            p++;
+            continue;
+        }
+
+        if (*p == '%')
+        {
+            const char* close = std::find(p + 1, end, '%');
+            string command;
+
+            for (const char* c = p + 1; c < close; c++)
+                if (!is_space(*c))
+                    command += *c;
+
+            parse_parameter(command);
+            p = close + (close < end);
+        }
+        else
+        {
+            const char* star = std::find(p, end, '*');
+
+            parse_block(p, star);
+            p = star + (star < end);
+        }
+    }
+
+    if (in_region)
+    {
+        warn("the last region isn't closed");
+        parse_block("G37", "G37" + 3);
+    }
+
+    step_and_repeat();
+    box = repeat_box;
+    place_image();
+}
+
+/******************************************************************************/
+/*
+ the image parameters are composed in the order gerbv applies them: axis
+ select, mirroring, offset, scaling, then the rotation. The rotations are
+ quarter turns, so the bounding box stays a box.
+ */
+/******************************************************************************/
+void RS274XImporter::place_image()
+{
+    image = shapes::affine::translation(0, 0);
+
+    if (swap_axes)
+    {
+        const shapes::affine swap = { 0, 1, 0, 1, 0, 0 };
+        image = image.then(swap);
+    }
+
+    image = image.then(shapes::affine::scaling(mirror_a ? -1 : 1, mirror_b ? -1 : 1));
+    image = image.then(shapes::affine::translation(offset_a, offset_b));
+    image = image.then(shapes::affine::scaling(scale_a, scale_b));
+    image = image.then(shapes::affine::rotation(rotation * M_PI / 180));
+
+    transformed = swap_axes || mirror_a || mirror_b || offset_a != 0 || offset_b != 0 ||
+                  scale_a != 1 || scale_b != 1 || rotation % 360 != 0;
+
+    if (!transformed)
+        return;
+
+    icoordpair first = box.min_corner();
+    icoordpair last = box.max_corner();
+
+    image(first);
+    image(last);
+
+    box = ibox(icoordpair(std::min(first.first, last.first),
+                          std::min(first.second, last.second)),
+               icoordpair(std::max(first.first, last.first),
+                          std::max(first.second, last.second)));
+}
+
+/******************************************************************************/
+/*
+ an extended parameter, with its blocks separated by asterisks; an aperture
+ macro takes all of its blocks
+ */
+/******************************************************************************/
+void RS274XImporter::parse_parameter(const string& command)
+{
+    vector<string> blocks;
+    size_t start = 0;
+
+    while (start < command.size())
+    {
+        size_t star = command.find('*', start);
+
+        if (star == string::npos)
+            star = command.size();
+
+        if (star > start)
+            blocks.push_back(command.substr(start, star - start));
+
+        start = star + 1;
+    }
+
+    if (blocks.empty())
+        return;
+
+    if (blocks.front().compare(0, 2, "AM") == 0)
+    {
+        define_macro(blocks.front().substr(2),
+                     vector<string>(blocks.begin() + 1, blocks.end()));
+        return;
+    }
+
+    for (vector<string>::const_iterator block = blocks.begin(); block != blocks.end();
+            ++block)
+    {
+        const string code = block->substr(0, 2);
+        const string value = block->substr(std::min<size_t>(2, block->size()));
+
+        if (code == "FS")
+        {
+            trailing_zeros = value.find('T') != string::npos;
+            incremental = value.find('I') != string::npos;
+
+            const size_t format = value.find('X');
+
+            if (format != string::npos && format + 2 < value.size())
+            {
+                integer_digits = value[format + 1] - '0';
+                decimal_digits = value[format + 2] - '0';
+            }
+        }
+        else if (code == "MO")
+            unit = value == "MM" ? 1 / 25.4 : 1;
+        else if (code == "AD")
+            define_aperture(value);
+        else if (code == "LP")
+            clear = value == "C";
+        else if (code == "IP")
+            negative = value == "NEG";
+        else if (code == "SR")
+        {
+            step_and_repeat();
+
+            repeat_x = 1;
+            repeat_y = 1;
+            repeat_dx = 0;
+            repeat_dy = 0;
+
+            for (size_t i = 0; i < value.size();)
+            {
+                const char letter = value[i++];
+                const size_t end = value.find_first_not_of("0123456789.+-", i);
+                const double number = atof(value.substr(i, end - i).c_str());
+
+                if (letter == 'X')
+                    repeat_x = std::max(int(number), 1);
+                else if (letter == 'Y')
+                    repeat_y = std::max(int(number), 1);
+                else if (letter == 'I')
+                    repeat_dx = number * unit;
+                else if (letter == 'J')
+                    repeat_dy = number * unit;
+
+                i = end == string::npos ? value.size() : end;
+            }
+        }
+        else if (code == "AS")
+        {
+            if (value != "AXBY" && value != "AYBX")
+                throw import_exception() << errorstring(path + ": invalid AS parameter " +
+                                                        value);
+
+            swap_axes = value == "AYBX";
+        }
+        else if (code == "MI")
+        {
+            mirror_a = parameter_value(value, 'A', 0) != 0;
+            mirror_b = parameter_value(value, 'B', 0) != 0;
+        }
+        else if (code == "OF")
+        {
+            offset_a = parameter_value(value, 'A', 0) * unit;
+            offset_b = parameter_value(value, 'B', 0) * unit;
+        }
+        else if (code == "SF")
+        {
+            scale_a = parameter_value(value, 'A', 1);
+            scale_b = parameter_value(value, 'B', 1);
+
+            if (scale_a == 0 || scale_b == 0)
+                throw import_exception() << errorstring(path + ": invalid SF parameter " +
+                                                        value);
+        }
+        else if (code == "IR")
+        {
+            rotation = atoi(value.c_str());
+
+            if (rotation % 90 != 0)
+                throw import_exception() << errorstring(path + ": the IR rotation of " +
+                                                        value + " degrees isn't a "
+                                                        "multiple of 90");
+        }
+        else if (code != "IN" && code != "LN" && code != "TF" && code != "TA" &&
+                 code != "TO" && code != "TD" && code != "IJ" && code != "IO")
+            warn("the unknown " + code + " parameter is ignored");
+    }
+}
+
+/******************************************************************************/
+/*
+ a data block: G and M codes, an operation or an aperture selection, and the
+ coordinates. Without an operation the coordinates repeat the last one, as
+ in the deprecated modal usage.
+ */
+/******************************************************************************/
+void RS274XImporter::parse_block(const char* begin, const char* end)
+{
+    int operation = 0;
+    bool coordinates = false;
+    bool has_ij = false;
+    double new_x = x;
+    double new_y = y;
+    double i = 0;
+    double j = 0;
+
+    for (const char* p = begin; p < end;)
+    {
+        const char letter = *p++;
+
+        if (is_space(letter))
+            continue;
+
+        const char* number_end = p;
+        while (number_end < end && is_number(*number_end))
+            number_end++;
+
+        const int code = atoi(string(p, number_end).c_str());
+        bool valid = true;
+        double value;
+
+        switch (letter)
+        {
+        case 'G':
+            switch (code)
+            {
+            case 1:
+            case 2:
+            case 3:
+                interpolation = code;
+                break;
+            case 4:
+                return;
+            case 36:
+                in_region = true;
+                regions.push_back(span());
+                regions.back().first = contours.size();
+                regions.back().count = 0;
+                contour_first = points.size();
+                break;
+            case 37:
+                if (in_region)
+                {
+                    close_contour();
+                    regions.back().count = contours.size() - regions.back().first;
+                    in_region = false;
+
+                    if (regions.back().count == 0)
+                        regions.pop_back();
+                    else
+                    {
+                        primitive region = primitive();
+                        region.type = PRIMITIVE_REGION;
+                        region.clear = clear;
+                        region.index = regions.size() - 1;
+                        primitives.push_back(region);
+                    }
+                }
+                break;
+            case 54:
+            case 55:
+                break;
+            case 70:
+                unit = 1;
+                break;
+            case 71:
+                unit = 1 / 25.4;
+                break;
+            case 74:
+                multi_quadrant = false;
+                break;
+            case 75:
+                multi_quadrant = true;
+                break;
+            case 90:
+                incremental = false;
+                break;
+            case 91:
+                incremental = true;
+                break;
+            default:
+                warn("unknown G codes are ignored");
+            }
+            break;
+
+        case 'M':
+            if (code == 0 || code == 2)
+                finished = true;
+            break;
+
+        case 'D':
+            if (code < 10)
+                operation = code;
+            else
+                current_aperture = code;
+            break;
+
+        case 'X':
+        case 'Y':
+        case 'I':
+        case 'J':
+            value = coordinate(p, number_end, valid);
+
+            if (!valid)
+                break;
+
+            if (letter == 'X')
+                new_x = incremental ? x + value : value;
+            else if (letter == 'Y')
+                new_y = incremental ? y + value : value;
+            else if (letter == 'I')
+                i = value;
+            else
+                j = value;
+
+            coordinates = true;
+            has_ij |= letter == 'I' || letter == 'J';
+            break;
+
+        case 'N':
+            break;
+
+        default:
+            warn(string("the unknown ") + letter + " words are ignored");
+        }
+
+        p = number_end;
+    }
+
+    if (!operation && coordinates)
+        operation = last_operation;
+
+    if (operation)
+    {
+        operate(operation, new_x, new_y, i, j, has_ij);
+        last_operation = operation;
+    }
+}
+
+/******************************************************************************/
+/*
+ a coordinate in inches, with the format of the FS parameter unless it has a
+ decimal point
+ */
+/******************************************************************************/
+double RS274XImporter::coordinate(const char* begin, const char* end, bool& valid) const
+{
+    const char* p = begin;
+    bool minus = false;
+    double value = 0;
+    int digits = 0;
+
+    if (p < end && (*p == '+' || *p == '-'))
+        minus = *p++ == '-';
+
+    if (std::find(p, end, '.') != end)
+    {
+        value = atof(string(p, end).c_str());
+        valid = p < end;
+        return (minus ? -value : value) * unit;
+    }
+
+    for (; p < end && *p >= '0' && *p <= '9'; p++, digits++)
+        value = value * 10 + (*p - '0');
+
+    valid = digits > 0;
+
+    // with the trailing zeros omitted the digits are aligned on the left
+    if (trailing_zeros)
+        value *= pow(10.0, integer_digits - digits);
+    else
+        value /= pow(10.0, decimal_digits);
+
+    return (minus ? -value : value) * unit;
+}
+
+/******************************************************************************/
+/*
+ D01 draws (or adds a segment to the contour of a region), D02 moves and D03
+ flashes the current aperture
+ */
+/******************************************************************************/
+void RS274XImporter::operate(int operation, double new_x, double new_y, double i,
+                             double j, bool has_ij)
+{
+    const bool circular = interpolation != 1;
+    arc_segment arc = arc_segment();
+
+    if (operation == 1 && circular && !arc_centre(new_x, new_y, i, j, arc))
+    {
+        if (!has_ij)
+            warn("the arcs without a centre are drawn as lines");
+        else if (!multi_quadrant)
+            warn("the single quadrant arcs whose I and J give no centre within 90 "
+                 "degrees are drawn as lines");
+        else
+            warn("the arcs with a zero radius are drawn as lines");
+        operation = -1;     // a line
+    }
+
+    if (in_region)
+    {
+        if (operation == 2)
+        {
+            close_contour();
+            contour_first = points.size();
+        }
+        else if (operation == 1 || operation == -1)
+        {
+            if (points.size() == contour_first)
+                points.push_back(icoordpair(x, y));
+
+            if (operation == 1 && circular)
+                shapes::append_arc(points, arc.cx, arc.cy, arc.radius, arc.angle1,
+                                   arc.angle2, vector_isolation::get_tolerance(), false);
+            else
+                points.push_back(icoordpair(new_x, new_y));
+
+            points.back() = icoordpair(new_x, new_y);
+        }
+
+        x = new_x;
+        y = new_y;
+        return;
+    }
+
+    if (operation == 1 || operation == -1 || operation == 3)
+    {
+        map<int, aperture>::const_iterator selected = apertures.find(current_aperture);
+
+        if (selected == apertures.end())
+            warn("the undefined apertures draw nothing");
+        else
+        {
+            const ibox& envelope = selected->second.envelope;
+            primitive drawn = primitive();
+
+            drawn.clear = clear;
+            drawn.index = current_aperture;
+            drawn.x1 = x;
+            drawn.y1 = y;
+            drawn.x2 = new_x;
+            drawn.y2 = new_y;
+
+            if (operation == 3)
+            {
+                drawn.type = PRIMITIVE_FLASH;
+                drawn.x1 = new_x;
+                drawn.y1 = new_y;
+                expand_box(new_x, new_y, envelope);
+            }
+            else if (operation == 1 && circular)
+            {
+                drawn.type = PRIMITIVE_ARC;
+                drawn.arc = arcs.size();
+                arcs.push_back(arc);
+                expand_box(arc, (envelope.max_corner().first -
+                                 envelope.min_corner().first) / 2);
+            }
+            else
+            {
+                drawn.type = PRIMITIVE_LINE;
+                expand_box(x, y, envelope);
+                expand_box(new_x, new_y, envelope);
+            }
+
+            primitives.push_back(drawn);
+        }
+    }
+
+    x = new_x;
+    y = new_y;
+}
+
+/******************************************************************************/
+/*
+ The centre of the arc from the current point to x, y. In multi quadrant mode
+ it's at the offset i, j from the start; in single quadrant mode the offset
+ has no sign, and the centre is the one making an arc of 90 degrees at most
+ whose radius is the same at both ends, up to the rounding of the coordinates
+ (1% or two units of the format). Returns false if there's no such centre.
+ */
+/******************************************************************************/
+bool RS274XImporter::arc_centre(double new_x, double new_y, double i, double j,
+                                arc_segment& arc) const
+{
+    const bool clockwise = interpolation == 2;
+    const double resolution = 2 * pow(10.0, -decimal_digits) * unit;
+    double best = -1;
+
+    for (int sign = 0; sign < (multi_quadrant ? 1 : 4); sign++)
+    {
+        arc_segment candidate;
+
+        candidate.cx = x + ((sign & 1) ? -fabs(i) : multi_quadrant ? i : fabs(i));
+        candidate.cy = y + ((sign & 2) ? -fabs(j) : multi_quadrant ? j : fabs(j));
+        candidate.radius = hypot(x - candidate.cx, y - candidate.cy);
+        candidate.angle1 = atan2(y - candidate.cy, x - candidate.cx);
+        candidate.angle2 = atan2(new_y - candidate.cy, new_x - candidate.cx);
+
+        // a multi quadrant arc ending where it starts is a whole circle
+        const bool whole = multi_quadrant && new_x == x && new_y == y;
+
+        if (clockwise)
+        {
+            while (candidate.angle2 > candidate.angle1 ||
+                    (whole && candidate.angle2 == candidate.angle1))
+                candidate.angle2 -= 2 * M_PI;
+        }
+        else
+        {
+            while (candidate.angle2 < candidate.angle1 ||
+                    (whole && candidate.angle2 == candidate.angle1))
+                candidate.angle2 += 2 * M_PI;
+        }
+
+        if (!multi_quadrant && fabs(candidate.angle2 - candidate.angle1) > M_PI / 2 + 1e-6)
+            continue;
+
+        const double mismatch = fabs(hypot(new_x - candidate.cx, new_y - candidate.cy) -
+                                     candidate.radius);
+
+        if (!multi_quadrant && mismatch > std::max(0.01 * candidate.radius, resolution))
+            continue;
+
+        if (best < 0 || mismatch < best)
+        {
+            best = mismatch;
+            arc = candidate;
+        }
+    }
+
+    return best >= 0 && arc.radius > 0;
+}
+
+/******************************************************************************/
+/*
+ ends the current contour of a region; the ones without an area are dropped
+ */
+/******************************************************************************/
+void RS274XImporter::close_contour()
+{
+    const unsigned int count = points.size() - contour_first;
+
+    if (count >= 3)
+    {
+        span contour;
+
+        contour.first = contour_first;
+        contour.count = count;
+        contours.push_back(contour);
+
+        for (unsigned int i = contour_first; i < points.size(); i++)
+            bg::expand(box, points[i]);
+    }
+    else
+        points.resize(contour_first);
+
+    contour_first = points.size();
+}
+
+/******************************************************************************/
+/*
+ ends the current step and repeat: its primitives are copied by each step
+ */
+/******************************************************************************/
+void RS274XImporter::step_and_repeat()
+{
+    const unsigned int last = primitives.size();
+
+    if ((repeat_x > 1 || repeat_y > 1) && last > repeat_first)
+    {
+        const ibox block = box;
+
+        for (int i = 0; i < repeat_x; i++)
+            for (int j = 0; j < repeat_y; j++)
+            {
+                const double dx = i * repeat_dx;
+                const double dy = j * repeat_dy;
+
+                if (i == 0 && j == 0)
+                    continue;
+
+                for (unsigned int k = repeat_first; k < last; k++)
+                {
+                    primitive copy = primitives[k];
+
+                    copy.x1 += dx;
+                    copy.y1 += dy;
+                    copy.x2 += dx;
+                    copy.y2 += dy;
+
+                    if (copy.type == PRIMITIVE_ARC)
+                    {
+                        arcs.push_back(arcs[copy.arc]);
+                        arcs.back().cx += dx;
+                        arcs.back().cy += dy;
+                        copy.arc = arcs.size() - 1;
+                    }
+                    else if (copy.type == PRIMITIVE_REGION)
+                    {
+                        const span region = regions[copy.index];
+
+                        regions.push_back(span());
+                        regions.back().first = contours.size();
+                        regions.back().count = region.count;
+
+                        for (unsigned int c = region.first; c < region.first + region.count;
+                                c++)
+                        {
+                            const span contour = contours[c];
+
+                            contours.push_back(span());
+                            contours.back().first = points.size();
+                            contours.back().count = contour.count;
+
+                            for (unsigned int n = contour.first;
+                                    n < contour.first + contour.count; n++)
+                                points.push_back(icoordpair(points[n].first + dx,
+                                                            points[n].second + dy));
+                        }
+
+                        copy.index = regions.size() - 1;
+                    }
+
+                    primitives.push_back(copy);
+                }
+
+                bg::expand(box, ibox(icoordpair(block.min_corner().first + dx,
+                                                block.min_corner().second + dy),
+                                     icoordpair(block.max_corner().first + dx,
+                                                block.max_corner().second + dy)));
+            }
+
+        contour_first = points.size();
+    }
+
+    // the box of the next block starts empty, and the one of the image is
+    // kept aside meanwhile
+    if (box.min_corner().first <= box.max_corner().first)
+        bg::expand(repeat_box, box);
+
+    bg::assign_inverse(box);
+    repeat_first = primitives.size();
+}
+
+/******************************************************************************/
+/*
+ */
+/******************************************************************************/
+void RS274XImporter::expand_box(double px, double py, const ibox& envelope)
+{
+    bg::expand(box, icoordpair(px + envelope.min_corner().first,
+                               py + envelope.min_corner().second));
+    bg::expand(box, icoordpair(px + envelope.max_corner().first,
+                               py + envelope.max_corner().second));
+}
+
+/******************************************************************************/
+/*
+ the ends of the arc and the points where it crosses the axes of its centre,
+ margin away from it
+ */
+/******************************************************************************/
+void RS274XImporter::expand_box(const arc_segment& arc, double margin)
+{
+    const double low = std::min(arc.angle1, arc.angle2);
+    const double high = std::max(arc.angle1, arc.angle2);
+    const ibox square(icoordpair(-margin, -margin), icoordpair(margin, margin));
+
+    expand_box(arc.cx + arc.radius * cos(low), arc.cy + arc.radius * sin(low), square);
+    expand_box(arc.cx + arc.radius * cos(high), arc.cy + arc.radius * sin(high), square);
+
+    for (double axis = ceil(low / (M_PI / 2)) * (M_PI / 2); axis < high; axis += M_PI / 2)
+        expand_box(arc.cx + arc.radius * cos(axis), arc.cy + arc.radius * sin(axis),
+                   square);
+}
+
+/******************************************************************************/
+/*
+ the parameters of a standard aperture are separated by X, after its type
+ */
+/******************************************************************************/
+void RS274XImporter::define_aperture(const string& command)
+{
+    size_t name_begin = 1;
+
+    while (name_begin < command.size() && command[name_begin] >= '0' &&
+            command[name_begin] <= '9')
+        name_begin++;
+
+    const int code = atoi(command.substr(1, name_begin - 1).c_str());
+    const size_t comma = command.find(',', name_begin);
+    const string name = command.substr(name_begin, comma - name_begin);
+    vector<double> arguments;
+
+    if (command.empty() || command[0] != 'D' || code < 10)
+    {
+        warn("the malformed apertures are ignored");
+        return;
+    }
+
+    if (comma != string::npos)
+    {
+        size_t start = comma + 1;
+
+        while (start <= command.size())
+        {
+            size_t separator = command.find('X', start);
+
+            if (separator == string::npos)
+                separator = command.size();
+
+            arguments.push_back(atof(command.substr(start, separator - start).c_str()));
+            start = separator + 1;
+        }
+    }
+
+    // some files give a single size to the square apertures
+    if ((name == "R" || name == "O") && arguments.size() == 1)
+        arguments.push_back(arguments.front());
+
+    aperture defined;
+    const size_t count = arguments.size();
+
+    if ((name == "C" && count >= 1) || ((name == "R" || name == "O") && count >= 2))
+    {
+        defined.type = name == "C" ? shapes::APERTURE_CIRCLE : name == "R" ?
+                       shapes::APERTURE_RECTANGLE : shapes::APERTURE_OVAL;
+
+        for (size_t i = 0; i < count; i++)
+            arguments[i] *= unit;
+
+        defined.parameters = arguments;
+    }
+    else if (name == "P" && count >= 2)
+    {
+        defined.type = shapes::APERTURE_POLYGON;
+
+        // the number of vertices and the rotation aren't lengths
+        for (size_t i = 0; i < count; i++)
+            if (i != 1 && i != 2)
+                arguments[i] *= unit;
+
+        defined.parameters = arguments;
+    }
+    else if (macros.count(name))
+    {
+        defined.type = -1;
+        expand_macro(macros[name], arguments, defined);
+    }
+    else
+    {
+        warn("the aperture " + name + " isn't defined, and draws nothing");
+        return;
+    }
+
+    build_shape(defined, vector_isolation::get_tolerance(), defined.shape);
+
+    if (defined.shape.empty())
+        defined.envelope = ibox(icoordpair(0, 0), icoordpair(0, 0));
+    else
+        bg::envelope(defined.shape, defined.envelope);
+
+    apertures[code] = defined;
+}
+
+/******************************************************************************/
+/*
+ the blocks of an AM parameter are the variable definitions ($n=expression)
+ and the primitives (code,expression,...); the comments (code 0) are dropped
+ */
+/******************************************************************************/
+void RS274XImporter::define_macro(const string& name, const vector<string>& blocks)
+{
+    macro& definition = macros[name];
+
+    definition.codes.clear();
+    definition.expressions.clear();
+
+    for (vector<string>::const_iterator block = blocks.begin(); block != blocks.end();
+            ++block)
+    {
+        const size_t equal = block->find('=');
+
+        if ((*block)[0] == '$' && equal != string::npos)
+        {
+            definition.codes.push_back(-1 - atoi(block->substr(1, equal - 1).c_str()));
+            definition.expressions.push_back(vector<string>(1, block->substr(equal + 1)));
+            continue;
+        }
+
+        vector<string> fields;
+        size_t start = 0;
+
+        while (start <= block->size())
+        {
+            size_t comma = block->find(',', start);
+
+            if (comma == string::npos)
+                comma = block->size();
+
+            fields.push_back(block->substr(start, comma - start));
+            start = comma + 1;
+        }
+
+        const int code = atoi(fields.front().c_str());
+
+        if (code == 0)
+            continue;
+
+        definition.codes.push_back(code);
+        definition.expressions.push_back(vector<string>(fields.begin() + 1, fields.end()));
+    }
+}
+
+/******************************************************************************/
+/*
+ evaluates the statements of a macro with the arguments of an AD command as
+ $1, $2...; the lengths are in the unit of the file until the primitives are
+ converted
+ */
+/******************************************************************************/
+void RS274XImporter::expand_macro(const macro& definition,
+                                  const vector<double>& arguments, aperture& expanded)
+{
+    vector<double> variables(1, 0);
+
+    variables.insert(variables.end(), arguments.begin(), arguments.end());
+
+    for (size_t s = 0; s < definition.codes.size(); s++)
+    {
+        const int code = definition.codes[s];
+        const vector<string>& fields = definition.expressions[s];
+
+        if (code < 0)
+        {
+            const double value = expression(fields.front(), variables).evaluate();
+            const size_t variable = -1 - code;
+
+            variables.resize(std::max(variables.size(), variable + 1), 0);
+            variables[variable] = value;
+            continue;
+        }
+
+        vector<double> parameters;
+
+        for (size_t f = 0; f < fields.size(); f++)
+            parameters.push_back(expression(fields[f], variables).evaluate());
+
+        if (!convert_primitive(code, parameters, unit))
+        {
+            warn("the unknown macro primitives are ignored");
+            continue;
+        }
+
+        expanded.primitives.push_back(std::make_pair(code, expanded.parameters.size()));
+        expanded.parameters.insert(expanded.parameters.end(), parameters.begin(),
+                                   parameters.end());
+    }
+}
+
+/******************************************************************************/
+/*
+ the polygons flashed by an aperture
+ */
+/******************************************************************************/
+void RS274XImporter::build_shape(const aperture& flashed, double tolerance,
+                                 imulti_polygon& shape)
+{
+    shape.clear();
+
+    if (flashed.type >= 0)
+    {
+        shapes::standard_flash(shapes::aperture_type(flashed.type), &flashed.parameters[0],
+                               flashed.parameters.size(), tolerance, shape);
+        return;
+    }
+
+    for (size_t i = 0; i < flashed.primitives.size(); i++)
+    {
+        imulti_polygon primitive_shape;
+        bool on;
+
+        if (shapes::macro_primitive(flashed.primitives[i].first,
+                                    &flashed.parameters[flashed.primitives[i].second],
+                                    tolerance, primitive_shape, on))
+            shapes::expose(primitive_shape, on, shape);
+    }
+}
+
+/******************************************************************************/
+/*
+ the polygons of a primitive; the tracks drawn by an aperture other than a
+ rectangle are drawn by a circle of its first parameter, like gerbv does
+ */
+/******************************************************************************/
+void RS274XImporter::shape_of(const primitive& drawn, double tolerance,
+                              imulti_polygon& shape) const
+{
+    shape.clear();
+
+    if (drawn.type == PRIMITIVE_REGION)
+    {
+        const span& region = regions[drawn.index];
+        ipolygon contour;
+
+        for (unsigned int c = region.first; c < region.first + region.count; c++)
+        {
+            contour.outer().assign(points.begin() + contours[c].first,
+                                   points.begin() + contours[c].first + contours[c].count);
+            shapes::add_contour(contour, shape);
+        }
+
+        return;
+    }
+
+    const aperture& used = apertures.find(drawn.index)->second;
+    const double width = used.parameters.empty() || used.type < 0 ? 0 : used.parameters[0];
+
+    if (drawn.type == PRIMITIVE_FLASH)
+    {
+        if (tolerance == vector_isolation::get_tolerance())
+            shape = used.shape;
+        else
+            build_shape(used, tolerance, shape);
+
+        shapes::transform(shapes::affine::translation(drawn.x1, drawn.y1), shape);
+    }
+    else if (drawn.type == PRIMITIVE_ARC)
+    {
+        const arc_segment& arc = arcs[drawn.arc];
+
+        shapes::arc_stroke(arc.cx, arc.cy, arc.radius, arc.angle1, arc.angle2, width,
+                           tolerance, shape);
+    }
+    else if (used.type == shapes::APERTURE_RECTANGLE)
+        shape.push_back(shapes::rectangle_stroke(drawn.x1, drawn.y1, drawn.x2, drawn.y2,
+                                                 width, used.parameters[1]));
+    else if (width > 0)
+        shape.push_back(shapes::round_stroke(drawn.x1, drawn.y1, drawn.x2, drawn.y2,
+                                             width, tolerance));
+}
+
+/******************************************************************************/
+/*
+ each warning is only printed once
+ */
+/******************************************************************************/
+void RS274XImporter::warn(const string& message)
+{
+    if (std::find(warnings.begin(), warnings.end(), message) != warnings.end())
+        return;
+
+    warnings.push_back(message);
+    cerr << "\nWarning: " << path << ": " << message << ".\n";
+}
+
+/******************************************************************************/
+/*
+ */
+/******************************************************************************/
+gdouble RS274XImporter::get_width()
+{
+    return box.max_corner().first - box.min_corner().first;
+}
+
+/******************************************************************************/
+/*
+ */
+/******************************************************************************/
+gdouble RS274XImporter::get_height()
+{
+    return box.max_corner().second - box.min_corner().second;
+}
+
+/******************************************************************************/
+/*
+ */
+/******************************************************************************/
+gdouble RS274XImporter::get_min_x()
+{
+    return box.min_corner().first;
+}
+
+/******************************************************************************/
+/*
+ */
+/******************************************************************************/
+gdouble RS274XImporter::get_max_x()
+{
+    return box.max_corner().first;
+}
+
+/******************************************************************************/
+/*
+ */
+/******************************************************************************/
+gdouble RS274XImporter::get_min_y()
+{
+    return box.min_corner().second;
+}
+
+/******************************************************************************/
+/*
+ */
+/******************************************************************************/
+gdouble RS274XImporter::get_max_y()
+{
+    return box.max_corner().second;
+}
+
+/******************************************************************************/
+/*
+ */
+/******************************************************************************/
+void RS274XImporter::render(Cairo::RefPtr<Cairo::ImageSurface> surface, const guint dpi,
+                            const double min_x, const double min_y,
+                            const bool antialias) throw (import_exception)
+{
+    if (scanline)
+        render_scanlines(surface, dpi, min_x, min_y, antialias);
+    else
+        render_cairo(surface, dpi, min_x, min_y, antialias);
+}
+
+/******************************************************************************/
+/*
+ Draws the primitives in their order, in white, the clear ones erasing the
+ surface. The circular tracks are drawn by cairo, the other apertures are
+ filled with their polygons and the flashes are copied from their stamps;
+ the regions are filled with the even-odd rule, like gerbv does. A negative
+ image starts filled over its bounding box, and the polarities are swapped.
+ */
+/******************************************************************************/
+void RS274XImporter::render_cairo(Cairo::RefPtr<Cairo::ImageSurface> surface,
+                                  const guint dpi, const double min_x,
+                                  const double min_y, const bool antialias)
+{
+    Cairo::RefPtr<Cairo::Context> cr = Cairo::Context::create(surface);
+
+    cr->translate(0, surface->get_height());
+    cr->scale(dpi, -double(dpi));
+    cr->translate(-min_x, -min_y);
+    cr->set_antialias(antialias ? Cairo::ANTIALIAS_DEFAULT : Cairo::ANTIALIAS_NONE);
+    cr->set_source_rgba(1, 1, 1, 1);
+    cr->set_line_cap(Cairo::LINE_CAP_ROUND);
+
+    if (negative)
+    {
+        cr->rectangle(get_min_x(), get_min_y(), get_width(), get_height());
+        cr->fill();
+    }
+
+    // the primitives are in the coordinates of the file
+    if (transformed)
+    {
+        cairo_matrix_t matrix;
+
+        cairo_matrix_init(&matrix, image.xx, image.yx, image.xy, image.yy, image.x0,
+                          image.y0);
+        cairo_transform(cr->cobj(), &matrix);
+    }
+
+    // set while the flashes are blitted into the surface behind cairo's back
+    bool direct = false;
+
+    for (vector<primitive>::const_iterator drawn = primitives.begin();
+            drawn != primitives.end(); ++drawn)
+    {
+        cr->set_operator(drawn->clear != negative ? Cairo::OPERATOR_CLEAR :
+                         Cairo::OPERATOR_OVER);
+
+        if (direct && drawn->type != PRIMITIVE_FLASH)
+        {
+            surface->mark_dirty();
+            direct = false;
+        }
+
+        if (drawn->type == PRIMITIVE_REGION)
+        {
+            const span& region = regions[drawn->index];
+
+            for (unsigned int c = region.first; c < region.first + region.count; c++)
+            {
+                const icoordpair* point = &points[contours[c].first];
+
+                cr->move_to(point->first, point->second);
+                for (unsigned int n = 1; n < contours[c].count; n++)
+                    cr->line_to(point[n].first, point[n].second);
+                cr->close_path();
+            }
+
+            cr->set_fill_rule(Cairo::FILL_RULE_EVEN_ODD);
+            cr->fill();
+            continue;
+        }
+
+        const aperture& used = apertures.find(drawn->index)->second;
+        const bool round = used.type == shapes::APERTURE_CIRCLE &&
+                           (used.parameters.size() < 2 || used.parameters[1] <= 0);
+        const double width = used.parameters.empty() || used.type < 0 ? 0 :
+                             used.parameters[0];
+
+        if (drawn->type == PRIMITIVE_FLASH)
+        {
+            int pixel_x, pixel_y;
+            // the stamps are only cached in the coordinates of the image
+            const shared_ptr<const stamp_cache::stamp> flash = transformed ?
+                shared_ptr<const stamp_cache::stamp>() :
+                stamps.get(drawn->index, used.shape, round ? width : 0, dpi,
+                           (drawn->x1 - min_x) * dpi,
+                           surface->get_height() - (drawn->y1 - min_y) * dpi,
+                           antialias, pixel_x, pixel_y);
+
+            if (flash)
+            {
+                if (!direct)
+                {
+                    surface->flush();
+                    direct = true;
+                }
+
+                stamp_cache::blit(*flash, pixel_x, pixel_y, drawn->clear != negative,
+                                  surface);
+            }
+            else
+            {
+                if (direct)
+                {
+                    surface->mark_dirty();
+                    direct = false;
+                }
+
+                cr->save();
+                cr->translate(drawn->x1, drawn->y1);
+                stamp_cache::draw(cr, used.shape, round ? width : 0);
+                cr->restore();
+                cr->fill();
+            }
+
+            continue;
+        }
+
+        if (drawn->type == PRIMITIVE_ARC ||
+                (drawn->type == PRIMITIVE_LINE && used.type != shapes::APERTURE_RECTANGLE))
+        {
+            if (width <= 0)
+                continue;
+
+            if (drawn->type == PRIMITIVE_ARC)
+            {
+                const arc_segment& arc = arcs[drawn->arc];
+
+                cr->begin_new_sub_path();
+                if (arc.angle2 > arc.angle1)
+                    cr->arc(arc.cx, arc.cy, arc.radius, arc.angle1, arc.angle2);
+                else
+                    cr->arc_negative(arc.cx, arc.cy, arc.radius, arc.angle1, arc.angle2);
+            }
+            else
+            {
+                cr->move_to(drawn->x1, drawn->y1);
+                cr->line_to(drawn->x2, drawn->y2);
+            }
+
+            cr->set_line_width(width);
+            cr->stroke();
+        }
+        else
+        {
+            imulti_polygon shape;
+
+            shape_of(*drawn, vector_isolation::get_tolerance(), shape);
+            stamp_cache::draw(cr, shape, 0);
+            cr->fill();
+        }
+    }
+
+    if (direct)
+        surface->mark_dirty();
+}
+
+/******************************************************************************/
+/*
+ Draws the primitives like render_cairo(), with the scanline rasteriser
+ writing straight into the memory of the surface. The flashes too large for
+ a stamp and the tracks are flattened into contours, filled one primitive at
+ a time with the non-zero winding rule.
+ */
+/******************************************************************************/
+void RS274XImporter::render_scanlines(Cairo::RefPtr<Cairo::ImageSurface> surface,
+                                      const guint dpi, const double min_x,
+                                      const double min_y, const bool antialias)
+{
+    surface->flush();
+
+    const shapes::affine to_device = shapes::affine::translation(-min_x, -min_y).then(
+        shapes::affine::scaling(dpi, -double(dpi))).then(
+        shapes::affine::translation(0, surface->get_height()));
+
+    if (negative)
+    {
+        scanline_rasteriser board(surface->get_data(), surface->get_width(),
+                                  surface->get_height(), surface->get_stride(),
+                                  antialias, to_device);
+
+        board.add_box(box);
+        board.fill(scanline_rasteriser::FILL_NONZERO, false);
+    }
+
+    // the primitives are in the coordinates of the file
+    scanline_rasteriser rasteriser(surface->get_data(), surface->get_width(),
+                                   surface->get_height(), surface->get_stride(),
+                                   antialias, image.then(to_device));
+
+    for (vector<primitive>::const_iterator drawn = primitives.begin();
+            drawn != primitives.end(); ++drawn)
+    {
+        const bool erase = drawn->clear != negative;
+
+        if (drawn->type == PRIMITIVE_REGION)
+        {
+            const span& region = regions[drawn->index];
+
+            for (unsigned int c = region.first; c < region.first + region.count; c++)
+                rasteriser.add_contour(&points[contours[c].first], contours[c].count);
+
+            rasteriser.fill(scanline_rasteriser::FILL_EVEN_ODD, erase);
+            continue;
+        }
+
+        const aperture& used = apertures.find(drawn->index)->second;
+        const bool round = used.type == shapes::APERTURE_CIRCLE &&
+                           (used.parameters.size() < 2 || used.parameters[1] <= 0);
+        const double width = used.parameters.empty() || used.type < 0 ? 0 :
+                             used.parameters[0];
+
+        if (drawn->type == PRIMITIVE_FLASH)
+        {
+            int pixel_x, pixel_y;
+            // the stamps are only cached in the coordinates of the image
+            const shared_ptr<const stamp_cache::stamp> flash = transformed ?
+                shared_ptr<const stamp_cache::stamp>() :
+                stamps.get(drawn->index, used.shape, round ? width : 0, dpi,
+                           (drawn->x1 - min_x) * dpi,
+                           surface->get_height() - (drawn->y1 - min_y) * dpi,
+                           antialias, pixel_x, pixel_y);
+
+            if (flash)
+            {
+                stamp_cache::blit(*flash, pixel_x, pixel_y, erase, surface);
+                continue;
+            }
+
+            if (round)
+                rasteriser.add_circle(drawn->x1, drawn->y1, width);
+            else
+                rasteriser.add_polygons(used.shape, drawn->x1, drawn->y1);
+        }
+        else if (drawn->type == PRIMITIVE_ARC ||
+                 (drawn->type == PRIMITIVE_LINE && used.type != shapes::APERTURE_RECTANGLE))
+        {
+            if (width <= 0)
+                continue;
+
+            if (drawn->type == PRIMITIVE_ARC)
+            {
+                const arc_segment& arc = arcs[drawn->arc];
+
+                rasteriser.add_arc_stroke(arc.cx, arc.cy, arc.radius, arc.angle1,
+                                          arc.angle2, width);
+            }
+            else
+                rasteriser.add_round_stroke(drawn->x1, drawn->y1, drawn->x2, drawn->y2,
+                                            width);
+        }
+        else
+        {
+            imulti_polygon shape;
+
+            shape_of(*drawn, vector_isolation::get_tolerance(), shape);
+            rasteriser.add_polygons(shape, 0, 0);
+        }
+
+        rasteriser.fill(scanline_rasteriser::FILL_NONZERO, erase);
+    }
+
+    surface->mark_dirty();
+}
+
+/******************************************************************************/
+/*
+ the shapes are united in batches of primitives with the same polarity
+ */
+/******************************************************************************/
+bool RS274XImporter::vectorise(imulti_polygon& copper, double tolerance)
+{
+    vector<imulti_polygon> batch;
+    bool batch_clear = false;
+
+    copper.clear();
+
+    try
+    {
+        for (vector<primitive>::const_iterator drawn = primitives.begin();
+                drawn != primitives.end(); ++drawn)
+        {
+            if (drawn->clear != batch_clear)
+            {
+                shapes::merge_batch(batch, batch_clear, copper);
+                batch_clear = drawn->clear;
+            }
+
+            batch.push_back(imulti_polygon());
+            shape_of(*drawn, tolerance, batch.back());
+        }
+
+        shapes::merge_batch(batch, batch_clear, copper);
+
+        if (transformed)
+            shapes::transform(image, copper);
+
+        // a negative image is clear where the primitives are drawn
+        if (negative)
+        {
+            imulti_polygon board =
+                shapes::single(shapes::rectangle((get_min_x() + get_max_x()) / 2,
+                                                 (get_min_y() + get_max_y()) / 2,
+                                                 get_width(), get_height()));
+
+            shapes::expose(copper, false, board);
+            copper.swap(board);
+        }
+    }
+    catch (const boost::geometry::exception& e)
+    {
+        cerr << "\nWarning: the polygons of " << path << " can't be built ("
+             << e.what() << "); the layer will be rasterised.\n";
+        copper.clear();
+        return false;
+    }
+
+    return true;
+}
@@ -0,0 +1,211 @@
+/*
+ * This file is part of pcb2gcode.
+ *
+ * Copyright (C) 2016 the pcb2gcode developers
+ *
+ * pcb2gcode is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * pcb2gcode is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with pcb2gcode.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef RS274XIMPORTER_HPP
+#define RS274XIMPORTER_HPP
+
+#include <map>
+using std::map;
+#include <string>
+using std::string;
+#include <vector>
+using std::vector;
+
+#include "importer.hpp"
+#include "shapes.hpp"
+#include "stamp_cache.hpp"
+
+/******************************************************************************/
+/*
+ Native importer for RS274-X Gerber files.
+
+ The file is memory-mapped and parsed in a single pass, without libgerbv:
+ only the primitives are kept (flashes, linear and circular tracks and
+ regions, with their polarities and step and repeats), in inches, and the
+ bounding box is computed along the way. The aperture macros are evaluated
+ by the AD commands, each aperture keeping the array of its primitives and
+ its polygons. The primitives keep the coordinates of the file, and the
+ deprecated image parameters (AS, MI, OF, SF, IR) are applied to all of them
+ as a single affine transformation when rendering or vectorising. The
+ flashes that fit in a stamp_cache are copied from their cached
+ rasterisations when rendering, unless the image is transformed.
+ */
+/******************************************************************************/
+class RS274XImporter: virtual public LayerImporter
+{
+public:
+    // throws import_exception if the file can't be read or parsed; scanline
+    // renders with the scanline_rasteriser instead of cairo
+    RS274XImporter(const string path, bool scanline = false);
+
+    virtual gdouble get_width();
+    virtual gdouble get_height();
+    virtual gdouble get_min_x();
+    virtual gdouble get_max_x();
+    virtual gdouble get_min_y();
+    virtual gdouble get_max_y();
+
+    // render() only reads the primitives, and can run concurrently on any
+    // number of surfaces
+    virtual void render(Cairo::RefPtr<Cairo::ImageSurface> surface,
+                        const guint dpi, const double min_x,
+                        const double min_y, const bool antialias)
+    throw (import_exception);
+    virtual unsigned int prepare_concurrent_render(unsigned int count)
+    {
+        return count;
+    }
+    virtual bool vectorise(imulti_polygon& copper, double tolerance);
+
+protected:
+    enum primitive_type { PRIMITIVE_FLASH, PRIMITIVE_LINE, PRIMITIVE_ARC,
+                          PRIMITIVE_REGION };
+
+    // x1, y1 is the position of a flash or the start of a track, x2, y2 the
+    // end of a track; index is the one of the aperture, or of the region
+    struct primitive
+    {
+        unsigned char type;
+        bool clear;
+        unsigned int index;
+        unsigned int arc;       // of an arc, in arcs
+        double x1, y1, x2, y2;
+    };
+
+    // angles in radians, counterclockwise from angle1 if angle2 > angle1
+    struct arc_segment
+    {
+        double cx, cy;
+        double radius;
+        double angle1, angle2;
+    };
+
+    // the contours of a region, [first, first + count) in contours, each
+    // one [first, first + count) in points
+    struct span
+    {
+        unsigned int first;
+        unsigned int count;
+    };
+
+    // a standard aperture (shapes::aperture_type) or a macro one (-1), in
+    // inches; a macro keeps its evaluated primitives, each one a code and
+    // the first of its parameters
+    struct aperture
+    {
+        int type;
+        vector<double> parameters;
+        vector<std::pair<int, unsigned int> > primitives;
+        // flashed at the origin, within vector_isolation::get_tolerance()
+        imulti_polygon shape;
+        ibox envelope;
+    };
+
+    // an aperture macro, as parsed: its statements, each one a primitive
+    // code or, for the variable definitions, -1 - the variable, and its
+    // expressions
+    struct macro
+    {
+        vector<int> codes;
+        vector<vector<string> > expressions;
+    };
+
+    void parse(const char* begin, const char* end);
+    void parse_parameter(const string& command);
+    void parse_block(const char* begin, const char* end);
+    void define_aperture(const string& command);
+    void define_macro(const string& name, const vector<string>& blocks);
+    void expand_macro(const macro& definition, const vector<double>& arguments,
+                      aperture& expanded);
+    double coordinate(const char* begin, const char* end, bool& valid) const;
+    void operate(int operation, double x, double y, double i, double j,
+                 bool has_ij);
+    bool arc_centre(double x, double y, double i, double j, arc_segment& arc) const;
+    void close_contour();
+    void step_and_repeat();
+    // composes the image parameters, and moves the bounding box into the image
+    void place_image();
+    // the box of the image, with the envelope centred on x, y
+    void expand_box(double x, double y, const ibox& envelope);
+    void expand_box(const arc_segment& arc, double margin);
+    static void build_shape(const aperture& flashed, double tolerance,
+                            imulti_polygon& shape);
+    void shape_of(const primitive& drawn, double tolerance, imulti_polygon& shape) const;
+    void render_cairo(Cairo::RefPtr<Cairo::ImageSurface> surface, const guint dpi,
+                      const double min_x, const double min_y, const bool antialias);
+    void render_scanlines(Cairo::RefPtr<Cairo::ImageSurface> surface, const guint dpi,
+                          const double min_x, const double min_y,
+                          const bool antialias);
+    void warn(const string& message);
+
+private:
+    const string path;
+    const bool scanline;
+
+    vector<primitive> primitives;
+    vector<arc_segment> arcs;
+    vector<span> regions;
+    vector<span> contours;
+    ipolygon::ring_type points;
+    map<int, aperture> apertures;
+    map<string, macro> macros;
+
+    // the bounding box, of the primitives before the current step and repeat
+    // in repeat_box
+    ibox box;
+    ibox repeat_box;
+    bool negative;
+
+    // parsing state
+    double unit;            // of the file, in inches
+    int integer_digits;
+    int decimal_digits;
+    bool trailing_zeros;    // omitted, instead of the leading ones
+    bool incremental;
+    int interpolation;      // 1, 2 (clockwise) or 3 (counterclockwise)
+    bool multi_quadrant;
+    bool in_region;
+    bool clear;
+    bool finished;
+    int current_aperture;
+    int last_operation;
+    double x, y;
+    // the first point of the current contour of a region
+    unsigned int contour_first;
+    // the first primitive of the current step and repeat, and its steps
+    unsigned int repeat_first;
+    int repeat_x, repeat_y;
+    double repeat_dx, repeat_dy;
+    vector<string> warnings;
+
+    // the deprecated image parameters
+    bool swap_axes;
+    bool mirror_a, mirror_b;
+    double offset_a, offset_b;      // in inches
+    double scale_a, scale_b;
+    int rotation;                   // in degrees, counterclockwise
+    // all of them, from the coordinates of the file to the ones of the image
+    shapes::affine image;
+    bool transformed;               // image isn't the identity
+
+    // the flashes, shared by the renderings
+    stamp_cache stamps;
+};
+
+#endif // RS274XIMPORTER_HPP
@@ -0,0 +1,216 @@
+/*
+ * This file is part of pcb2gcode.
+ *
+ * Copyright (C) 2016 the pcb2gcode developers
+ *
+ * pcb2gcode is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * pcb2gcode is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with pcb2gcode.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "run_set.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+
+/******************************************************************************/
+/*
+ raster order
+ */
+/******************************************************************************/
+static bool run_before(const pixel_run& a, const pixel_run& b)
+{
+    return a.y < b.y || (a.y == b.y && a.first < b.first);
+}
+
+/******************************************************************************/
+/*
+ */
+/******************************************************************************/
+void run_set::assign(const vector<pixel_run>* lists, int count)
+{
+    vector<unsigned int> cursor(count, 0);
+
+    runs.clear();
+
+    while (true)
+    {
+        int next = -1;
+
+        for (int i = 0; i < count; i++)
+            if (cursor[i] < lists[i].size() &&
+                    (next < 0 || run_before(lists[i][cursor[i]], lists[next][cursor[next]])))
+                next = i;
+
+        if (next < 0)
+            break;
+
+        const pixel_run& run = lists[next][cursor[next]++];
+        append(run.y, run.first, run.last);
+    }
+}
+
+/******************************************************************************/
+/*
+ each row of the border is made of the runs of the 3 rows around it, dilated
+ by one pixel and merged by column, with the runs of the set cut out. All the
+ rows are sorted, so it's a linear merge.
+ */
+/******************************************************************************/
+void run_set::get_border(int width, int height, run_set& border) const
+{
+    border.clear();
+
+    // first run of each row of the set, and the end of the runs
+    vector<unsigned int> rows;
+
+    for (unsigned int i = 0; i < runs.size(); i++)
+        if (i == 0 || runs[i].y != runs[i - 1].y)
+            rows.push_back(i);
+
+    rows.push_back(runs.size());
+
+    run_set joined;
+    unsigned int first_row = 0;     // first row of the set at y - 1 or after
+    int previous_y = -1;
+
+    for (unsigned int r = 0; r + 1 < rows.size(); r++)
+    {
+        for (int y = runs[rows[r]].y - 1; y <= runs[rows[r]].y + 1; y++)
+        {
+            if (y <= previous_y || y >= height)
+                continue;
+
+            previous_y = y;
+
+            while (runs[rows[first_row]].y < y - 1)
+                first_row++;
+
+            // the rows y - 1, y and y + 1 of the set
+            unsigned int cursor[3];
+            unsigned int end[3];
+            int sources = 0;
+            unsigned int own = 0;
+            unsigned int own_end = 0;
+
+            for (unsigned int i = first_row; i + 1 < rows.size() && runs[rows[i]].y <= y + 1; i++)
+            {
+                cursor[sources] = rows[i];
+                end[sources] = rows[i + 1];
+                sources++;
+
+                if (runs[rows[i]].y == y)
+                {
+                    own = rows[i];
+                    own_end = rows[i + 1];
+                }
+            }
+
+            joined.clear();
+
+            while (true)
+            {
+                int next = -1;
+
+                for (int i = 0; i < sources; i++)
+                    if (cursor[i] < end[i] &&
+                            (next < 0 || runs[cursor[i]].first < runs[cursor[next]].first))
+                        next = i;
+
+                if (next < 0)
+                    break;
+
+                const pixel_run& run = runs[cursor[next]++];
+                joined.append(y, std::max(run.first - 1, 0), std::min(run.last + 1, width - 1));
+            }
+
+            for (unsigned int i = 0; i < joined.runs.size(); i++)
+            {
+                const pixel_run& run = joined.runs[i];
+                int x = run.first;
+
+                while (own < own_end && runs[own].last < run.first)
+                    own++;
+
+                for (unsigned int j = own; j < own_end && runs[j].first <= run.last; j++)
+                {
+                    if (runs[j].first > x)
+                        border.append(y, x, runs[j].first - 1);
+
+                    x = std::max(x, runs[j].last + 1);
+                }
+
+                if (x <= run.last)
+                    border.append(y, x, run.last);
+            }
+        }
+    }
+}
+
+/******************************************************************************/
+/*
+ */
+/******************************************************************************/
+unsigned int run_set::find(int x, int y) const
+{
+    const pixel_run key = { y, x, x };
+    unsigned int i = std::lower_bound(runs.begin(), runs.end(), key, run_before) - runs.begin();
+
+    // the previous run can start before x and still reach it
+    if (i > 0 && runs[i - 1].y == y && runs[i - 1].last >= x)
+        i--;
+
+    return i;
+}
+
+/******************************************************************************/
+/*
+ breadth-first visit of the runs, where two runs of consecutive rows are
+ 4-connected when their columns overlap
+ */
+/******************************************************************************/
+void run_set::get_connected(int x, int y, run_set& part) const
+{
+    const unsigned int start = find(x, y);
+
+    if (start == runs.size() || runs[start].y != y || runs[start].first > x)
+        throw std::logic_error("run_set::get_connected(): the start is not in the set.");
+
+    vector<bool> reached(runs.size(), false);
+    vector<unsigned int> queue(1, start);
+    reached[start] = true;
+
+    for (unsigned int i = 0; i < queue.size(); i++)
+    {
+        const pixel_run& run = runs[queue[i]];
+
+        for (int ny = run.y - 1; ny <= run.y + 1; ny += 2)
+        {
+            for (unsigned int j = find(run.first, ny);
+                    j < runs.size() && runs[j].y == ny && runs[j].first <= run.last; j++)
+            {
+                if (!reached[j])
+                {
+                    reached[j] = true;
+                    queue.push_back(j);
+                }
+            }
+        }
+    }
+
+    part.clear();
+
+    for (unsigned int i = 0; i < runs.size(); i++)
+        if (reached[i])
+            part.runs.push_back(runs[i]);
+}
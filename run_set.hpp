@@ -0,0 +1,99 @@
+/*
+ * This file is part of pcb2gcode.
+ *
+ * Copyright (C) 2016 the pcb2gcode developers
+ *
+ * pcb2gcode is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * pcb2gcode is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with pcb2gcode.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef RUN_SET_HPP
+#define RUN_SET_HPP
+
+#include <vector>
+using std::vector;
+
+/******************************************************************************/
+/*
+ Horizontal run of pixels, from first to last (included).
+ */
+/******************************************************************************/
+struct pixel_run
+{
+    int y;
+    int first;
+    int last;
+};
+
+/******************************************************************************/
+/*
+ Run-length encoded set of pixels: disjoint, non-touching runs sorted in
+ raster order. Copper areas are mostly long horizontal runs, so the set
+ operations are proportional to the number of runs instead of pixels.
+ */
+/******************************************************************************/
+class run_set
+{
+public:
+    // the runs must be appended in raster order; a run touching or
+    // overlapping the last one is joined to it
+    void append(int y, int first, int last)
+    {
+        if (!runs.empty() && runs.back().y == y && runs.back().last + 1 >= first)
+        {
+            if (last > runs.back().last)
+                runs.back().last = last;
+        }
+        else
+        {
+            const pixel_run run = { y, first, last };
+            runs.push_back(run);
+        }
+    }
+
+    const vector<pixel_run>& get_runs() const
+    {
+        return runs;
+    }
+    bool empty() const
+    {
+        return runs.empty();
+    }
+    void clear()
+    {
+        runs.clear();
+    }
+    void swap(run_set& other)
+    {
+        runs.swap(other.runs);
+    }
+
+    // replaces the set with the union of some lists of runs, each one in
+    // raster order but possibly overlapping
+    void assign(const vector<pixel_run>* lists, int count);
+
+    // the pixels 8-adjacent to the set and not in it, within width x height
+    void get_border(int width, int height, run_set& border) const;
+    // the part of the set 4-connected to the pixel x, y, which must belong
+    // to it
+    void get_connected(int x, int y, run_set& part) const;
+
+protected:
+    vector<pixel_run> runs;
+
+    // index of the first run of the row y ending at x or after it
+    unsigned int find(int x, int y) const;
+};
+
+#endif // RUN_SET_HPP
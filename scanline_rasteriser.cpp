@@ -0,0 +1,445 @@
+/*
+ * This file is part of pcb2gcode.
+ *
+ * Copyright (C) 2016 the pcb2gcode developers
+ *
+ * pcb2gcode is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * pcb2gcode is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with pcb2gcode.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "scanline_rasteriser.hpp"
+
+#include <stdint.h>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace
+{
+
+// sub-rows of the anti-aliased rows, each one worth subrow_weight of the 256
+// of a covered pixel
+const int subrows = 16;
+const int subrow_weight = 256 / subrows;
+
+/******************************************************************************/
+/*
+ mask of the pixels first to last (0 to 31) of a word of a FORMAT_A1 row,
+ with the bit order of bitplane::bit()
+ */
+/******************************************************************************/
+inline uint32_t pixel_mask(int first, int last)
+{
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    return (0xFFFFFFFFu >> first) & (0xFFFFFFFFu << (31 - last));
+#else
+    return (0xFFFFFFFFu << first) & (0xFFFFFFFFu >> (31 - last));
+#endif
+}
+
+/******************************************************************************/
+/*
+ sets or clears the pixels whose centre is in a span of a FORMAT_A1 row, the
+ whole words at once
+ */
+/******************************************************************************/
+struct bit_span
+{
+    uint32_t* row;
+    int width;
+    bool clear;
+
+    void operator()(double x0, double x1) const
+    {
+        const int first = std::max(int(ceil(x0 - 0.5)), 0);
+        const int last = std::min(int(ceil(x1 - 0.5)) - 1, width - 1);
+
+        if (first > last)
+            return;
+
+        const int first_word = first / 32;
+        const int last_word = last / 32;
+
+        if (first_word == last_word)
+        {
+            apply(first_word, pixel_mask(first & 31, last & 31));
+            return;
+        }
+
+        apply(first_word, pixel_mask(first & 31, 31));
+        std::fill(row + first_word + 1, row + last_word, clear ? 0 : 0xFFFFFFFFu);
+        apply(last_word, pixel_mask(0, last & 31));
+    }
+
+    void apply(int word, uint32_t mask) const
+    {
+        if (clear)
+            row[word] &= ~mask;
+        else
+            row[word] |= mask;
+    }
+};
+
+/******************************************************************************/
+/*
+ adds the part of each pixel covered by a span of a sub-row to the coverage
+ of the row, and keeps the range of the pixels it touched
+ */
+/******************************************************************************/
+struct coverage_span
+{
+    int* accumulated;
+    int width;
+    int first_touched;
+    int last_touched;
+
+    void operator()(double x0, double x1)
+    {
+        x0 = std::max(x0, 0.0);
+        x1 = std::min(x1, double(width));
+
+        if (x0 >= x1)
+            return;
+
+        const int first = int(x0);
+        const int last = std::min(int(x1), width - 1);
+
+        if (first == int(x1))
+            accumulated[first] += int((x1 - x0) * subrow_weight + 0.5);
+        else
+        {
+            accumulated[first] += int((first + 1 - x0) * subrow_weight + 0.5);
+
+            for (int x = first + 1; x < int(x1); x++)
+                accumulated[x] += subrow_weight;
+
+            if (int(x1) < width)
+                accumulated[int(x1)] += int((x1 - int(x1)) * subrow_weight + 0.5);
+        }
+
+        first_touched = std::min(first_touched, first);
+        last_touched = std::max(last_touched, last);
+    }
+};
+
+}
+
+/******************************************************************************/
+/*
+ */
+/******************************************************************************/
+scanline_rasteriser::scanline_rasteriser(unsigned char* data, int width, int height,
+        int stride, bool antialias, const shapes::affine& to_device) :
+    data(data), width(width), height(height), stride(stride), antialias(antialias),
+    to_device(to_device), next_edge(0)
+{
+    const double scale = sqrt(fabs(to_device.xx * to_device.yy -
+                                   to_device.xy * to_device.yx));
+
+    tolerance = 0.125 / scale;
+    min_x = min_y = std::numeric_limits<double>::max();
+    max_x = max_y = -std::numeric_limits<double>::max();
+
+    if (antialias)
+        accumulated.assign(width, 0);
+}
+
+/******************************************************************************/
+/*
+ the horizontal edges cross no row
+ */
+/******************************************************************************/
+void scanline_rasteriser::add_edge(const icoordpair& from, const icoordpair& to)
+{
+    if (from.second == to.second)
+        return;
+
+    edge added;
+
+    added.direction = from.second < to.second ? 1 : -1;
+
+    const icoordpair& top = added.direction > 0 ? from : to;
+    const icoordpair& bottom = added.direction > 0 ? to : from;
+
+    added.y0 = top.second;
+    added.y1 = bottom.second;
+    added.x0 = top.first;
+    added.slope = (bottom.first - top.first) / (bottom.second - top.second);
+    edges.push_back(added);
+
+    min_x = std::min(min_x, std::min(from.first, to.first));
+    max_x = std::max(max_x, std::max(from.first, to.first));
+    min_y = std::min(min_y, top.second);
+    max_y = std::max(max_y, bottom.second);
+}
+
+/******************************************************************************/
+/*
+ */
+/******************************************************************************/
+void scanline_rasteriser::add_contour(const icoordpair* points, size_t count)
+{
+    if (count < 3)
+        return;
+
+    icoordpair first = points[0];
+    icoordpair previous;
+
+    to_device(first);
+    previous = first;
+
+    for (size_t i = 1; i < count; i++)
+    {
+        icoordpair current = points[i];
+
+        to_device(current);
+        add_edge(previous, current);
+        previous = current;
+    }
+
+    add_edge(previous, first);
+}
+
+/******************************************************************************/
+/*
+ the holes of the polygons run the other way round than their outer rings
+ */
+/******************************************************************************/
+void scanline_rasteriser::add_polygons(const imulti_polygon& shape, double dx, double dy)
+{
+    for (imulti_polygon::const_iterator area = shape.begin(); area != shape.end(); ++area)
+    {
+        for (size_t r = 0; r <= area->inners().size(); r++)
+        {
+            const ipolygon::ring_type& source = r == 0 ? area->outer() :
+                                                area->inners()[r - 1];
+
+            ring.resize(source.size());
+            for (size_t i = 0; i < source.size(); i++)
+                ring[i] = icoordpair(source[i].first + dx, source[i].second + dy);
+
+            if (!ring.empty())
+                add_contour(&ring[0], ring.size());
+        }
+    }
+}
+
+/******************************************************************************/
+/*
+ */
+/******************************************************************************/
+void scanline_rasteriser::add_box(const ibox& area)
+{
+    const icoordpair corners[4] =
+    {
+        area.min_corner(), icoordpair(area.max_corner().first, area.min_corner().second),
+        area.max_corner(), icoordpair(area.min_corner().first, area.max_corner().second)
+    };
+
+    add_contour(corners, 4);
+}
+
+/******************************************************************************/
+/*
+ the round shapes all run counterclockwise, so that they add up with the
+ non-zero winding rule
+ */
+/******************************************************************************/
+void scanline_rasteriser::add_circle(double cx, double cy, double diameter)
+{
+    ring.clear();
+    shapes::append_arc(ring, cx, cy, diameter / 2, 0, 2 * M_PI, tolerance, true);
+    add_contour(&ring[0], ring.size());
+}
+
+/******************************************************************************/
+/*
+ */
+/******************************************************************************/
+void scanline_rasteriser::add_round_stroke(double x1, double y1, double x2, double y2,
+        double width)
+{
+    if (x1 == x2 && y1 == y2)
+    {
+        add_circle(x1, y1, width);
+        return;
+    }
+
+    const double angle = atan2(y2 - y1, x2 - x1);
+
+    ring.clear();
+    shapes::append_arc(ring, x2, y2, width / 2, angle - M_PI / 2, angle + M_PI / 2,
+                       tolerance, true);
+    shapes::append_arc(ring, x1, y1, width / 2, angle + M_PI / 2, angle + 3 * M_PI / 2,
+                       tolerance, true);
+    add_contour(&ring[0], ring.size());
+}
+
+/******************************************************************************/
+/*
+ the band of the arc, and a disc at each end; like shapes::arc_stroke(), the
+ band becomes a sector when the arc is narrower than the aperture
+ */
+/******************************************************************************/
+void scanline_rasteriser::add_arc_stroke(double cx, double cy, double radius,
+        double angle1, double angle2, double width)
+{
+    const double from = std::min(angle1, angle2);
+    const double to = std::max(angle1, angle2);
+
+    ring.clear();
+    shapes::append_arc(ring, cx, cy, radius + width / 2, from, to, tolerance, true);
+
+    if (radius > width / 2)
+        shapes::append_arc(ring, cx, cy, radius - width / 2, to, from, tolerance, true);
+    else
+        ring.push_back(icoordpair(cx, cy));
+
+    add_contour(&ring[0], ring.size());
+
+    add_circle(cx + radius * cos(angle1), cy + radius * sin(angle1), width);
+    add_circle(cx + radius * cos(angle2), cy + radius * sin(angle2), width);
+}
+
+/******************************************************************************/
+/*
+ the heights of the samples only grow during a fill, so the edges enter the
+ active ones in the order of their tops
+ */
+/******************************************************************************/
+template <typename Span>
+void scanline_rasteriser::scan(double y, fill_rule rule, Span& span)
+{
+    while (next_edge < edges.size() && edges[next_edge].y0 <= y)
+        active.push_back(&edges[next_edge++]);
+
+    size_t kept = 0;
+
+    crossings.clear();
+
+    for (size_t i = 0; i < active.size(); i++)
+    {
+        if (active[i]->y1 <= y)
+            continue;
+
+        active[kept++] = active[i];
+        crossings.push_back(std::make_pair(active[i]->x0 +
+                                           (y - active[i]->y0) * active[i]->slope,
+                                           active[i]->direction));
+    }
+
+    active.resize(kept);
+    std::sort(crossings.begin(), crossings.end());
+
+    int winding = 0;
+    double start = 0;
+
+    for (size_t i = 0; i < crossings.size(); i++)
+    {
+        const bool was_inside = rule == FILL_NONZERO ? winding != 0 : (winding & 1);
+
+        winding += crossings[i].second;
+
+        const bool inside = rule == FILL_NONZERO ? winding != 0 : (winding & 1);
+
+        if (inside && !was_inside)
+            start = crossings[i].first;
+        else if (!inside && was_inside)
+            span(start, crossings[i].first);
+    }
+}
+
+/******************************************************************************/
+/*
+ the paths outside the image are dropped without crossing any row
+ */
+/******************************************************************************/
+void scanline_rasteriser::fill(fill_rule rule, bool clear)
+{
+    if (!edges.empty() && max_x >= 0 && min_x <= width && max_y >= 0 && min_y <= height)
+    {
+        std::sort(edges.begin(), edges.end());
+        next_edge = 0;
+        active.clear();
+
+        if (antialias)
+            fill_coverage(rule, clear);
+        else
+            fill_binary(rule, clear);
+    }
+
+    edges.clear();
+    min_x = min_y = std::numeric_limits<double>::max();
+    max_x = max_y = -std::numeric_limits<double>::max();
+}
+
+/******************************************************************************/
+/*
+ the pixels are inside the path when their centre is
+ */
+/******************************************************************************/
+void scanline_rasteriser::fill_binary(fill_rule rule, bool clear)
+{
+    const int first_row = std::max(int(floor(min_y - 0.5)), 0);
+    const int last_row = std::min(int(ceil(max_y)), height - 1);
+    bit_span span;
+
+    span.width = width;
+    span.clear = clear;
+
+    for (int y = first_row; y <= last_row; y++)
+    {
+        span.row = reinterpret_cast<uint32_t*>(data + y * stride);
+        scan(y + 0.5, rule, span);
+    }
+}
+
+/******************************************************************************/
+/*
+ the coverage of the rows is composited like cairo's OVER (set) and CLEAR
+ operators do with an opaque source
+ */
+/******************************************************************************/
+void scanline_rasteriser::fill_coverage(fill_rule rule, bool clear)
+{
+    const int first_row = std::max(int(floor(min_y)), 0);
+    const int last_row = std::min(int(ceil(max_y)), height - 1);
+    coverage_span span;
+
+    span.accumulated = &accumulated[0];
+    span.width = width;
+
+    for (int y = first_row; y <= last_row; y++)
+    {
+        span.first_touched = width;
+        span.last_touched = -1;
+
+        for (int s = 0; s < subrows; s++)
+            scan(y + (s + 0.5) / subrows, rule, span);
+
+        unsigned char* target = data + y * stride;
+
+        for (int x = span.first_touched; x <= span.last_touched; x++)
+        {
+            const int covered = std::min(accumulated[x], 255);
+
+            accumulated[x] = 0;
+
+            if (clear)
+                target[x] = (target[x] * (255 - covered) + 127) / 255;
+            else
+                target[x] += ((255 - target[x]) * covered + 127) / 255;
+        }
+    }
+}
@@ -0,0 +1,116 @@
+/*
+ * This file is part of pcb2gcode.
+ *
+ * Copyright (C) 2016 the pcb2gcode developers
+ *
+ * pcb2gcode is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * pcb2gcode is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with pcb2gcode.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SCANLINE_RASTERISER_HPP
+#define SCANLINE_RASTERISER_HPP
+
+#include <stddef.h>
+
+#include <utility>
+#include <vector>
+using std::vector;
+
+#include <boost/noncopyable.hpp>
+
+#include "coord.hpp"
+#include "shapes.hpp"
+
+/******************************************************************************/
+/*
+ Scanline polygon filler for the gerber primitives, writing straight into
+ the memory of a FORMAT_A1 (binary) or FORMAT_A8 (anti-aliased) image.
+
+ The path is a set of closed contours, added one primitive at a time and
+ filled with the non-zero winding or the even-odd rule, setting or clearing
+ its pixels. Each row is crossed by the edges of the path at the centres of
+ its pixels (binary) or at 16 sub-rows, whose spans are accumulated into the
+ coverage of the row (anti-aliased); the spans are filled a word at a time.
+ The curves are flattened within 1/8 of a pixel.
+ */
+/******************************************************************************/
+class scanline_rasteriser: boost::noncopyable
+{
+public:
+    enum fill_rule { FILL_NONZERO, FILL_EVEN_ODD };
+
+    // the image is width x height pixels, with rows of stride bytes;
+    // to_device maps the coordinates of the path to its pixels, downwards
+    scanline_rasteriser(unsigned char* data, int width, int height, int stride,
+                        bool antialias, const shapes::affine& to_device);
+
+    // a contour, closed or not
+    void add_contour(const icoordpair* points, size_t count);
+    // the polygons translated by dx, dy
+    void add_polygons(const imulti_polygon& shape, double dx, double dy);
+    void add_box(const ibox& area);
+    void add_circle(double cx, double cy, double diameter);
+    // a segment with round ends
+    void add_round_stroke(double x1, double y1, double x2, double y2, double width);
+    // an arc with round ends, from angle1 to angle2 (in radians)
+    void add_arc_stroke(double cx, double cy, double radius, double angle1,
+                        double angle2, double width);
+
+    // fills the path, then starts a new one
+    void fill(fill_rule rule, bool clear);
+
+private:
+    // in device coordinates, from the top (y0) to the bottom (y1); direction
+    // is the one of the contour, +1 downwards
+    struct edge
+    {
+        double y0, y1;
+        double x0;
+        double slope;
+        int direction;
+
+        bool operator<(const edge& other) const
+        {
+            return y0 < other.y0;
+        }
+    };
+
+    // samples the path at the height y, and calls span(first, last) for
+    // each span inside it
+    template <typename Span>
+    void scan(double y, fill_rule rule, Span& span);
+    void add_edge(const icoordpair& from, const icoordpair& to);
+    void fill_binary(fill_rule rule, bool clear);
+    void fill_coverage(fill_rule rule, bool clear);
+
+    unsigned char* const data;
+    const int width;
+    const int height;
+    const int stride;
+    const bool antialias;
+    const shapes::affine to_device;
+    // of the curves, in the coordinates of the path
+    double tolerance;
+
+    vector<edge> edges;
+    double min_x, min_y, max_x, max_y;
+
+    // scratch buffers of fill()
+    vector<const edge*> active;
+    vector<std::pair<double, int> > crossings;
+    vector<int> accumulated;
+    ipolygon::ring_type ring;
+    size_t next_edge;
+};
+
+#endif // SCANLINE_RASTERISER_HPP
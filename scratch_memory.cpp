@@ -0,0 +1,142 @@
+/*
+ * This file is part of pcb2gcode.
+ *
+ * Copyright (C) 2016 the pcb2gcode developers
+ *
+ * pcb2gcode is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * pcb2gcode is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with pcb2gcode.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "scratch_memory.hpp"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include <set>
+#include <vector>
+
+#include <boost/thread/mutex.hpp>
+
+namespace
+{
+
+boost::mutex mapped_mutex;
+// the mapped blocks, the others are on the heap
+std::set<void*> mapped_blocks;
+
+}
+
+/******************************************************************************/
+/*
+ */
+/******************************************************************************/
+string& scratch_memory::get_directory()
+{
+    static string directory;
+    return directory;
+}
+
+/******************************************************************************/
+/*
+ */
+/******************************************************************************/
+void scratch_memory::set_directory(const string& directory)
+{
+    get_directory() = directory;
+}
+
+/******************************************************************************/
+/*
+ the file is sized without writing it, so it's all holes until the pages are
+ written, and it's unlinked right away so that nothing is left behind, even
+ if the process is killed
+ */
+/******************************************************************************/
+void* scratch_memory::allocate(size_t bytes)
+{
+    if (!is_mapped() || bytes < min_mapped_bytes)
+    {
+        void* block = calloc(bytes ? bytes : 1, 1);
+
+        if (!block)
+            throw std::bad_alloc();
+
+        return block;
+    }
+
+    const string pattern = get_directory() + "/pcb2gcode-scratch-XXXXXX";
+    std::vector<char> path(pattern.begin(), pattern.end());
+    path.push_back('\0');
+
+    const int fd = mkstemp(&path[0]);
+
+    if (fd < 0)
+        throw std::bad_alloc();
+
+    unlink(&path[0]);
+
+    void* block = MAP_FAILED;
+
+    if (ftruncate(fd, bytes) == 0)
+        block = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+    close(fd);
+
+    if (block == MAP_FAILED)
+        throw std::bad_alloc();
+
+    boost::mutex::scoped_lock lock(mapped_mutex);
+    mapped_blocks.insert(block);
+
+    return block;
+}
+
+/******************************************************************************/
+/*
+ */
+/******************************************************************************/
+void scratch_memory::release(void* block, size_t bytes)
+{
+    {
+        boost::mutex::scoped_lock lock(mapped_mutex);
+
+        if (mapped_blocks.erase(block))
+        {
+            munmap(block, bytes);
+            return;
+        }
+    }
+
+    free(block);
+}
+
+/******************************************************************************/
+/*
+ only the whole pages inside the range are advised
+ */
+/******************************************************************************/
+void scratch_memory::advise(const void* begin, size_t bytes, access_pattern pattern)
+{
+    if (!is_mapped() || bytes < min_mapped_bytes)
+        return;
+
+    static const int advice[] = { MADV_NORMAL, MADV_SEQUENTIAL, MADV_RANDOM };
+    const uintptr_t page = sysconf(_SC_PAGESIZE);
+    const uintptr_t first = (reinterpret_cast<uintptr_t>(begin) + page - 1) & ~(page - 1);
+    const uintptr_t last = (reinterpret_cast<uintptr_t>(begin) + bytes) & ~(page - 1);
+
+    if (first < last)
+        madvise(reinterpret_cast<void*>(first), last - first, advice[pattern]);
+}
@@ -0,0 +1,148 @@
+/*
+ * This file is part of pcb2gcode.
+ *
+ * Copyright (C) 2016 the pcb2gcode developers
+ *
+ * pcb2gcode is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * pcb2gcode is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with pcb2gcode.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SCRATCH_MEMORY_HPP
+#define SCRATCH_MEMORY_HPP
+
+#include <stddef.h>
+
+#include <limits>
+#include <new>
+#include <string>
+using std::string;
+
+/******************************************************************************/
+/*
+ Storage of the large image buffers.
+
+ By default the buffers are allocated on the heap. Once a scratch directory
+ is set, each large buffer is a shared mapping of its own temporary file in
+ that directory, deleted as soon as it's created: the pages that don't fit in
+ memory are written back to the file instead of the swap, and the pages that
+ are never touched take no room, as the file is sparse. The vectors using a
+ scratch_allocator write their whole block when they are filled, so only the
+ blocks used straight from allocate() (the bit planes, the label tiles) keep
+ such holes.
+ */
+/******************************************************************************/
+class scratch_memory
+{
+public:
+    enum access_pattern
+    {
+        access_normal, access_sequential, access_random
+    };
+
+    // must be called before any buffer is allocated; an empty directory
+    // keeps the buffers on the heap
+    static void set_directory(const string& directory);
+    static bool is_mapped()
+    {
+        return !get_directory().empty();
+    }
+
+    // zero-filled block; throws std::bad_alloc
+    static void* allocate(size_t bytes);
+    static void release(void* block, size_t bytes);
+
+    // hint on how the pages of [begin, begin + bytes) are going to be
+    // accessed; the heap blocks ignore it
+    static void advise(const void* begin, size_t bytes, access_pattern pattern);
+
+    // smaller blocks always stay on the heap
+    static const size_t min_mapped_bytes = 1 << 20;
+
+private:
+    static string& get_directory();
+};
+
+/******************************************************************************/
+/*
+ Allocator of the vectors holding whole images.
+ */
+/******************************************************************************/
+template <typename T> class scratch_allocator
+{
+public:
+    typedef T value_type;
+    typedef T* pointer;
+    typedef const T* const_pointer;
+    typedef T& reference;
+    typedef const T& const_reference;
+    typedef size_t size_type;
+    typedef ptrdiff_t difference_type;
+
+    template <typename U> struct rebind
+    {
+        typedef scratch_allocator<U> other;
+    };
+
+    scratch_allocator()
+    {
+    }
+    template <typename U> scratch_allocator(const scratch_allocator<U>&)
+    {
+    }
+
+    pointer allocate(size_type n, const void* = 0)
+    {
+        if (n > max_size())
+            throw std::bad_alloc();
+
+        return static_cast<pointer>(scratch_memory::allocate(n * sizeof(T)));
+    }
+    void deallocate(pointer p, size_type n)
+    {
+        scratch_memory::release(p, n * sizeof(T));
+    }
+
+    size_type max_size() const
+    {
+        return std::numeric_limits<size_type>::max() / sizeof(T);
+    }
+
+    void construct(pointer p, const T& value)
+    {
+        new (p) T(value);
+    }
+    void destroy(pointer p)
+    {
+        p->~T();
+    }
+
+    pointer address(reference x) const
+    {
+        return &x;
+    }
+    const_pointer address(const_reference x) const
+    {
+        return &x;
+    }
+
+    bool operator==(const scratch_allocator&) const
+    {
+        return true;
+    }
+    bool operator!=(const scratch_allocator&) const
+    {
+        return false;
+    }
+};
+
+#endif // SCRATCH_MEMORY_HPP
@@ -0,0 +1,516 @@
+/*
+ * This file is part of pcb2gcode.
+ *
+ * Copyright (C) 2016 the pcb2gcode developers
+ *
+ * pcb2gcode is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * pcb2gcode is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with pcb2gcode.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+
+#include "shapes.hpp"
+#include "vector_isolation.hpp"
+
+namespace shapes
+{
+
+namespace bg = boost::geometry;
+
+/******************************************************************************/
+/*
+ */
+/******************************************************************************/
+imulti_polygon single(const ipolygon& area)
+{
+    imulti_polygon result;
+
+    result.push_back(area);
+
+    return result;
+}
+
+/******************************************************************************/
+/*
+ a mirroring reverses the rings, hence the correction
+ */
+/******************************************************************************/
+void transform(const affine& t, imulti_polygon& shape)
+{
+    bg::for_each_point(shape, t);
+    bg::correct(shape);
+}
+
+/******************************************************************************/
+/*
+ appends the arc from angle1 to angle2 (in radians, counterclockwise if
+ angle2 > angle1), without its first point unless first is set
+ */
+/******************************************************************************/
+void append_arc(ipolygon::ring_type& ring, double cx, double cy, double radius,
+                double angle1, double angle2, double tolerance, bool first)
+{
+    const int sides = vector_isolation::get_circle_sides(radius, tolerance);
+    const int steps = std::max(1, int(ceil(fabs(angle2 - angle1) / (2 * M_PI) * sides)));
+
+    for (int i = first ? 0 : 1; i <= steps; i++)
+    {
+        const double angle = angle1 + (angle2 - angle1) * i / steps;
+
+        ring.push_back(icoordpair(cx + radius * cos(angle), cy + radius * sin(angle)));
+    }
+}
+
+/******************************************************************************/
+/*
+ */
+/******************************************************************************/
+void append_circle(ipolygon::ring_type& ring, double cx, double cy, double diameter,
+                   double tolerance)
+{
+    append_arc(ring, cx, cy, diameter / 2, 0, 2 * M_PI, tolerance, true);
+    ring.back() = ring.front();
+}
+
+/******************************************************************************/
+/*
+ */
+/******************************************************************************/
+ipolygon circle(double cx, double cy, double diameter, double tolerance)
+{
+    ipolygon result;
+
+    append_circle(result.outer(), cx, cy, diameter, tolerance);
+    bg::correct(result);
+
+    return result;
+}
+
+/******************************************************************************/
+/*
+ the area between two concentric circles
+ */
+/******************************************************************************/
+ipolygon annulus(double cx, double cy, double outer_diameter, double inner_diameter,
+                 double tolerance)
+{
+    ipolygon result = circle(cx, cy, outer_diameter, tolerance);
+
+    if (inner_diameter > 0)
+    {
+        result.inners().resize(1);
+        append_circle(result.inners().front(), cx, cy, inner_diameter, tolerance);
+        bg::correct(result);
+    }
+
+    return result;
+}
+
+/******************************************************************************/
+/*
+ */
+/******************************************************************************/
+ipolygon rectangle(double cx, double cy, double width, double height)
+{
+    ipolygon result;
+
+    result.outer().push_back(icoordpair(cx - width / 2, cy - height / 2));
+    result.outer().push_back(icoordpair(cx - width / 2, cy + height / 2));
+    result.outer().push_back(icoordpair(cx + width / 2, cy + height / 2));
+    result.outer().push_back(icoordpair(cx + width / 2, cy - height / 2));
+    result.outer().push_back(result.outer().front());
+    bg::correct(result);
+
+    return result;
+}
+
+/******************************************************************************/
+/*
+ a rectangle with two half circles on its shorter sides
+ */
+/******************************************************************************/
+ipolygon oval(double cx, double cy, double width, double height, double tolerance)
+{
+    ipolygon result;
+    ipolygon::ring_type& ring = result.outer();
+
+    if (width > height)
+    {
+        const double d = (width - height) / 2;
+
+        append_arc(ring, cx + d, cy, height / 2, -M_PI / 2, M_PI / 2, tolerance, true);
+        append_arc(ring, cx - d, cy, height / 2, M_PI / 2, 3 * M_PI / 2, tolerance, true);
+    }
+    else
+    {
+        const double d = (height - width) / 2;
+
+        append_arc(ring, cx, cy + d, width / 2, 0, M_PI, tolerance, true);
+        append_arc(ring, cx, cy - d, width / 2, M_PI, 2 * M_PI, tolerance, true);
+    }
+
+    ring.push_back(ring.front());
+    bg::correct(result);
+
+    return result;
+}
+
+/******************************************************************************/
+/*
+ the first vertex is at rotation degrees from the x axis
+ */
+/******************************************************************************/
+ipolygon regular_polygon(double cx, double cy, double diameter, int sides,
+                         double rotation)
+{
+    ipolygon result;
+
+    for (int i = 0; i < sides; i++)
+    {
+        const double angle = rotation * M_PI / 180 + 2 * M_PI * i / sides;
+
+        result.outer().push_back(icoordpair(cx + diameter / 2 * cos(angle),
+                                            cy + diameter / 2 * sin(angle)));
+    }
+
+    if (!result.outer().empty())
+        result.outer().push_back(result.outer().front());
+    bg::correct(result);
+
+    return result;
+}
+
+/******************************************************************************/
+/*
+ the segment drawn by a circular aperture, with round ends
+ */
+/******************************************************************************/
+ipolygon round_stroke(double x1, double y1, double x2, double y2, double width,
+                      double tolerance)
+{
+    if (x1 == x2 && y1 == y2)
+        return circle(x1, y1, width, tolerance);
+
+    ipolygon result;
+    const double angle = atan2(y2 - y1, x2 - x1);
+
+    append_arc(result.outer(), x2, y2, width / 2, angle - M_PI / 2, angle + M_PI / 2,
+               tolerance, true);
+    append_arc(result.outer(), x1, y1, width / 2, angle + M_PI / 2,
+               angle + 3 * M_PI / 2, tolerance, true);
+    result.outer().push_back(result.outer().front());
+    bg::correct(result);
+
+    return result;
+}
+
+/******************************************************************************/
+/*
+ the segment drawn by a rectangular aperture: the convex hull of the
+ rectangles at its ends
+ */
+/******************************************************************************/
+ipolygon rectangle_stroke(double x1, double y1, double x2, double y2, double width,
+                          double height)
+{
+    bg::model::multi_point<icoordpair> corners;
+
+    for (int i = 0; i < 4; i++)
+    {
+        const double dx = (i & 1) ? width / 2 : -width / 2;
+        const double dy = (i & 2) ? height / 2 : -height / 2;
+
+        corners.push_back(icoordpair(x1 + dx, y1 + dy));
+        corners.push_back(icoordpair(x2 + dx, y2 + dy));
+    }
+
+    ipolygon result;
+    bg::convex_hull(corners, result);
+
+    return result;
+}
+
+/******************************************************************************/
+/*
+ the segment of a vector line macro primitive, with square ends
+ */
+/******************************************************************************/
+ipolygon butt_stroke(double x1, double y1, double x2, double y2, double width)
+{
+    ipolygon result;
+    const double length = hypot(x2 - x1, y2 - y1);
+
+    if (length == 0)
+        return result;
+
+    const double nx = -(y2 - y1) / length * width / 2;
+    const double ny = (x2 - x1) / length * width / 2;
+
+    result.outer().push_back(icoordpair(x1 + nx, y1 + ny));
+    result.outer().push_back(icoordpair(x2 + nx, y2 + ny));
+    result.outer().push_back(icoordpair(x2 - nx, y2 - ny));
+    result.outer().push_back(icoordpair(x1 - nx, y1 - ny));
+    result.outer().push_back(result.outer().front());
+    bg::correct(result);
+
+    return result;
+}
+
+/******************************************************************************/
+/*
+ */
+/******************************************************************************/
+void arc_stroke(double cx, double cy, double radius, double angle1, double angle2,
+                double width, double tolerance, imulti_polygon& result)
+{
+    result.clear();
+
+    if (fabs(angle2 - angle1) >= 2 * M_PI - 1e-9)
+    {
+        result.push_back(annulus(cx, cy, 2 * radius + width, 2 * radius - width,
+                                 tolerance));
+        return;
+    }
+
+    vector<imulti_polygon> parts(3);
+    ipolygon band;
+
+    append_arc(band.outer(), cx, cy, radius + width / 2, angle1, angle2, tolerance,
+               true);
+
+    if (radius > width / 2)
+        append_arc(band.outer(), cx, cy, radius - width / 2, angle2, angle1,
+                   tolerance, true);
+    else
+        band.outer().push_back(icoordpair(cx, cy));
+
+    band.outer().push_back(band.outer().front());
+    bg::correct(band);
+
+    parts[0].push_back(band);
+    parts[1].push_back(circle(cx + radius * cos(angle1), cy + radius * sin(angle1),
+                              width, tolerance));
+    parts[2].push_back(circle(cx + radius * cos(angle2), cy + radius * sin(angle2),
+                              width, tolerance));
+
+    vector_isolation::unite(parts, result);
+}
+
+/******************************************************************************/
+/*
+ */
+/******************************************************************************/
+void expose(const imulti_polygon& shape, bool on, imulti_polygon& result)
+{
+    imulti_polygon merged;
+
+    if (on)
+        bg::union_(result, shape, merged);
+    else
+        bg::difference(result, shape, merged);
+
+    result.swap(merged);
+}
+
+/******************************************************************************/
+/*
+ the hole of a standard aperture follows its own parameters: it's round, or
+ rectangular if it has a height
+ */
+/******************************************************************************/
+void standard_flash(aperture_type type, const double* p, int count, double tolerance,
+                    imulti_polygon& result)
+{
+    int hole;   // index of the parameters of the hole
+
+    result.clear();
+
+    switch (type)
+    {
+    case APERTURE_CIRCLE:
+        result.push_back(circle(0, 0, p[0], tolerance));
+        hole = 1;
+        break;
+
+    case APERTURE_RECTANGLE:
+        result.push_back(rectangle(0, 0, p[0], p[1]));
+        hole = 2;
+        break;
+
+    case APERTURE_OVAL:
+        result.push_back(oval(0, 0, p[0], p[1], tolerance));
+        hole = 2;
+        break;
+
+    case APERTURE_POLYGON:
+        result.push_back(regular_polygon(0, 0, p[0], int(p[1]), count > 2 ? p[2] : 0));
+        hole = 3;
+        break;
+
+    default:
+        return;
+    }
+
+    if (count > hole && p[hole] > 0)
+    {
+        const bool rectangular = count > hole + 1 && p[hole + 1] > 0;
+
+        expose(single(rectangular ? rectangle(0, 0, p[hole], p[hole + 1]) :
+                      circle(0, 0, p[hole], tolerance)), false, result);
+    }
+}
+
+/******************************************************************************/
+/*
+ the codes and the parameters are the ones of the RS-274X specification: 1
+ circle, 2 and 20 vector line, 21 center line, 22 lower left line, 4 outline,
+ 5 polygon, 6 moire and 7 thermal, the last parameter being the rotation
+ around the origin of the aperture. The moires and the thermals have no
+ exposure parameter, and are always on.
+ */
+/******************************************************************************/
+bool macro_primitive(int code, const double* p, double tolerance,
+                     imulti_polygon& shape, bool& on)
+{
+    double rotation = 0;
+
+    shape.clear();
+    on = true;
+
+    switch (code)
+    {
+    case 1:
+        shape.push_back(circle(p[2], p[3], p[1], tolerance));
+        on = p[0] != 0;
+        rotation = p[4];
+        break;
+
+    case 4:
+    {
+        const int points = int(p[1]) + 1;
+
+        shape.resize(1);
+        for (int i = 0; i < points; i++)
+            shape.front().outer().push_back(icoordpair(p[2 + 2 * i], p[3 + 2 * i]));
+        shape.front().outer().push_back(shape.front().outer().front());
+        bg::correct(shape);
+        on = p[0] != 0;
+        rotation = p[2 + 2 * points];
+        break;
+    }
+
+    case 5:
+        shape.push_back(regular_polygon(p[2], p[3], p[4], int(p[1]), 0));
+        on = p[0] != 0;
+        rotation = p[5];
+        break;
+
+    case 6:
+    {
+        vector<imulti_polygon> parts;
+
+        for (int i = 0; i < int(p[5]); i++)
+        {
+            const double outer = p[2] - 2 * i * (p[3] + p[4]);
+
+            if (outer <= 0)
+                break;
+
+            parts.push_back(single(annulus(p[0], p[1], outer, outer - 2 * p[3],
+                                           tolerance)));
+        }
+
+        parts.push_back(single(rectangle(p[0], p[1], p[7], p[6])));
+        parts.push_back(single(rectangle(p[0], p[1], p[6], p[7])));
+        vector_isolation::unite(parts, shape);
+        rotation = p[8];
+        break;
+    }
+
+    case 7:
+    {
+        imulti_polygon cross;
+
+        shape.push_back(annulus(p[0], p[1], p[2], p[3], tolerance));
+        cross.push_back(rectangle(p[0], p[1], p[2], p[4]));
+        expose(single(rectangle(p[0], p[1], p[4], p[2])), true, cross);
+        expose(cross, false, shape);
+        rotation = p[5];
+        break;
+    }
+
+    case 2:
+    case 20:
+        shape.push_back(butt_stroke(p[2], p[3], p[4], p[5], p[1]));
+        on = p[0] != 0;
+        rotation = p[6];
+        break;
+
+    case 21:
+        shape.push_back(rectangle(p[3], p[4], p[1], p[2]));
+        on = p[0] != 0;
+        rotation = p[5];
+        break;
+
+    case 22:
+        shape.push_back(rectangle(p[3] + p[1] / 2, p[4] + p[2] / 2, p[1], p[2]));
+        on = p[0] != 0;
+        rotation = p[5];
+        break;
+
+    default:
+        return false;
+    }
+
+    if (rotation != 0)
+        transform(affine::rotation(rotation * M_PI / 180), shape);
+
+    return true;
+}
+
+/******************************************************************************/
+/*
+ the contours of a region are filled with the even-odd rule, like gerbv does
+ */
+/******************************************************************************/
+void add_contour(ipolygon& contour, imulti_polygon& result)
+{
+    if (contour.outer().size() >= 3)
+    {
+        imulti_polygon merged;
+
+        contour.outer().push_back(contour.outer().front());
+        bg::correct(contour);
+        bg::sym_difference(result, contour, merged);
+        result.swap(merged);
+    }
+
+    contour.clear();
+}
+
+/******************************************************************************/
+/*
+ */
+/******************************************************************************/
+void merge_batch(vector<imulti_polygon>& batch, bool clear, imulti_polygon& copper)
+{
+    if (batch.empty())
+        return;
+
+    imulti_polygon shapes;
+
+    vector_isolation::unite(batch, shapes);
+    expose(shapes, !clear, copper);
+}
+
+}
@@ -0,0 +1,141 @@
+/*
+ * This file is part of pcb2gcode.
+ *
+ * Copyright (C) 2016 the pcb2gcode developers
+ *
+ * pcb2gcode is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * pcb2gcode is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with pcb2gcode.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SHAPES_HPP
+#define SHAPES_HPP
+
+#include <cmath>
+
+#include <vector>
+using std::vector;
+
+#include "coord.hpp"
+
+/******************************************************************************/
+/*
+ Polygons of the shapes drawn by the gerber files, in inches, shared by the
+ importers. The curves are approximated within tolerance, and every polygon
+ is corrected (clockwise outer rings, closed).
+ */
+/******************************************************************************/
+namespace shapes
+{
+
+/******************************************************************************/
+/*
+ affine transformation of the points: x' = xx * x + xy * y + x0 and
+ y' = yx * x + yy * y + y0
+ */
+/******************************************************************************/
+struct affine
+{
+    double xx, xy, x0;
+    double yx, yy, y0;
+
+    static affine translation(double dx, double dy)
+    {
+        const affine t = { 1, 0, dx, 0, 1, dy };
+        return t;
+    }
+    static affine scaling(double sx, double sy)
+    {
+        const affine t = { sx, 0, 0, 0, sy, 0 };
+        return t;
+    }
+    // counterclockwise, in radians
+    static affine rotation(double angle)
+    {
+        const affine t = { cos(angle), -sin(angle), 0, sin(angle), cos(angle), 0 };
+        return t;
+    }
+
+    // this transformation followed by next
+    affine then(const affine& next) const
+    {
+        const affine t = { next.xx * xx + next.xy * yx, next.xx * xy + next.xy * yy,
+                           next.xx * x0 + next.xy * y0 + next.x0,
+                           next.yx * xx + next.yy * yx, next.yx * xy + next.yy * yy,
+                           next.yx * x0 + next.yy * y0 + next.y0
+                         };
+        return t;
+    }
+
+    void operator()(icoordpair& point) const
+    {
+        const double x = point.first;
+
+        point.first = xx * x + xy * point.second + x0;
+        point.second = yx * x + yy * point.second + y0;
+    }
+};
+
+// the standard apertures
+enum aperture_type { APERTURE_CIRCLE, APERTURE_RECTANGLE, APERTURE_OVAL,
+                     APERTURE_POLYGON };
+
+imulti_polygon single(const ipolygon& area);
+void transform(const affine& t, imulti_polygon& shape);
+
+// appends the arc from angle1 to angle2 (in radians, counterclockwise if
+// angle2 > angle1), without its first point unless first is set
+void append_arc(ipolygon::ring_type& ring, double cx, double cy, double radius,
+                double angle1, double angle2, double tolerance, bool first);
+void append_circle(ipolygon::ring_type& ring, double cx, double cy, double diameter,
+                   double tolerance);
+
+ipolygon circle(double cx, double cy, double diameter, double tolerance);
+ipolygon annulus(double cx, double cy, double outer_diameter, double inner_diameter,
+                 double tolerance);
+ipolygon rectangle(double cx, double cy, double width, double height);
+ipolygon oval(double cx, double cy, double width, double height, double tolerance);
+ipolygon regular_polygon(double cx, double cy, double diameter, int sides,
+                         double rotation);
+
+ipolygon round_stroke(double x1, double y1, double x2, double y2, double width,
+                      double tolerance);
+ipolygon rectangle_stroke(double x1, double y1, double x2, double y2, double width,
+                          double height);
+ipolygon butt_stroke(double x1, double y1, double x2, double y2, double width);
+// the arc of the given radius from angle1 to angle2 (in radians) drawn by a
+// circular aperture, with round ends
+void arc_stroke(double cx, double cy, double radius, double angle1, double angle2,
+                double width, double tolerance, imulti_polygon& result);
+
+// the flash of a standard aperture centred on the origin, with the
+// parameters of its AD command (in inches), hole included
+void standard_flash(aperture_type type, const double* parameters, int count,
+                    double tolerance, imulti_polygon& result);
+// a primitive of an aperture macro, with the code and the evaluated
+// parameters (in inches) of its AM command, rotation applied; on is its
+// exposure. Returns false if the code is unknown.
+bool macro_primitive(int code, const double* parameters, double tolerance,
+                     imulti_polygon& shape, bool& on);
+
+// adds (exposure on) or removes a shape from result
+void expose(const imulti_polygon& shape, bool on, imulti_polygon& result);
+// closes a contour of a region and adds it to result with the even-odd rule,
+// then clears it
+void add_contour(ipolygon& contour, imulti_polygon& result);
+// adds the shapes of a run of primitives with the same polarity to the
+// copper, or removes them from it
+void merge_batch(vector<imulti_polygon>& batch, bool clear, imulti_polygon& copper);
+
+}
+
+#endif // SHAPES_HPP
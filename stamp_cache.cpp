@@ -0,0 +1,266 @@
+/*
+ * This file is part of pcb2gcode.
+ *
+ * Copyright (C) 2016 the pcb2gcode developers
+ *
+ * pcb2gcode is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * pcb2gcode is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with pcb2gcode.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "stamp_cache.hpp"
+#include "raster.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+
+/******************************************************************************/
+/*
+ sets or clears the pixels [first, last] of a row of a FORMAT_A1 surface
+ */
+/******************************************************************************/
+void fill_bits(uint32_t* row, int first, int last, bool clear)
+{
+    for (int x = first; x <= last;)
+    {
+        const int word_last = std::min(last, x | 31);
+        uint32_t mask = 0;
+
+        if ((x & 31) == 0 && word_last == x + 31)
+            mask = 0xFFFFFFFF;
+        else
+            for (int b = x; b <= word_last; b++)
+                mask |= bitplane::bit(b);
+
+        if (clear)
+            row[x / 32] &= ~mask;
+        else
+            row[x / 32] |= mask;
+
+        x = word_last + 1;
+    }
+}
+
+}
+
+/******************************************************************************/
+/*
+ the stamps that would be too large are cached as NULL too
+ */
+/******************************************************************************/
+shared_ptr<const stamp_cache::stamp> stamp_cache::get(int aperture,
+        const imulti_polygon& shape, double diameter, unsigned int dpi, double x,
+        double y, bool antialias, int& pixel_x, int& pixel_y)
+{
+    pixel_x = int(floor(x));
+    pixel_y = int(floor(y));
+
+    const int phase_x = std::min(int((x - pixel_x) * phases), phases - 1);
+    const int phase_y = std::min(int((y - pixel_y) * phases), phases - 1);
+    const uint64_t key = (uint64_t(unsigned(aperture)) << 32) |
+                         (uint64_t(dpi & 0xFFFFFF) << 7) | (phase_x << 4) |
+                         (phase_y << 1) | (antialias ? 1 : 0);
+
+    {
+        boost::mutex::scoped_lock lock(stamps_mutex);
+        map<uint64_t, shared_ptr<const stamp> >::const_iterator cached = stamps.find(key);
+
+        if (cached != stamps.end())
+            return cached->second;
+    }
+
+    // two renderers can make the same stamp at once, the first one is kept
+    shared_ptr<const stamp> made = make_stamp(shape, diameter, dpi,
+                                              (phase_x + 0.5) / phases,
+                                              (phase_y + 0.5) / phases, antialias);
+
+    boost::mutex::scoped_lock lock(stamps_mutex);
+
+    return stamps.insert(std::make_pair(key, made)).first->second;
+}
+
+/******************************************************************************/
+/*
+ the stamp is rendered like the flash would be, with the centre at phase_x,
+ phase_y in its pixel, and a pixel of margin
+ */
+/******************************************************************************/
+shared_ptr<const stamp_cache::stamp> stamp_cache::make_stamp(const imulti_polygon& shape,
+        double diameter, unsigned int dpi, double phase_x, double phase_y,
+        bool antialias)
+{
+    shared_ptr<stamp> made(new stamp());
+    ibox envelope;
+
+    if (diameter > 0)
+        envelope = ibox(icoordpair(-diameter / 2, -diameter / 2),
+                        icoordpair(diameter / 2, diameter / 2));
+    else if (!shape.empty())
+        boost::geometry::envelope(shape, envelope);
+    else
+        return made;
+
+    // device coordinates, downwards
+    const int left = int(floor(phase_x + envelope.min_corner().first * dpi)) - 1;
+    const int right = int(ceil(phase_x + envelope.max_corner().first * dpi)) + 1;
+    const int top = int(floor(phase_y - envelope.max_corner().second * dpi)) - 1;
+    const int bottom = int(ceil(phase_y - envelope.min_corner().second * dpi)) + 1;
+
+    if (right - left > max_side || bottom - top > max_side)
+        return shared_ptr<const stamp>();
+
+    made->left = left;
+    made->top = top;
+    made->width = right - left;
+    made->height = bottom - top;
+
+    Cairo::RefPtr<Cairo::ImageSurface> surface =
+        Cairo::ImageSurface::create(antialias ? Cairo::FORMAT_A8 : Cairo::FORMAT_A1,
+                                    made->width, made->height);
+    Cairo::RefPtr<Cairo::Context> cr = Cairo::Context::create(surface);
+
+    cr->translate(phase_x - left, phase_y - top);
+    cr->scale(dpi, -double(dpi));
+    cr->set_antialias(antialias ? Cairo::ANTIALIAS_DEFAULT : Cairo::ANTIALIAS_NONE);
+    cr->set_source_rgba(1, 1, 1, 1);
+    draw(cr, shape, diameter);
+    cr->fill();
+    surface->flush();
+
+    const unsigned char* data = surface->get_data();
+    const int stride = surface->get_stride();
+
+    if (antialias)
+    {
+        made->coverage.resize(made->width * made->height);
+
+        for (int y = 0; y < made->height; y++)
+            std::copy(data + y * stride, data + y * stride + made->width,
+                      made->coverage.begin() + y * made->width);
+    }
+    else
+    {
+        for (int y = 0; y < made->height; y++)
+        {
+            const uint32_t* row = reinterpret_cast<const uint32_t*>(data + y * stride);
+
+            for (int x = 0; x < made->width; x++)
+            {
+                if (!(row[x / 32] & bitplane::bit(x)))
+                    continue;
+
+                int last = x;
+                while (last + 1 < made->width &&
+                        (row[(last + 1) / 32] & bitplane::bit(last + 1)))
+                    last++;
+
+                made->runs.append(y, x, last);
+                x = last;
+            }
+        }
+    }
+
+    return made;
+}
+
+/******************************************************************************/
+/*
+ the anti-aliased stamps are composited like cairo's OVER (set) and CLEAR
+ operators do with an opaque source
+ */
+/******************************************************************************/
+void stamp_cache::blit(const stamp& flash, int x, int y, bool clear,
+                       Cairo::RefPtr<Cairo::ImageSurface> surface)
+{
+    const int width = surface->get_width();
+    const int height = surface->get_height();
+    const int stride = surface->get_stride();
+    unsigned char* data = surface->get_data();
+
+    x += flash.left;
+    y += flash.top;
+
+    if (surface->get_format() == Cairo::FORMAT_A1)
+    {
+        for (vector<pixel_run>::const_iterator run = flash.runs.get_runs().begin();
+                run != flash.runs.get_runs().end(); ++run)
+        {
+            const int row = y + run->y;
+            const int first = std::max(x + run->first, 0);
+            const int last = std::min(x + run->last, width - 1);
+
+            if (row >= 0 && row < height && first <= last)
+                fill_bits(reinterpret_cast<uint32_t*>(data + row * stride), first, last,
+                          clear);
+        }
+
+        return;
+    }
+
+    const int first_x = std::max(-x, 0);
+    const int last_x = std::min(width - x, flash.width);
+
+    for (int row = std::max(-y, 0); row < std::min(height - y, flash.height); row++)
+    {
+        const unsigned char* source = &flash.coverage[row * flash.width];
+        unsigned char* target = data + (y + row) * stride + x;
+
+        for (int i = first_x; i < last_x; i++)
+        {
+            if (!source[i])
+                continue;
+
+            if (clear)
+                target[i] = (target[i] * (255 - source[i]) + 127) / 255;
+            else
+                target[i] += ((255 - target[i]) * source[i] + 127) / 255;
+        }
+    }
+}
+
+/******************************************************************************/
+/*
+ the holes of the polygons run the other way round, so the path is filled
+ with the non-zero winding rule
+ */
+/******************************************************************************/
+void stamp_cache::draw(Cairo::RefPtr<Cairo::Context> cr, const imulti_polygon& shape,
+                       double diameter)
+{
+    cr->set_fill_rule(Cairo::FILL_RULE_WINDING);
+
+    if (diameter > 0)
+    {
+        cr->begin_new_sub_path();
+        cr->arc(0, 0, diameter / 2, 0, 2 * M_PI);
+        return;
+    }
+
+    for (imulti_polygon::const_iterator area = shape.begin(); area != shape.end(); ++area)
+    {
+        for (size_t r = 0; r <= area->inners().size(); r++)
+        {
+            const ipolygon::ring_type& ring = r == 0 ? area->outer() : area->inners()[r - 1];
+
+            if (ring.empty())
+                continue;
+
+            cr->move_to(ring.front().first, ring.front().second);
+            for (size_t n = 1; n < ring.size(); n++)
+                cr->line_to(ring[n].first, ring[n].second);
+            cr->close_path();
+        }
+    }
+}
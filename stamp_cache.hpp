@@ -0,0 +1,100 @@
+/*
+ * This file is part of pcb2gcode.
+ *
+ * Copyright (C) 2016 the pcb2gcode developers
+ *
+ * pcb2gcode is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * pcb2gcode is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with pcb2gcode.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef STAMP_CACHE_HPP
+#define STAMP_CACHE_HPP
+
+#include <stdint.h>
+
+#include <map>
+using std::map;
+#include <vector>
+using std::vector;
+
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+using boost::shared_ptr;
+#include <boost/thread/mutex.hpp>
+
+#include <cairomm/cairomm.h>
+
+#include "coord.hpp"
+#include "run_set.hpp"
+
+/******************************************************************************/
+/*
+ Rasterised flashes of the apertures, to be copied into the rendered layers
+ instead of drawing each flash again.
+
+ A stamp is the shape of an aperture rendered by cairo for a given dpi, with
+ its centre at one of phases x phases sub-pixel positions: each flash uses
+ the stamp of the phase nearest to its own, and is off by 1 / (2 * phases)
+ of a pixel at most. The stamps of the binary renderings are runs of pixels,
+ the ones of the anti-aliased renderings coverage bytes. They are made on
+ their first use, by any number of concurrent renderers.
+ */
+/******************************************************************************/
+class stamp_cache: boost::noncopyable
+{
+public:
+    static const int phases = 8;
+    // the larger flashes are drawn by cairo, as they are seldom repeated and
+    // would take a lot of memory for all their phases
+    static const int max_side = 256;
+
+    // the pixels of a stamp, from the pixel (left, top) of the one where the
+    // centre of the flash falls
+    struct stamp
+    {
+        int left, top;
+        int width, height;
+        run_set runs;                   // binary
+        vector<unsigned char> coverage; // anti-aliased, width x height
+    };
+
+    // The stamp of the shape of aperture (in inches, centred on the origin)
+    // flashed at the device coordinates x, y, and the pixel where its centre
+    // falls; diameter is the one of a round aperture drawn as a circle, 0
+    // otherwise. NULL if the flash is larger than max_side pixels.
+    shared_ptr<const stamp> get(int aperture, const imulti_polygon& shape,
+                                double diameter, unsigned int dpi, double x, double y,
+                                bool antialias, int& pixel_x, int& pixel_y);
+
+    // Copies the stamp into a FORMAT_A1 (binary) or FORMAT_A8 (anti-aliased)
+    // surface, with the centre of the flash in the pixel (x, y), setting the
+    // pixels or clearing them; the surface must be flushed.
+    static void blit(const stamp& flash, int x, int y, bool clear,
+                     Cairo::RefPtr<Cairo::ImageSurface> surface);
+
+    // appends the polygons of shape to the path of cr, or the circle of the
+    // given diameter centred on the origin if it isn't 0
+    static void draw(Cairo::RefPtr<Cairo::Context> cr, const imulti_polygon& shape,
+                     double diameter);
+
+private:
+    static shared_ptr<const stamp> make_stamp(const imulti_polygon& shape, double diameter,
+                                              unsigned int dpi, double phase_x,
+                                              double phase_y, bool antialias);
+
+    // aperture, dpi, phases and anti-aliasing packed in 64 bits
+    map<uint64_t, shared_ptr<const stamp> > stamps;
+    boost::mutex stamps_mutex;
+};
+
+#endif // STAMP_CACHE_HPP
@@ -25,6 +25,15 @@ using std::pair;
 
 #include "outline_bridges.hpp"
 #include "tsp_solver.hpp"
+#include "distance_transform.hpp"
+#include "bit_growth.hpp"
+#include "component_labelling.hpp"
+#include "marching_squares.hpp"
+#include "pixel_kernels.hpp"
+#include "row_kernels.hpp"
+#include "parallel.hpp"
+#include "path_stitching.hpp"
+#include "vector_isolation.hpp"
 
 #include <glibmm/miscutils.h>
 using Glib::build_filename;
@@ -45,14 +54,13 @@ using Glib::build_filename;
 /******************************************************************************/
 void Surface::make_the_surface(unsigned int width, unsigned int height)
 {
-    pixbuf = Gdk::Pixbuf::create(Gdk::COLORSPACE_RGB, true, 8, width, height);
-
-    cairo_surface = Cairo::ImageSurface::create(pixbuf->get_pixels(),
-                    Cairo::FORMAT_ARGB32, width, height, pixbuf->get_rowstride());
+    copper = shared_ptr<bitplane>(new bitplane(width, height));
 }
 
 #include <boost/foreach.hpp>
+#include <cstdlib>
 #include <iostream>
+#include <map>
 using std::cerr;
 using std::endl;
 
@@ -66,24 +74,254 @@ Surface::Surface(guint dpi, ivalue_t min_x, ivalue_t max_x, ivalue_t min_y,
                  ivalue_t max_y, string outputdir) :
     dpi(dpi), min_x(min_x), max_x(max_x), min_y(min_y), max_y(max_y), zero_x(
         -min_x * (ivalue_t) dpi + (ivalue_t) procmargin), zero_y(
-            -min_y * (ivalue_t) dpi + (ivalue_t) procmargin), clr(32), outputdir(outputdir)
+            -min_y * (ivalue_t) dpi + (ivalue_t) procmargin), offset_x(0), offset_y(0),
+    roi_min_x(min_x), roi_max_x(max_x), roi_min_y(min_y), roi_max_y(max_y),
+    clr(0), outputdir(outputdir), blasts(0)
 {
-    guint8* pixels;
-    int stride;
+    // the bitplane is already clear
     make_the_surface((max_x - min_x) * dpi + 2 * procmargin,
                      (max_y - min_y) * dpi + 2 * procmargin);
-    usedcolors.push_back(BLACK);
-    usedcolors.push_back(WHITE);
+}
+
+/******************************************************************************/
+/*
+ the window is cut from the image of the whole board, so its pixels are
+ exactly the ones of the full image
+ */
+/******************************************************************************/
+Surface::Surface(guint dpi, ivalue_t min_x, ivalue_t max_x, ivalue_t min_y,
+                 ivalue_t max_y, ivalue_t roi_min_x, ivalue_t roi_max_x,
+                 ivalue_t roi_min_y, ivalue_t roi_max_y, string outputdir) :
+    dpi(dpi), min_x(min_x), max_x(max_x), min_y(min_y), max_y(max_y), zero_x(
+        -min_x * (ivalue_t) dpi + (ivalue_t) procmargin), zero_y(
+            -min_y * (ivalue_t) dpi + (ivalue_t) procmargin), offset_x(0), offset_y(0),
+    roi_min_x(std::max(roi_min_x, min_x)), roi_max_x(std::min(roi_max_x, max_x)),
+    roi_min_y(std::max(roi_min_y, min_y)), roi_max_y(std::min(roi_max_y, max_y)),
+    clr(0), outputdir(outputdir), blasts(0)
+{
+    const int board_width = (max_x - min_x) * dpi + 2 * procmargin;
+    const int board_height = (max_y - min_y) * dpi + 2 * procmargin;
+
+    // an empty region gets the whole board
+    if (!(this->roi_min_x <= this->roi_max_x && this->roi_min_y <= this->roi_max_y))
+    {
+        this->roi_min_x = min_x;
+        this->roi_max_x = max_x;
+        this->roi_min_y = min_y;
+        this->roi_max_y = max_y;
+    }
+
+    // the offsets are still 0, so these are the pixels of the whole board;
+    // the rows go downwards from max_y
+    const int left = std::max(xi2pt(this->roi_min_x) - procmargin, 0);
+    const int right = std::min(xi2pt(this->roi_max_x) + procmargin + 1, board_width);
+    const int top = std::max(yi2pt(min_y + max_y - this->roi_max_y) - procmargin, 0);
+    const int bottom = std::min(yi2pt(min_y + max_y - this->roi_min_y) + procmargin + 1,
+                                board_height);
+
+    offset_x = left;
+    offset_y = top;
+
+    make_the_surface(std::max(right - left, 1), std::max(bottom - top, 1));
+}
+
+/******************************************************************************/
+/*
+ The layer is rendered in horizontal bands, each with the lower left corner
+ of its own rows: the importer renders straight into the rows of the
+ occupancy bitplane, through cairo FORMAT_A1 surfaces sharing its memory, or
+ into a FORMAT_A8 band that is thresholded and whose edges are kept in the
+ coverage. When the importer can render several surfaces at once, the bands
+ are rendered concurrently. With a band_memory budget (in bytes) the bands
+ are as high as the budget allows; the planes of the whole layer
+ (get_plane_bytes()) have to be taken out of it by the caller.
+ */
+/******************************************************************************/
+void Surface::render(boost::shared_ptr<LayerImporter> importer, bool antialias,
+                     size_t band_memory)
+throw (import_exception)
+{
+    // kept for the refined windows
+    this->importer = importer;
+
+    const int height = copper->get_height();
+    const int band_stride = Cairo::ImageSurface::format_stride_for_width(Cairo::FORMAT_A8,
+                                                                         copper->get_width());
+    const unsigned int renderers = get_renderers(importer.get(), band_stride, band_memory);
+    // the copies of the layer are paid from the budget first
+    const size_t copies = (renderers - 1) * importer->get_render_copy_bytes();
+    const int band_rows = get_band_rows(band_stride,
+                                        band_memory ? std::max<size_t>(band_memory - copies, 1) : 0,
+                                        renderers);
+    const int bands = (height + band_rows - 1) / band_rows;
+
+    if (antialias)
+    {
+        // the anti-aliased coverage is kept for the sub-pixel contours, and
+        // the pixels covered at least by half are the copper
+        coverage = shared_ptr<coverageplane>(new coverageplane(*copper));
+    }
+
+    if (renderers > 1 && bands > 1)
+        parallel::for_batches(bands, boost::bind(&Surface::render_bands, this,
+                              importer.get(), antialias, band_rows, false, _1, _2));
+    else
+        render_bands(importer.get(), antialias, band_rows, true, 0, bands);
+}
+
+/******************************************************************************/
+/*
+ Concurrent renderers of a layer: each one may need its own copy of the layer,
+ which the importer parses again, so they are only used for the layers with
+ at least concurrent_band_pixels pixels per renderer. Within a band_memory
+ budget, the copies and a row of coverage tiles per renderer must fit in it.
+ */
+/******************************************************************************/
+static const size_t concurrent_band_pixels = 1 << 22;
+
+unsigned int Surface::get_renderers(LayerImporter* importer, int band_stride,
+                                    size_t band_memory)
+{
+    const int height = copper->get_height();
+    const size_t pixels = size_t(copper->get_width()) * height;
+    // the bands are at least a row of coverage tiles high
+    const size_t bands = (height + coverageplane::tile_size - 1) / coverageplane::tile_size;
+    unsigned int renderers = std::min<size_t>(std::min<size_t>(parallel::threads(), bands),
+                                              std::max<size_t>(pixels / concurrent_band_pixels, 1));
+
+    if (band_memory != 0)
+    {
+        const size_t copy = importer->get_render_copy_bytes();
+        const size_t band = size_t(band_stride) * coverageplane::tile_size;
+
+        while (renderers > 1 && (renderers - 1) * copy + renderers * band > band_memory)
+            renderers--;
+    }
+
+    return renderers > 1 ? importer->prepare_concurrent_render(renderers) : 1;
+}
+
+/******************************************************************************/
+/*
+ the labels and the coverage are counted as if all their tiles were
+ allocated; the bit-parallel growth also needs the windows of the
+ components, which aren't counted
+ */
+/******************************************************************************/
+size_t Surface::get_plane_bytes(shared_ptr<RoutingMill> mill, bool masked)
+{
+    const size_t pixels = size_t(copper->get_width()) * copper->get_height();
+    const bool subpixel = mill->contour_mode == CONTOUR_SUBPIXEL;
+    // the copper and the masked area, 1 bit per pixel each, and the labels
+    size_t bytes = pixels / 8 * (masked ? 2 : 1) + pixels * 4;
+
+    if (subpixel)
+    {
+        // the coverage, and the distance transform with the features
+        bytes += pixels + pixels * 16;
+    }
+    else if (mill->growth_engine == GROWTH_EDT)
+        bytes += pixels * 12;
+    else if (mill->growth_engine == GROWTH_BITPLANE)
+        bytes += pixels / 4;
+
+    return bytes;
+}
+
+/******************************************************************************/
+/*
+ Rows of a band: the renderer and its temporary masks need about an 8-bit row
+ per pixel row and renderer. The bands start on the rows of coverage tiles,
+ so that the concurrent ones store disjoint tiles; a budget too small for a
+ row of tiles of a single renderer can't be met.
+ */
+/******************************************************************************/
+int Surface::get_band_rows(int band_stride, size_t band_memory, unsigned int renderers)
+{
+    const int tile_size = coverageplane::tile_size;
+    const int height = copper->get_height();
+
+    // a band per renderer
+    int rows = ((height + renderers - 1) / renderers + tile_size - 1) & ~(tile_size - 1);
+
+    if (band_memory != 0)
+    {
+        const size_t band_row_bytes = size_t(band_stride) * renderers;
+        const size_t budget = band_memory / band_row_bytes;
+
+        if (budget < size_t(rows))
+            rows = std::max<int>(budget & ~(tile_size - 1), tile_size);
+
+        if (budget < size_t(std::min(rows, height)))
+        {
+            std::stringstream msg;
+            msg << "the render bands need "
+                << ((band_row_bytes * std::min(rows, height) + (1 << 20) - 1) >> 20)
+                << " MB, more than the --max-memory budget leaves them";
+            throw memory_exception() << errorstring(msg.str());
+        }
+    }
+
+    return std::min(rows, height);
+}
+
+/******************************************************************************/
+/*
+ renders the bands [begin, end); parallel_threshold thresholds each band on
+ all the threads, when the bands aren't rendered concurrently
+ */
+/******************************************************************************/
+void Surface::render_bands(LayerImporter* importer, bool antialias, int band_rows,
+                           bool parallel_threshold, int begin, int end)
+{
+    const int width = copper->get_width();
+    const int height = copper->get_height();
+    const int band_stride = Cairo::ImageSurface::format_stride_for_width(Cairo::FORMAT_A8,
+                                                                         width);
 
-    /* "Note that the buffer is not cleared; you will have to fill it completely yourself." */
-    //printf("clearing\n");
-    pixels = cairo_surface->get_data();
-    stride = cairo_surface->get_stride();
-    for (int y = 0; y < pixbuf->get_height(); y++)
+    // the image can be a window of the one of the whole board
+    const int board_height = (max_y - min_y) * dpi + 2 * procmargin;
+    const ivalue_t left = min_x + static_cast<ivalue_t>(offset_x - procmargin) / dpi;
+
+    vector<unsigned char> band;
+
+    for (int i = begin; i < end; i++)
     {
-        for (int x = 0; x < pixbuf->get_width(); x++)
+        const int top = i * band_rows;
+        const int rows = std::min(band_rows, height - top);
+        const ivalue_t bottom = min_y + static_cast<ivalue_t>(board_height - offset_y -
+                                top - rows - procmargin) / dpi;
+
+        if (antialias)
+        {
+            band.assign(band_stride * rows, 0);
+
+            Cairo::RefPtr<Cairo::ImageSurface> cairo_surface =
+                Cairo::ImageSurface::create(&band[0], Cairo::FORMAT_A8, width, rows,
+                                            band_stride);
+
+            importer->render(cairo_surface, dpi, left, bottom, true);
+
+            cairo_surface->flush();
+
+            if (parallel_threshold)
+                parallel::for_chunks(rows, boost::bind(&Surface::threshold_rows, this,
+                                                       &band, band_stride, top, _1, _2));
+            else
+                threshold_rows(&band, band_stride, top, 0, rows);
+
+            coverage->store_rows(top, rows, &band[0], band_stride);
+        }
+        else
         {
-            PRC(pixels + x*4 + y*stride) = BLACK;
+            Cairo::RefPtr<Cairo::ImageSurface> cairo_surface =
+                Cairo::ImageSurface::create(copper->get_data() + top * copper->get_stride(),
+                                            Cairo::FORMAT_A1, width, rows,
+                                            copper->get_stride());
+
+            importer->render(cairo_surface, dpi, left, bottom, false);
+
+            cairo_surface->flush();
         }
     }
 }
@@ -92,17 +330,92 @@ Surface::Surface(guint dpi, ivalue_t min_x, ivalue_t max_x, ivalue_t min_y,
 /*
  */
 /******************************************************************************/
-void Surface::render(boost::shared_ptr<LayerImporter> importer)
-throw (import_exception)
+void Surface::threshold_rows(const vector<unsigned char>* band, int band_stride,
+                             int top, int begin, int end)
 {
-    importer->render(cairo_surface, dpi,
-                     min_x - static_cast<ivalue_t>(procmargin) / dpi,
-                     min_y - static_cast<ivalue_t>(procmargin) / dpi);
+    for (int y = begin; y < end; y++)
+        row_kernels::threshold_bytes(&(*band)[y * band_stride], copper->get_width(),
+                                     copper->get_row(top + y));
+}
+
+/******************************************************************************/
+/*
+ sets the runs of pixels of the row y whose bit is set to value
+ */
+/******************************************************************************/
+static void fill_runs(labelplane& labels, int y, const uint32_t* bits, guint32 value)
+{
+    const int width = labels.get_width();
+    int x = 0;
+
+    while (x < width)
+    {
+        // whole clear words are skipped
+        if ((x & 31) == 0 && bits[x / 32] == 0)
+        {
+            x += 32;
+            continue;
+        }
+
+        if (!(bits[x / 32] & bitplane::bit(x)))
+        {
+            x++;
+            continue;
+        }
+
+        const int begin = x;
+
+        while (x < width)
+        {
+            if ((x & 31) == 0 && bits[x / 32] == 0xFFFFFFFF)
+                x += 32;
+            else if (bits[x / 32] & bitplane::bit(x))
+                x++;
+            else
+                break;
+        }
+
+        labels.fill_span(y, begin, std::min(x, width), value);
+    }
+}
+
+/******************************************************************************/
+/*
+ allocates the label plane from the bitplanes: copper is WHITE (not yet
+ labelled), the masked area is tinted to block the growth, the rest is BLACK
+ */
+/******************************************************************************/
+void Surface::make_the_labels()
+{
+    const int width = copper->get_width();
+    const int height = copper->get_height();
+
+    labels = shared_ptr<labelplane>(new labelplane(width, height, BLACK));
+
+    // only the tiles with some copper or masked area get allocated, hence
+    // every thread gets whole rows of tiles
+    parallel::for_chunks((height + labelplane::tile_size - 1) / labelplane::tile_size,
+                         boost::bind(&Surface::label_rows, this, _1, _2));
+}
+
+/******************************************************************************/
+/*
+ */
+/******************************************************************************/
+void Surface::label_rows(int begin, int end)
+{
+    const int last_row = std::min(end * labelplane::tile_size, labels->get_height());
+
+    for (int y = begin * labelplane::tile_size; y < last_row; y++)
+    {
+        if (blocked)
+            fill_runs(*labels, y, blocked->get_row(y), RED | BLUE);
+
+        fill_runs(*labels, y, copper->get_row(y), WHITE);
+    }
 }
 
-#include <iostream>
 using std::cout;
-using std::endl;
 using std::list;
 
 /******************************************************************************/
@@ -131,64 +444,41 @@ vector<shared_ptr<icoords> > Surface::get_toolpath(shared_ptr<RoutingMill> mill,
         bool mirrored, bool mirror_absolute)
 {
     Isolator* iso = dynamic_cast<Isolator*>(mill.get());
-    int extra_passes = iso ? iso->extra_passes : 0;
-
-    coords components = fill_all_components();
+    const guint refine_dpi = iso ? iso->refine_dpi : 0;
+    const int extra_passes = iso ? iso->extra_passes : 0;
+    const bool offset = iso && iso->offset_passes && extra_passes > 0;
+    const bool refined = refine_dpi > dpi && importer;
+    const int passes = offset ? 1 : extra_passes + 1;
 
-    int added = -1;
     int contentions = 0;
-    int grow = mill->tool_diameter / 2 * dpi;
     ivalue_t mirror_axis = mirror_absolute ? min_x : ((min_x + max_x) / 2);
 
     vector<shared_ptr<icoords> > toolpath;
 
-    for (int pass = 0; pass <= extra_passes && added != 0; pass++)
+    if (refined || offset)
     {
-        for (int i = 0; i < grow && added != 0; i++)
-        {
-            added = 0;
-
-            BOOST_FOREACH( coordpair c, components )
-            {
-                added += grow_a_component(c.first, c.second, contentions);
-            }
-        }
+        // the refined windows are stitched and the extra passes offset in
+        // board coordinates, then the whole layer is mirrored
+        toolpath = grow_and_trace(mill, passes, false, mirror_axis, contentions);
 
-        coords inside, outside;
+        if (refined)
+            refine(mill, passes, refine_dpi, toolpath, contentions);
+        if (offset)
+            offset_passes(mill, extra_passes, toolpath, contentions);
 
-        BOOST_FOREACH( coordpair c, components )
+        if (mirrored)
         {
-            calculate_outline(c.first, c.second, outside, inside);
-            inside.clear();
-
-            shared_ptr<icoords> outline(new icoords());
-            shared_ptr<icoords> outline_optimised(new icoords());
-
-            // i'm not sure wheter this is the right place to do this...
-            // that "mirrored" flag probably is a bad idea.
-            BOOST_FOREACH( coordpair c, outside )
-            {
-                outline->push_back(
-                    icoordpair(
-                        // tricky calculations
-                        mirrored ?
-                        (2 * mirror_axis - xpt2i(c.first)) :
-                        xpt2i(c.first),
-                        min_y + max_y - ypt2i(c.second)));
-            }
-
-            outside.clear();
-
-            if (mill->optimise)
+            BOOST_FOREACH(shared_ptr<icoords>& path, toolpath)
             {
-                //Use Boost's Douglas-Peucker simplification algorithm
-                boost::geometry::simplify( *outline, *outline_optimised, 1.0 / dpi );
-                toolpath.push_back(outline_optimised);
+                BOOST_FOREACH(icoordpair& point, *path)
+                {
+                    point.first = 2 * mirror_axis - point.first;
+                }
             }
-            else
-                toolpath.push_back(outline);
         }
     }
+    else
+        toolpath = grow_and_trace(mill, passes, mirrored, mirror_axis, contentions);
 
     if (contentions)
     {
@@ -198,459 +488,1858 @@ vector<shared_ptr<icoords> > Surface::get_toolpath(shared_ptr<RoutingMill> mill,
              << " possibly use a smaller milling width.\n";
     }
 
+    if (blasts)
+    {
+        cerr << "\nNote: the outline tracer had to repair stray pixels "
+             << blasts << " times.\n";
+    }
+
     tsp_solver::nearest_neighbour( toolpath, std::make_pair(0, 0), 1.0 / dpi );
 
     save_debug_image("traced");
+    labels.reset();
+
     return toolpath;
 }
 
 /******************************************************************************/
 /*
+ grows the components and traces their isolation paths, for the given number
+ of passes; the labels are left allocated
  */
 /******************************************************************************/
-guint32 Surface::get_an_unused_color()
+vector<shared_ptr<icoords> > Surface::grow_and_trace(shared_ptr<RoutingMill> mill,
+        int passes, bool mirrored, ivalue_t mirror_axis, int& contentions)
 {
-    bool badcol;
-    do
+    const int extra_passes = passes - 1;
+
+    const bool subpixel = mill->contour_mode == CONTOUR_SUBPIXEL;
+    const bool growth_on_runs = mill->growth_engine != GROWTH_EDT && !subpixel;
+
+    make_the_labels();
+    vector<run_set> component_runs;
+    coords components = fill_all_components(growth_on_runs ? &component_runs : NULL);
+
+    int added = -1;
+    int grow = mill->tool_diameter / 2 * dpi;
+    double radius = mill->tool_diameter / 2 * dpi;
+
+    vector<shared_ptr<icoords> > toolpath;
+
+    // the distance transform is computed once, then each pass only has to
+    // claim the pixels within its radius
+    shared_ptr<distance_transform> edt;
+    // otherwise the components grow one ring at a time, from the pixels
+    // added by the previous ring
+    vector<frontier> active;
+    // or with the same rings on bit-packed planes
+    shared_ptr<bit_growth> bits;
+
+    // the sub-pixel contours are interpolated on the distance field, so they
+    // always need it
+    if (!growth_on_runs)
+    {
+        vector<uint32_t> seed_colors;
+
+        BOOST_FOREACH( coordpair c, components )
+        {
+            seed_colors.push_back(labels->get(c.first, c.second));
+        }
+
+        // the pixel contours keep the square rings of the outline engine
+        edt = shared_ptr<distance_transform>(
+                  new distance_transform(*labels, seed_colors, subpixel, !subpixel));
+    }
+    else
     {
-        badcol = false;
-        clr = rand();
+        run_set border;
+
+        if (mill->growth_engine == GROWTH_BITPLANE)
+            bits = shared_ptr<bit_growth>(new bit_growth(*labels));
 
-        for (int i = 0; i < usedcolors.size(); i++)
+        // the first ring is the outer border of the copper, the holes are
+        // not isolated from inside. The first run of a component is on its
+        // top row, so the pixel after it is outside
+        for (unsigned int i = 0; i < components.size(); i++)
         {
-            if (usedcolors[i] == clr)
+            const pixel_run& first_run = component_runs[i].get_runs().front();
+            const guint32 color = labels->get(components[i].first, components[i].second);
+
+            active.push_back(frontier());
+            active.back().color = color;
+
+            component_runs[i].get_border(labels->get_width(), labels->get_height(), border);
+            border.get_connected(first_run.last + 1, first_run.y, active.back().candidates);
+
+            if (bits)
             {
-                badcol = true;
-                break;
+                bits->add_component(color, component_runs[i], active.back().candidates,
+                                    grow * (extra_passes + 1));
+                active.pop_back();
             }
         }
-    }
-    while (badcol);
-    usedcolors.push_back(clr);
-    return clr;
-}
 
-/******************************************************************************/
-/*
- try to find white pixels, aka uncolored pixels,
- and do some floodfilling with a random color based on them.
- returns the	list floodfill-seed points
- */
-/******************************************************************************/
-std::vector<std::pair<int, int> > Surface::fill_all_components()
-{
-    std::vector<pair<int, int> > components;
-    int max_x = cairo_surface->get_width() - 1;
-    int max_y = cairo_surface->get_height() - 1;
-    guint8* pixels = cairo_surface->get_data();
-    int stride = cairo_surface->get_stride();
+        vector<run_set>().swap(component_runs);
+    }
 
-    for (int y = 0; y <= max_y; y++)
+    for (int pass = 0; pass <= extra_passes && added != 0; pass++)
     {
-        for (int x = 0; x <= max_x; x++)
+        if (subpixel)
+        {
+            // the contour is measured from the copper edges, up to half a
+            // pixel farther than the centres of the copper pixels
+            added = edt->grow(*labels, radius * (pass + 1) + 0.5, contentions);
+        }
+        else if (edt)
+        {
+            added = edt->grow(*labels, grow * (pass + 1), contentions);
+        }
+        else if (bits)
+        {
+            for (int i = 0; i < grow && added != 0; i++)
+                added = bits->grow(*labels, contentions);
+        }
+        else
         {
-            if ((PRC(pixels + x*4 + y*stride) | OPAQUE) == WHITE)
+            for (int i = 0; i < grow && added != 0; i++)
             {
-                components.push_back(pair<int, int>(x, y));
-                fill_a_component(x, y, get_an_unused_color());
+                added = grow_frontiers(active, contentions);
+
+                // saturated components can't grow any more
+                unsigned int still_active = 0;
+
+                for (unsigned int j = 0; j < active.size(); j++)
+                {
+                    if (!active[j].candidates.empty())
+                    {
+                        active[still_active].color = active[j].color;
+                        active[still_active].candidates.swap(active[j].candidates);
+                        still_active++;
+                    }
+                }
+
+                active.resize(still_active);
             }
         }
+
+        trace_job job;
+        job.mill = mill;
+        job.mirrored = mirrored;
+        job.mirror_axis = mirror_axis;
+        job.edt = subpixel ? edt.get() : NULL;
+        job.radius = radius * (pass + 1);
+        job.components = &components;
+        job.paths.resize(components.size());
+        job.deferred.resize(components.size(), false);
+
+        parallel::for_batches(components.size(),
+                              boost::bind(&Surface::trace_components, this, &job, _1, _2));
+
+        // a repair only changes the pixels around the component being traced,
+        // between its own color and the background: the traces of the others
+        // don't depend on it, so doing the repairs last, in order, gives the
+        // same labels and toolpaths as a serial run
+        for (unsigned int i = 0; i < components.size(); i++)
+            if (job.deferred[i])
+                trace_component(job, i, serial_tracer, true);
+
+        toolpath.insert(toolpath.end(), job.paths.begin(), job.paths.end());
     }
 
-    return components;
+    return toolpath;
 }
 
-#include <stack>
+/******************************************************************************/
+/*
+ the adaptive refinement looks for the isolation areas of different
+ components less than refine_gap pixels apart, in cells of refine_cell x
+ refine_cell pixels
+ */
+/******************************************************************************/
+static const int refine_gap = 3;
+static const int refine_cell = 16;
 
 /******************************************************************************/
 /*
- fill_a_component does not do any image boundary checks out of performance reasons.
+ re-renders at refine_dpi the areas where the isolation areas of different
+ components meet or almost meet, computes their toolpaths there and stitches
+ them into the ones of the whole layer. The neighbouring crowded cells are
+ grouped in windows, which are grown by the milling width plus a few pixels
+ on each side, twice: the copper outside a window can't change the refined
+ paths in the inner part, which is the one stitched.
  */
 /******************************************************************************/
-void Surface::fill_a_component(int x, int y, guint32 argb)
+void Surface::refine(shared_ptr<RoutingMill> mill, int passes, guint refine_dpi,
+                     vector<shared_ptr<icoords> >& toolpath, int& contentions)
 {
-    guint32 newclr = argb;
+    const int width = labels->get_width();
+    const int height = labels->get_height();
+    const int cells_per_row = (width + refine_cell - 1) / refine_cell;
+    const int cells_per_column = (height + refine_cell - 1) / refine_cell;
+    const double tolerance = 3.0 / dpi;
+    // the pixel contours run on the pixel grids, the sides of the windows
+    // don't
+    const ivalue_t margin = (ceil(mill->tool_diameter / 2 * dpi * passes) +
+                             refine_gap + 8.5) / dpi + 0.25 / refine_dpi;
+
+    vector<unsigned char> crowded(cells_per_row * cells_per_column, false);
+
+    // every thread gets whole rows of cells
+    parallel::for_chunks(cells_per_column, boost::bind(&Surface::crowded_rows,
+                         this, &crowded, _1, _2));
+
+    // the bounding boxes of the groups of crowded cells, grown by the margin
+    vector<path_stitching::rectangle> inner;
+    vector<pair<int, int> > stack;
+
+    for (int i = 0; i < cells_per_row * cells_per_column; i++)
+    {
+        if (crowded[i] != 1)
+            continue;
+
+        int first_x = i % cells_per_row, last_x = first_x;
+        int first_y = i / cells_per_row, last_y = first_y;
 
-    guint8* pixels = cairo_surface->get_data();
-    int stride = cairo_surface->get_stride();
+        crowded[i] = 2;
+        stack.push_back(pair<int, int>(first_x, first_y));
 
-    guint8* here = pixels + x * 4 + y * stride;
-    guint8* maxhere = pixels + (cairo_surface->get_width() - 1) * 4
-                      + (cairo_surface->get_height() - 1) * stride;
+        while (!stack.empty())
+        {
+            const pair<int, int> cell = stack.back();
+            stack.pop_back();
+
+            first_x = std::min(first_x, cell.first);
+            last_x = std::max(last_x, cell.first);
+            first_y = std::min(first_y, cell.second);
+            last_y = std::max(last_y, cell.second);
+
+            for (int y = std::max(cell.second - 1, 0);
+                    y <= std::min(cell.second + 1, cells_per_column - 1); y++)
+                for (int x = std::max(cell.first - 1, 0);
+                        x <= std::min(cell.first + 1, cells_per_row - 1); x++)
+                    if (crowded[y * cells_per_row + x] == 1)
+                    {
+                        crowded[y * cells_per_row + x] = 2;
+                        stack.push_back(pair<int, int>(x, y));
+                    }
+        }
+
+        path_stitching::rectangle area;
+        area.min_x = xpt2i(first_x * refine_cell) - margin;
+        area.max_x = xpt2i((last_x + 1) * refine_cell) + margin;
+        // the rows of the image go downwards
+        area.min_y = min_y + max_y - ypt2i((last_y + 1) * refine_cell) - margin;
+        area.max_y = min_y + max_y - ypt2i(first_y * refine_cell) + margin;
+        inner.push_back(area);
+    }
+
+    // the windows mustn't overlap, or the later ones could find the refined
+    // paths of the earlier ones in their margins
+    for (bool merged = true; merged; )
+    {
+        merged = false;
+
+        for (unsigned int i = 0; i < inner.size() && !merged; i++)
+            for (unsigned int j = i + 1; j < inner.size() && !merged; j++)
+            {
+                path_stitching::rectangle& a = inner[i];
+                const path_stitching::rectangle& b = inner[j];
 
-    guint32 ownclr = PRC(here);
+                if (a.min_x - margin < b.max_x + margin && b.min_x - margin < a.max_x + margin &&
+                        a.min_y - margin < b.max_y + margin && b.min_y - margin < a.max_y + margin)
+                {
+                    a.min_x = std::min(a.min_x, b.min_x);
+                    a.max_x = std::max(a.max_x, b.max_x);
+                    a.min_y = std::min(a.min_y, b.min_y);
+                    a.max_y = std::max(a.max_y, b.max_y);
+                    inner.erase(inner.begin() + j);
+                    merged = true;
+                }
+            }
+    }
 
-    std::stack<pair<int, int> > queued_pixels;
-    queued_pixels.push(pair<int, int>(x, y));
+    unsigned int rejected = 0;
 
-    while (queued_pixels.size())
+    BOOST_FOREACH(path_stitching::rectangle area, inner)
     {
-        pair<int, int> current_pixel = queued_pixels.top();
-        x = current_pixel.first;
-        y = current_pixel.second;
-        queued_pixels.pop();
+        // nothing is missing beyond the sides of the area the layer covers,
+        // so there the window stops and the inner part doesn't
+        const ivalue_t window_min_x = std::max(area.min_x - margin, roi_min_x);
+        const ivalue_t window_max_x = std::min(area.max_x + margin, roi_max_x);
+        const ivalue_t window_min_y = std::max(area.min_y - margin, roi_min_y);
+        const ivalue_t window_max_y = std::min(area.max_y + margin, roi_max_y);
+        const ivalue_t beyond = max_x - min_x + max_y - min_y;
+
+        if (window_min_x == roi_min_x)
+            area.min_x = min_x - beyond;
+        if (window_max_x == roi_max_x)
+            area.max_x = max_x + beyond;
+        if (window_min_y == roi_min_y)
+            area.min_y = min_y - beyond;
+        if (window_max_y == roi_max_y)
+            area.max_y = max_y + beyond;
+
+        // on the pixel grid, the origin of the window is exact
+        Surface window(refine_dpi, floor(window_min_x * refine_dpi) / refine_dpi,
+                       ceil(window_max_x * refine_dpi) / refine_dpi,
+                       floor(window_min_y * refine_dpi) / refine_dpi,
+                       ceil(window_max_y * refine_dpi) / refine_dpi, outputdir);
+
+        window.render(importer, mill->contour_mode == CONTOUR_SUBPIXEL);
+        window.clear_margins();
+
+        if (blocked)
+            window.copy_mask(*this);
+
+        int window_contentions = 0;
+        vector<shared_ptr<icoords> > refined =
+            window.grow_and_trace(mill, passes, false, 0, window_contentions);
+
+        // a contour running along a side of the inner part can cross it at
+        // one resolution and not at the other: the side is moved away
+        bool stitched = false;
+
+        for (int attempt = 0; attempt < 4 && !stitched; attempt++)
+        {
+            path_stitching::rectangle inner_part = area;
+            const ivalue_t shift = attempt * 2.0 / dpi;
+
+            inner_part.min_x += shift;
+            inner_part.max_x -= shift;
+            inner_part.min_y += shift;
+            inner_part.max_y -= shift;
 
-        here = pixels + x * 4 + y * stride;
-        PRC(here) = newclr;
+            stitched = path_stitching::stitch(toolpath, refined, inner_part, tolerance);
+        }
 
-        if (here + 4 <= maxhere && PRC(here+4) == ownclr)
-            queued_pixels.push(pair<int, int>(x + 1, y));
-        if (pixels <= here - 4 && PRC(here-4) == ownclr)
-            queued_pixels.push(pair<int, int>(x - 1, y));
-        if (here + stride <= maxhere && PRC(here+stride) == ownclr)
-            queued_pixels.push(pair<int, int>(x, y + 1));
-        if (pixels <= here - stride && PRC(here-stride) == ownclr)
-            queued_pixels.push(pair<int, int>(x, y - 1));
-        if (here + 4 + stride <= maxhere && PRC(here+4+stride) == ownclr)
-            queued_pixels.push(pair<int, int>(x + 1, y + 1));
-        if (here - 4 + stride <= maxhere && PRC(here-4+stride) == ownclr)
-            queued_pixels.push(pair<int, int>(x - 1, y + 1));
-        if (pixels <= here + 4 - stride && PRC(here+4-stride) == ownclr)
-            queued_pixels.push(pair<int, int>(x + 1, y - 1));
-        if (pixels <= here - 4 - stride && PRC(here-4-stride) == ownclr)
-            queued_pixels.push(pair<int, int>(x - 1, y - 1));
+        if (stitched)
+        {
+            contentions += window_contentions;
+            blasts += window.blasts;
+        }
+        else
+            rejected++;
     }
 
-    cairo_surface->mark_dirty();
+    if (rejected)
+    {
+        cerr << "\nNote: " << rejected << " of " << inner.size()
+             << " refined areas didn't match the surrounding toolpaths and"
+             << " have been left at the base resolution.\n";
+    }
 }
 
 /******************************************************************************/
 /*
- starting from a pixel at xy within a "component" aka a blob of
- same-colored pixels, increase x until it is next to a new color
+ the toolpaths of the first pass enclose the isolation areas, which are
+ offset by the milling radius once more for each extra pass instead of being
+ grown on the pixels
  */
 /******************************************************************************/
-void Surface::run_to_border(int& x, int& y)
+void Surface::offset_passes(shared_ptr<RoutingMill> mill, int extra_passes,
+                            vector<shared_ptr<icoords> >& toolpath, int& contentions)
 {
-    guint8* pixels = cairo_surface->get_data();
-    int stride = cairo_surface->get_stride();
+    imulti_polygon areas;
 
-    guint32 start_color = PRC(pixels + x*4 + y * stride);
+    areas.resize(toolpath.size());
 
-    if (start_color == 0)
+    for (unsigned int i = 0; i < toolpath.size(); i++)
     {
-        PRC(pixels + x*4 + y * stride) = RED;
-        save_debug_image("error_runtoborder");
-        std::stringstream msg;
-        msg << "run_to_border: start_color == 0 at (" << x << "," << y << ")\n";
-        throw std::logic_error(msg.str());
+        areas[i].outer().assign(toolpath[i]->begin(), toolpath[i]->end());
+        boost::geometry::correct(areas[i]);
+    }
+
+    vector_isolation offsets(areas, min_x, max_x, true);
+    unsigned int failures = 0;
+
+    if (mask_area)
+        offsets.set_mask(*mask_area);
+
+    for (int pass = 1; pass <= extra_passes; pass++)
+        contentions += offsets.grow(mill->tool_diameter / 2 * pass, mill->optimise,
+                                    toolpath, failures);
+
+    if (failures)
+    {
+        cerr << "\nWarning: the extra passes of " << failures
+             << " isolation areas couldn't be offset, and are missing. You"
+             << " may want to disable offset-passes.\n";
     }
+}
+
+/******************************************************************************/
+/*
+ marks the cells [begin, end) (whole rows of cells) holding a background pixel
+ with two different components less than refine_gap pixels away
+ */
+/******************************************************************************/
+void Surface::crowded_rows(vector<unsigned char>* crowded, int begin, int end)
+{
+    const int width = labels->get_width();
+    const int height = labels->get_height();
+    const int cells_per_row = (width + refine_cell - 1) / refine_cell;
+    const int span = 2 * refine_gap + 1;
+
+    vector<vector<guint32> > rows(span, vector<guint32>(width));
+    // first component color in each column of the rows, and whether there
+    // is another one; 0 if there is none
+    vector<guint32> first(width);
+    vector<unsigned char> mixed(width);
+
+    for (int y = std::max(begin * refine_cell, refine_gap);
+            y < std::min(end * refine_cell, height - refine_gap); y++)
+    {
+        for (int i = 0; i < span; i++)
+            labels->get_span(y - refine_gap + i, 0, width, &rows[i][0]);
+
+        for (int x = 0; x < width; x++)
+        {
+            first[x] = 0;
+            mixed[x] = false;
+
+            for (int i = 0; i < span; i++)
+            {
+                const guint32 pixel = rows[i][x];
+
+                if ((pixel | OPAQUE) == BLACK || pixel == (RED | BLUE))
+                    continue;
+
+                if (!first[x])
+                    first[x] = pixel;
+                else if (pixel != first[x])
+                    mixed[x] = true;
+            }
+        }
+
+        for (int x = refine_gap; x < width - refine_gap; x++)
+        {
+            unsigned char& cell = (*crowded)[(y / refine_cell) * cells_per_row +
+                                             x / refine_cell];
+
+            if (cell || rows[refine_gap][x] != BLACK)
+                continue;
+
+            guint32 color = 0;
+
+            for (int dx = -refine_gap; dx <= refine_gap && !cell; dx++)
+            {
+                if (mixed[x + dx] || (first[x + dx] && color && first[x + dx] != color))
+                    cell = true;
+                else if (first[x + dx])
+                    color = first[x + dx];
+            }
+        }
+    }
+}
+
+/******************************************************************************/
+/*
+ clears the copper rendered in the processing margins: the copper crossing
+ the sides of a window mustn't reach the border of the image
+ */
+/******************************************************************************/
+void Surface::clear_margins()
+{
+    const int width = copper->get_width();
+    const int height = copper->get_height();
+
+    for (int y = 0; y < height; y++)
+        for (int x = 0; x < width; x++)
+        {
+            if (x == procmargin && y >= procmargin && y < height - procmargin)
+                x = width - procmargin;
+
+            copper->set(x, y, false);
+
+            if (coverage)
+                coverage->clear(x, y);
+        }
+}
+
+/******************************************************************************/
+/*
+ blocks the pixels of a window whose nearest pixel in the layer it refines is
+ blocked, and clears their copper, as add_mask() does
+ */
+/******************************************************************************/
+void Surface::copy_mask(Surface& layer)
+{
+    const int width = copper->get_width();
+    const int height = copper->get_height();
+    const int layer_width = layer.blocked->get_width();
+    const int layer_height = layer.blocked->get_height();
+
+    vector<int> columns(width);
+
+    blocked = shared_ptr<bitplane>(new bitplane(width, height));
+
+    for (int x = 0; x < width; x++)
+        columns[x] = std::max(std::min(layer.xi2pt(xpt2i(x + 0.5)), layer_width - 1), 0);
+
+    for (int y = 0; y < height; y++)
+    {
+        // the rows of both the images go downwards from max_y
+        const int row = std::max(std::min(layer.yi2pt(layer.min_y + layer.max_y -
+                                          (min_y + max_y - ypt2i(y + 0.5))),
+                                          layer_height - 1), 0);
+
+        for (int x = 0; x < width; x++)
+            if (layer.blocked->get(columns[x], row))
+            {
+                blocked->set(x, y, true);
+                copper->set(x, y, false);
+            }
+    }
+}
+
+/******************************************************************************/
+/*
+ traces the components [begin, end) without repairs; the ones that need one
+ (or fail) are left to the serial pass, which reports the errors
+ */
+/******************************************************************************/
+void Surface::trace_components(trace_job* job, int begin, int end)
+{
+    tracer_state state;
+
+    for (int i = begin; i < end; i++)
+    {
+        try
+        {
+            if (!trace_component(*job, i, state, false))
+                job->deferred[i] = true;
+        }
+        catch (std::exception&)
+        {
+            job->deferred[i] = true;
+        }
+    }
+}
+
+/******************************************************************************/
+/*
+ */
+/******************************************************************************/
+bool Surface::trace_component(trace_job& job, int i, tracer_state& state, bool repair)
+{
+    const coordpair& c = (*job.components)[i];
+    vector<pair<double, double> >& contour = state.contour;
+
+    if (job.edt)
+    {
+        calculate_subpixel_outline(c.first, c.second, *job.edt, job.radius, contour);
+    }
+    else
+    {
+        if (!calculate_outline(c.first, c.second, state, repair))
+            return false;
+
+        contour.assign(state.outside.begin(), state.outside.end());
+    }
+
+    shared_ptr<icoords> outline(new icoords());
+
+    // i'm not sure wheter this is the right place to do this...
+    // that "mirrored" flag probably is a bad idea.
+    for (unsigned int i = 0; i < contour.size(); i++)
+    {
+        const pair<double, double>& c = contour[i];
+
+        outline->push_back(
+            icoordpair(
+                // tricky calculations
+                job.mirrored ?
+                (2 * job.mirror_axis - xpt2i(c.first)) :
+                xpt2i(c.first),
+                min_y + max_y - ypt2i(c.second)));
+    }
+
+    if (job.mill->optimise)
+    {
+        //Use Boost's Douglas-Peucker simplification algorithm
+        shared_ptr<icoords> outline_optimised(new icoords());
+
+        boost::geometry::simplify( *outline, *outline_optimised, 1.0 / dpi );
+        job.paths[i] = outline_optimised;
+    }
+    else
+        job.paths[i] = outline;
+
+    return true;
+}
+
+/******************************************************************************/
+/*
+ returns a new component color in constant time. The colors are derived from
+ a counter, skipping the ones reserved for the image processing, so the same
+ input always gets the same colors.
+ */
+/******************************************************************************/
+guint32 Surface::get_an_unused_color()
+{
+    guint32 color;
+
+    do
+    {
+        if (clr >= 0x1000000)
+            throw std::logic_error("Too many components, no more colors available.");
+
+        // multiplying by an odd number is a bijection of the 24-bit color
+        // space, so every counter value yields a different color, while the
+        // colors of consecutive components are far apart in the debug images
+        color = OPAQUE | ((clr++ * 0x9E3779) & 0xFFFFFF);
+    }
+    while (color == BLACK || color == WHITE || color == RED ||
+           color == GREEN || color == BLUE || color == (RED | BLUE));
+
+    return color;
+}
+
+/******************************************************************************/
+/*
+ try to find white pixels, aka uncolored pixels, and label each 8-connected
+ area of them with a new color (using multiple threads).
+ returns the list of seed points, that is the first pixel of each area, and
+ if requested the runs of each area
+ */
+/******************************************************************************/
+std::vector<std::pair<int, int> > Surface::fill_all_components(vector<run_set>* runs)
+{
+    // both the labelling and the painting scan the rows in order
+    labels->advise(scratch_memory::access_sequential);
+
+    component_labelling labelling(*labels, WHITE, OPAQUE);
+
+    const std::vector<pair<int, int> >& components = labelling.get_seeds();
+
+    // the colors are picked in the same order as a serial scan would do
+    vector<uint32_t> colors;
+    colors.reserve(components.size());
+
+    for (unsigned int i = 0; i < components.size(); i++)
+        colors.push_back(get_an_unused_color());
+
+    labelling.paint(*labels, colors);
+
+    if (runs)
+        labelling.get_runs(*runs);
+
+    labels->advise(scratch_memory::access_normal);
+
+    return components;
+}
+
+#include <algorithm>
+
+/******************************************************************************/
+/*
+ scanline flood fill with 8-connectivity: each popped seed is extended to the
+ whole horizontal run of pixels of the same color, which is filled at once;
+ then only the first pixel of each run touching it (diagonals included) in the
+ rows above and below is queued.
+ */
+/******************************************************************************/
+void Surface::fill_a_component(int x, int y, guint32 argb)
+{
+    const int width = labels->get_width();
+    const int height = labels->get_height();
+
+    const guint32 ownclr = labels->get(x, y);
+
+    if (ownclr == argb)
+        return;
+
+    vector<pair<int, int> > queued_runs;
+    queued_runs.push_back(pair<int, int>(x, y));
+
+    while (!queued_runs.empty())
+    {
+        x = queued_runs.back().first;
+        y = queued_runs.back().second;
+        queued_runs.pop_back();
+
+        // already filled while processing another run
+        if (labels->get(x, y) != ownclr)
+            continue;
+
+        int left = x;
+        int right = x;
+
+        while (left > 0 && labels->get(left - 1, y) == ownclr)
+            left--;
+        while (right < width - 1 && labels->get(right + 1, y) == ownclr)
+            right++;
+
+        labels->fill_span(y, left, right + 1, argb);
+
+        const int first = std::max(left - 1, 0);
+        const int last = std::min(right + 1, width - 1);
+
+        for (int ny = y - 1; ny <= y + 1; ny += 2)
+        {
+            if (ny < 0 || ny >= height)
+                continue;
+
+            for (int nx = first; nx <= last; nx++)
+            {
+                if (labels->get(nx, ny) == ownclr)
+                {
+                    queued_runs.push_back(pair<int, int>(nx, ny));
+
+                    while (nx <= last && labels->get(nx, ny) == ownclr)
+                        nx++;
+                }
+            }
+        }
+    }
+
+}
+
+/******************************************************************************/
+/*
+ starting from a pixel at xy within a "component" aka a blob of
+ same-colored pixels, increase x until it is next to a new color
+ */
+/******************************************************************************/
+void Surface::run_to_border(int& x, int& y)
+{
+    guint32 start_color = labels->get(x, y);
+
+    if (start_color == 0)
+    {
+        labels->set(x, y, RED);
+        save_debug_image("error_runtoborder");
+        std::stringstream msg;
+        msg << "run_to_border: start_color == 0 at (" << x << "," << y << ")\n";
+        throw std::logic_error(msg.str());
+    }
+
+    while (labels->get(x, y) == start_color)
+        x++;
+}
+
+/******************************************************************************/
+/*
+ pixel of another component: not the own color, not black
+ */
+/******************************************************************************/
+struct foreign_pixel
+{
+    const guint32 color;
+
+    foreign_pixel(guint32 color) : color(color)
+    {
+    }
+
+    bool operator()(guint32 pixel) const
+    {
+        return pixel != color && (pixel | OPAQUE) != BLACK;
+    }
+};
+
+/******************************************************************************/
+/*
+ */
+/******************************************************************************/
+struct other_than
+{
+    const guint32 color;
+
+    other_than(guint32 color) : color(color)
+    {
+    }
+
+    bool operator()(guint32 pixel) const
+    {
+        return pixel != color;
+    }
+};
+
+/******************************************************************************/
+/*
+ returns true if free for growing components. Once x, y is known not to be on
+ the image borders, its neighbours are inside the image
+ */
+/******************************************************************************/
+inline bool Surface::allow_grow(int x, int y, guint32 ownclr)
+{
+    if (x <= 0 || y <= 0)
+        return false;
+    if (x >= labels->get_width() - 1)
+        return false;
+    if (y >= labels->get_height() - 1)
+        return false;
+
+    return !neighbour_kernel<8, labelplane>::any(*labels, x, y, foreign_pixel(ownclr));
+}
+
+/******************************************************************************/
+/*
+ traces the pixels just outside of the component containing x,y into outside
+ (which is cleared first). When stray pixels deadlock the tracer they are
+ repaired ("blasted") and the trace is resumed from the last checkpoint that
+ can't have been affected by the repair, instead of starting over.
+ */
+/******************************************************************************/
+bool Surface::calculate_outline(const int x, const int y, tracer_state& state,
+                                bool repair)
+{
+    vector<pair<int, int> >& outside = state.outside;
+    vector<trace_checkpoint>& checkpoints = state.checkpoints;
+
+    int max_x = labels->get_width();
+    int max_y = labels->get_height();
+
+    guint32 owncolor = labels->get(x, y);
+
+    int xstart = x;
+    int ystart = y;
+
+    run_to_border(xstart, ystart); //change xstart so that xstart++ would be outside of the component
+    int xout = xstart;
+    int yout = ystart;
+    int xin = xout - 1;
+    int yin = yout;
+
+    outside.clear();
+    outside.push_back(pair<int, int>(xout, yout));
+    checkpoints.clear();
+
+    while (true)
+    {
+        int i;
+        int steps = 0; // number of steps done in 1 iteration of the while loop
+
+        trace_checkpoint checkpoint = { xin, yin, xout, yout, outside.size() };
+        checkpoints.push_back(checkpoint);
+
+        // step outside: out turns clockwise around in. The neighbours of in
+        // are inside the image unless in is on its borders
+        if (xin <= 0 || yin <= 0 || xin >= max_x - 1 || yin >= max_y - 1)
+        {
+            if (!repair)
+                return false;
+
+            save_debug_image("error_outerpath");
+            std::stringstream msg;
+            msg << "Outside path reaches image margins at " << xin << ","
+                << yin << ")\n";
+            throw std::logic_error(msg.str());
+        }
+
+        int direction = neighbourhood<8>::index(xout - xin, yout - yin);
+
+        for (i = 0; i < 8; i++)
+        {
+            direction = (direction + 1) & 7;
+
+            int xnext = xin + neighbourhood<8>::dx(direction);
+            int ynext = yin + neighbourhood<8>::dy(direction);
+
+            if (xnext == xstart && ynext == ystart)
+            {
+                outside.push_back(pair<int, int>(xout, yout));
+                outside.push_back(pair<int, int>(xstart, ystart));
+                return true;
+            }
+
+            if (labels->get(xnext, ynext) != owncolor)
+            {
+                outside.push_back(pair<int, int>(xout, yout));
+                xout = xnext;
+                yout = ynext;
+            }
+            else
+                break;
+        }
+        if (i == 8)
+        {
+            if (!repair)
+                return false;
+
+            save_debug_image("error_outsideoverstepping");
+            std::stringstream msg;
+            msg << "Outside over-stepping at in(" << xin << "," << yin << ")\n";
+            throw std::logic_error(msg.str());
+        }
+
+        steps += i;
+
+        // step inside: in turns counterclockwise around out. Only an out on
+        // the image borders has neighbours outside of it
+        const bool out_on_border = xout <= 0 || yout <= 0 ||
+                                   xout >= max_x - 1 || yout >= max_y - 1;
+
+        direction = neighbourhood<8>::index(xin - xout, yin - yout);
+
+        for (i = 0; i < 8; i++)
+        {
+            direction = (direction + 7) & 7;
+
+            int xnext = xout + neighbourhood<8>::dx(direction);
+            int ynext = yout + neighbourhood<8>::dy(direction);
+
+            if (out_on_border &&
+                    (xnext < 0 || ynext < 0 || xnext >= max_x || ynext >= max_y))
+            {
+                if (!repair)
+                    return false;
+
+                save_debug_image("error_innerpath");
+                std::stringstream msg;
+                msg << "Inside path reaches image margins at " << xin << ","
+                    << yin << ")\n";
+                throw std::logic_error(msg.str());
+            }
+
+            if (labels->get(xnext, ynext) == owncolor)
+            {
+                xin = xnext;
+                yin = ynext;
+            }
+            else
+                break;
+        }
+        if (i == 8)
+        {
+            if (!repair)
+                return false;
+
+            save_debug_image("error_insideoverstepping");
+            std::stringstream msg;
+            msg << "Inside over-stepping at out(" << xout << "," << yout
+                << ")\n";
+            throw std::logic_error(msg.str());
+        }
+
+        steps += i;
+
+        // check whether we made any progress calculating the trace outline.
+        // if we haven't, our algorithm is deadlocked by stray pixels
+        // we try to resolve this by enforcing the algorithm's constraints
+        // for the components
+        if (steps == 0)
+        {
+            if (!repair)
+                return false;
+
+            int changes = 0;
+            // test constraints for surrounding pixels, enforce if necessary
+            for (i = 0; i < 8; i++)
+            {
+                int cx = xin + neighbourhood<8>::dx(i);
+                int cy = yin + neighbourhood<8>::dy(i);
+                if (allow_grow(cx, cy, owncolor))
+                {
+                    labels->set(cx, cy, owncolor);
+                    changes++;
+                }
+
+                // if a component pixel can't be reached non-diagonally, clear it
+                // even if it was set just now
+                if (!neighbour_kernel<4, labelplane>::any(*labels, cx, cy, other_than(BLACK)))
+                {
+                    labels->set(cx, cy, BLACK);
+                    changes++;
+                }
+            }
+            if (allow_grow(xstart, ystart, owncolor))
+                labels->set(xstart, ystart, owncolor);
+
+            if (changes == 0)
+            {
+                labels->set(xin, yin, labels->get(xin, yin) | RED);
+                labels->set(xout, yout, labels->get(xout, yout) | BLUE);
+                save_debug_image("failed_repair");
+                std::stringstream msg;
+                msg << "Failed repairing @ (" << xin << "," << yin << ")\n";
+                throw std::logic_error(msg.str());
+            }
+            else
+                blasts++;
+
+            // the repair only changed pixels next to xin,yin, so the steps
+            // whose in and out pixels are farther than 3 pixels from it have
+            // examined only unchanged pixels and are still valid
+            unsigned int resume = 0;
+
+            while (resume < checkpoints.size() &&
+                    (std::abs(checkpoints[resume].xin - xin) > 3 ||
+                     std::abs(checkpoints[resume].yin - yin) > 3) &&
+                    (std::abs(checkpoints[resume].xout - xin) > 3 ||
+                     std::abs(checkpoints[resume].yout - yin) > 3))
+                resume++;
+
+            if (resume == 0 || labels->get(xstart, ystart) == owncolor)
+            {
+                // the start itself is affected: start right at the beginning
+                xstart = x;
+                ystart = y;
+                run_to_border(xstart, ystart);
+                xout = xstart;
+                yout = ystart;
+                xin = xout - 1;
+                yin = yout;
+                outside.clear();
+                outside.push_back(pair<int, int>(xout, yout));
+                checkpoints.clear();
+            }
+            else
+            {
+                const trace_checkpoint& previous = checkpoints[resume - 1];
+
+                xin = previous.xin;
+                yin = previous.yin;
+                xout = previous.xout;
+                yout = previous.yout;
+                outside.resize(previous.outside_size);
+                checkpoints.resize(resume - 1);
+            }
+
+            continue;
+        }
+    }
+}
+
+/******************************************************************************/
+/*
+ Field whose positive pixels are the isolation area of a component: it's the
+ radius minus the distance from the copper edges, estimated from the distance
+ of the nearest copper pixel and its anti-aliased coverage. The pixels nearer
+ to other components or claimed by them are slightly negative, so that the
+ contour passes next to them, as the pixel contours do.
+ */
+/******************************************************************************/
+struct isolation_field
+{
+    const labelplane& labels;
+    const distance_transform& edt;
+    const coverageplane* coverage;
+    const guint32 color;
+    const double radius;
+
+    double operator()(int x, int y) const
+    {
+        static const double epsilon = 1.0 / 64;
+        const guint32 label = labels.get(x, y);
+
+        if (edt.get_nearest(x, y) != color ||
+                (label != color && label != labels.get_background()))
+            return -epsilon;
+
+        // a fully covered pixel has its edge half a pixel away from the centre
+        double distance = sqrt(double(edt.get_sqdist(x, y)));
+
+        if (coverage)
+        {
+            int feature_x, feature_y;
+            edt.get_feature(x, y, feature_x, feature_y);
+            distance -= coverage->get(feature_x, feature_y) - 0.5;
+        }
+        else
+            distance -= 0.5;
+
+        return radius - distance;
+    }
+};
+
+/******************************************************************************/
+/*
+ sub-pixel version of calculate_outline(): x, y must be the first copper pixel
+ of the component, and edt must have grown it at least up to radius
+ */
+/******************************************************************************/
+void Surface::calculate_subpixel_outline(int x, int y,
+        const distance_transform& edt, double radius,
+        vector<pair<double, double> >& contour)
+{
+    const isolation_field field = { *labels, edt, coverage.get(),
+                                    labels->get(x, y), radius
+                                  };
+
+    // as in run_to_border(), the pixels above are outside
+    while (field(x, y) > 0)
+        x++;
+
+    marching_squares::trace(field, x, y,
+                            4 * size_t(labels->get_width()) * labels->get_height(),
+                            contour);
+
+    // the field is sampled at the pixel centres
+    for (unsigned int i = 0; i < contour.size(); i++)
+    {
+        contour[i].first += 0.5;
+        contour[i].second += 0.5;
+    }
+}
+
+/******************************************************************************/
+/*
+ */
+/******************************************************************************/
+guint Surface::grow_a_component(int x, int y, int& contentions)
+{
+    if (x < 0 || x >= labels->get_width() || y < 0
+            || y >= labels->get_height())
+    {
+        std::stringstream msg;
+        msg << "grow_a_component(): invalid starting point: (" << x << "," << y
+            << ")";
+        throw std::logic_error(msg.str());
+    }
+
+    contentions = 0;
+
+    const vector<pair<int, int> >& outside = serial_tracer.outside;
+    calculate_outline(x, y, serial_tracer);
+
+    unsigned int pixels_changed = 0;
+
+    guint32 ownclr = labels->get(x, y);
+
+    for (unsigned int i = 0; i < outside.size(); i++)
+    {
+        pair<int, int> coord = outside[i];
+
+        if (allow_grow(coord.first, coord.second, ownclr))
+        {
+            labels->set(coord.first, coord.second, ownclr);
+            pixels_changed++;
+        }
+        else
+        {
+            contentions++;
+        }
+    }
+
+    return pixels_changed;
+}
+
+/******************************************************************************/
+/*
+ appends the runs of free pixels of row (whose first pixel is at column
+ begin) between the columns first and last
+ */
+/******************************************************************************/
+static inline void queue_free_runs(const guint32* row, int y, int begin,
+                                   int first, int last, vector<pixel_run>& runs)
+{
+    for (int x = first; x <= last; x++)
+    {
+        if ((row[x - begin] | OPAQUE) == BLACK)
+        {
+            const pixel_run run = { y, x, x };
+            runs.push_back(run);
+
+            while (x + 1 <= last && (row[x + 1 - begin] | OPAQUE) == BLACK)
+                runs.back().last = ++x;
+        }
+    }
+}
+
+/******************************************************************************/
+/*
+ queues the free pixels above, beside and below a claimed run; rows are the
+ 3 rows around it, from column begin
+ */
+/******************************************************************************/
+static inline void queue_around(const vector<guint32>* rows, int begin,
+                                const pixel_run& claim, vector<pixel_run>* next)
+{
+    queue_free_runs(&rows[0][0], claim.y - 1, begin, claim.first - 1, claim.last + 1, next[0]);
+    queue_free_runs(&rows[1][0], claim.y, begin, claim.first - 1, claim.first - 1, next[1]);
+    queue_free_runs(&rows[1][0], claim.y, begin, claim.last + 1, claim.last + 1, next[1]);
+    queue_free_runs(&rows[2][0], claim.y + 1, begin, claim.first - 1, claim.last + 1, next[2]);
+}
+
+/******************************************************************************/
+/*
+ appends the pixel x, y to runs in raster order
+ */
+/******************************************************************************/
+static inline void append_pixel(vector<pixel_run>& runs, int x, int y)
+{
+    if (!runs.empty() && runs.back().y == y && runs.back().last + 1 == x)
+        runs.back().last = x;
+    else
+    {
+        const pixel_run run = { y, x, x };
+        runs.push_back(run);
+    }
+}
+
+/******************************************************************************/
+/*
+ number of pixels of runs
+ */
+/******************************************************************************/
+static inline unsigned int count_pixels(const vector<pixel_run>& runs)
+{
+    unsigned int pixels = 0;
+
+    BOOST_FOREACH(const pixel_run& run, runs)
+    {
+        pixels += run.last - run.first + 1;
+    }
+
+    return pixels;
+}
+
+/******************************************************************************/
+/*
+ sorts the free candidates of a run in the ones a component can claim and the
+ ones it can't, appending them to claims and rejected. rows[1] gets the row of
+ the run from column max(run.first - 1, 0), rows[0] and rows[2] the ones
+ around it (not read on the first and last rows). A pixel can be claimed when
+ no other component is in the 3 columns around it (same test as
+ allow_grow()); the rows are only read, so the claims of a component don't
+ change the outcome for its other candidates.
+ Only the candidates next to another component are contended and go to
+ rejected: the ones on the border of the image or next to the masked area
+ are just dropped.
+ */
+/******************************************************************************/
+static void classify_candidates(const labelplane& labels, const pixel_run& run,
+                                guint32 color, vector<guint32>* rows,
+                                vector<unsigned char>& foreign,
+                                vector<pixel_run>& claims,
+                                vector<pixel_run>& rejected)
+{
+    const int width = labels.get_width();
+    const int height = labels.get_height();
+    const int y = run.y;
+    const int begin = std::max(run.first - 1, 0);
+    const int end = std::min(run.last + 2, width);
+    const int length = end - begin;
+
+    if (int(foreign.size()) < length)
+    {
+        for (int i = 0; i < 3; i++)
+            rows[i].resize(length);
+
+        foreign.resize(length);
+    }
+
+    labels.get_span(y, begin, end, &rows[1][0]);
+
+    // the free pixels of the first and last rows can't be claimed,
+    // whatever is around
+    if (y == 0 || y == height - 1)
+        return;
+
+    labels.get_span(y - 1, begin, end, &rows[0][0]);
+    labels.get_span(y + 1, begin, end, &rows[2][0]);
+
+    // foreign[i]: 1 if the column is blocked, 2 if it's blocked by another
+    // component rather than by the masked area
+    for (int i = 0; i < length; i++)
+    {
+        foreign[i] = 0;
+
+        for (int j = 0; j < 3; j++)
+        {
+            // not own color, not black -> other component!
+            if (rows[j][i] != color && (rows[j][i] | OPAQUE) != BLACK)
+                foreign[i] |= rows[j][i] == (RED | BLUE) ? 1 : 3;
+        }
+    }
+
+    for (int x = run.first; x <= run.last; x++)
+    {
+        if ((rows[1][x - begin] | OPAQUE) == BLACK)
+        {
+            if (x == 0 || x == width - 1)
+                continue;
+
+            const int blocked = foreign[x - 1 - begin] | foreign[x - begin] |
+                                foreign[x + 1 - begin];
+
+            if (!blocked)
+                append_pixel(claims, x, y);
+            else if (blocked & 2)
+                append_pixel(rejected, x, y);
+        }
+    }
+}
+
+/******************************************************************************/
+/*
+ adds one ring of pixels to a component, trying only the candidates around
+ the pixels added by the previous ring; the free pixels around the new ring
+ become the next candidates. A rejected candidate stays rejected, as the other
+ components never shrink.
+ The candidates are tested a run at a time, and the rows read for the test
+ also give the free pixels around the claims.
+ */
+/******************************************************************************/
+unsigned int Surface::grow_frontier(frontier& component, int& contentions)
+{
+    const guint32 color = component.color;
+
+    vector<guint32>* rows = growth_rows;
+    vector<pixel_run>& claims = growth_claims;
+    vector<pixel_run>& rejected = growth_rejected;
+    // the next candidates above, beside and below the claimed runs, each
+    // list in raster order
+    vector<pixel_run>* next = growth_next;
+    unsigned int pixels_changed = 0;
+
+    for (int i = 0; i < 3; i++)
+        next[i].clear();
+
+    BOOST_FOREACH(const pixel_run& run, component.candidates.get_runs())
+    {
+        const int begin = std::max(run.first - 1, 0);
+
+        claims.clear();
+        rejected.clear();
+        classify_candidates(*labels, run, color, rows, growth_foreign, claims, rejected);
+
+        contentions += count_pixels(rejected);
+
+        BOOST_FOREACH(const pixel_run& claim, claims)
+        {
+            labels->fill_span(claim.y, claim.first, claim.last + 1, color);
+            pixels_changed += claim.last - claim.first + 1;
+
+            queue_around(rows, begin, claim, next);
+        }
+    }
+
+    component.candidates.assign(next, 3);
+
+    return pixels_changed;
+}
+
+/******************************************************************************/
+/*
+ tentative claims of the concurrent growth: the index of the component plus
+ one, without the alpha of the colors
+ */
+/******************************************************************************/
+static inline guint32 ring_tag(int component)
+{
+    return component + 1;
+}
+
+static inline bool is_ring_tag(guint32 pixel)
+{
+    return (pixel & OPAQUE) == 0 && pixel != 0;
+}
+
+// owner of a tile of the labels claimed by more components
+static const guint32 shared_tile = 0xFFFFFFFF;
+
+/******************************************************************************/
+/*
+ grows all the components by one ring, with the same result as calling
+ grow_frontier() on each of them in order.
+ With more threads, the components grow concurrently:
+ - each component sorts its candidates by looking at the labels as they were
+   at the beginning of the ring, and queues the free pixels around its claims
+   as the next candidates (propose_rings). Each tile of the labels records
+   which component claims pixels in it or next to it, if only one does;
+ - in the tiles shared by more components, the tentative claims are tagged in
+   the labels with compare-and-swap, the lower component winning a pixel
+   wanted by more of them (tag_rings);
+ - a claim with no tag of a lower component around it can't be affected by
+   the components before it, so it's final (check_rings, commit_rings);
+ - the others are resolved serially in the order of the components, exactly
+   as the serial growth would do. They're rare: only where two components
+   race for the same gap.
+ The next candidates can include pixels claimed later in the ring, by the
+ component itself or by the ones after it; the next ring skips them, as the
+ serial growth does. They're queued again only for the components that lost
+ contested claims (queue_rings).
+ */
+/******************************************************************************/
+unsigned int Surface::grow_frontiers(vector<frontier>& active, int& contentions)
+{
+    unsigned int pixels_changed = 0;
+
+    if (parallel::threads() <= 1 || active.size() <= 1)
+    {
+        for (unsigned int j = 0; j < active.size(); j++)
+            pixels_changed += grow_frontier(active[j], contentions);
+
+        return pixels_changed;
+    }
+
+    vector<ring_proposal>& proposals = growth_proposals;
+    proposals.resize(active.size());
+
+    growth_tiles_per_row = (labels->get_width() + labelplane::tile_size - 1) >>
+                           labelplane::tile_shift;
+    growth_tile_owners.assign(growth_tiles_per_row *
+                              ((labels->get_height() + labelplane::tile_size - 1) >>
+                               labelplane::tile_shift), 0);
+
+    parallel::for_batches(active.size(), boost::bind(&Surface::propose_rings, this,
+                          &active, &proposals, _1, _2));
+
+    // the tiles written by more components must exist before the concurrent
+    // writes; the others are allocated by their only writer
+    for (unsigned int j = 0; j < active.size(); j++)
+    {
+        BOOST_FOREACH(const pixel_run& claim, proposals[j].claims)
+        {
+            if (!owns_tiles(claim, ring_tag(j)))
+                labels->allocate_span(claim.y, claim.first, claim.last + 1);
+        }
+    }
+
+    parallel::for_batches(active.size(), boost::bind(&Surface::tag_rings, this,
+                          &proposals, _1, _2));
+    parallel::for_batches(active.size(), boost::bind(&Surface::check_rings, this,
+                          &proposals, _1, _2));
+    parallel::for_batches(active.size(), boost::bind(&Surface::commit_rings, this,
+                          &active, &proposals, _1, _2));
+
+    // the contested claims: the lower components are final by now, and the
+    // tags left belong to the current component or to the ones after it,
+    // which don't count yet
+    for (unsigned int j = 0; j < active.size(); j++)
+    {
+        const guint32 color = active[j].color;
+        ring_proposal& proposal = proposals[j];
+
+        pixels_changed += count_pixels(proposal.claims);
+
+        BOOST_FOREACH(const pixel_run& run, proposal.contested)
+        {
+            for (int x = run.first; x <= run.last; x++)
+            {
+                const guint32 pixel = labels->get(x, run.y);
+                bool foreign = false;
+
+                // claimed by a lower component
+                if (pixel != ring_tag(j) && (pixel | OPAQUE) != BLACK)
+                {
+                    proposal.requeue = true;
+                    continue;
+                }
+
+                for (int dy = -1; dy <= 1; dy++)
+                    for (int dx = -1; dx <= 1; dx++)
+                    {
+                        const guint32 around = labels->get(x + dx, run.y + dy);
+
+                        if (around != color && (around | OPAQUE) != BLACK &&
+                                !is_ring_tag(around))
+                            foreign = true;
+                    }
+
+                if (foreign)
+                {
+                    labels->set(x, run.y, BLACK);
+                    contentions++;
+                    proposal.requeue = true;
+                }
+                else
+                {
+                    labels->set(x, run.y, color);
+                    append_pixel(proposal.resolved, x, run.y);
+                    pixels_changed++;
+                }
+            }
+        }
+    }
+
+    // a candidate rejected at the beginning of the ring isn't a contention
+    // if a lower component has claimed it in the meantime
+    std::map<guint32, unsigned int> component_index;
+
+    for (unsigned int j = 0; j < active.size(); j++)
+    {
+        BOOST_FOREACH(const pixel_run& run, proposals[j].rejected)
+        {
+            for (int x = run.first; x <= run.last; x++)
+            {
+                const guint32 pixel = labels->get(x, run.y);
+
+                if ((pixel | OPAQUE) != BLACK)
+                {
+                    if (component_index.empty())
+                        for (unsigned int i = 0; i < active.size(); i++)
+                            component_index[active[i].color] = i;
+
+                    if (component_index.find(pixel)->second < j)
+                        continue;
+                }
+
+                contentions++;
+            }
+        }
+    }
+
+    parallel::for_batches(active.size(), boost::bind(&Surface::queue_rings, this,
+                          &active, &proposals, _1, _2));
+
+    return pixels_changed;
+}
+
+/******************************************************************************/
+/*
+ records the component (tag) as owner of the tiles of the pixels around a
+ claim, or the tiles as shared if another one is there
+ */
+/******************************************************************************/
+void Surface::own_tiles(const pixel_run& claim, guint32 tag)
+{
+    const int shift = labelplane::tile_shift;
+
+    for (int ty = (claim.y - 1) >> shift; ty <= (claim.y + 1) >> shift; ty++)
+        for (int tx = (claim.first - 1) >> shift; tx <= (claim.last + 1) >> shift; tx++)
+        {
+            guint32* owner = &growth_tile_owners[ty * growth_tiles_per_row + tx];
+
+            while (true)
+            {
+                const guint32 current = *owner;
+
+                if (current == tag || current == shared_tile)
+                    break;
+                if (__sync_bool_compare_and_swap(owner, current,
+                                                 current == 0 ? tag : shared_tile))
+                    break;
+            }
+        }
+}
+
+/******************************************************************************/
+/*
+ true if no other component claims pixels in the tiles of a claim or next to
+ them: its pixels can't be contested
+ */
+/******************************************************************************/
+bool Surface::owns_tiles(const pixel_run& claim, guint32 tag) const
+{
+    const int shift = labelplane::tile_shift;
+    const int ty = claim.y >> shift;
+
+    for (int tx = claim.first >> shift; tx <= claim.last >> shift; tx++)
+        if (growth_tile_owners[ty * growth_tiles_per_row + tx] != tag)
+            return false;
 
-    while (PRC(pixels + x*4 + y*stride) == start_color)
-        x++;
+    return true;
 }
 
-int offset8[8][2] = { { 1, 0 }, { 1, 1 }, { 0, 1 }, { -1, 1 }, { -1, 0 }, {
-        -1,
-        -1
-    }, { 0, -1 }, { 1, -1 }
-};
-int offset4[4][2] = { { 1, 0 }, { 0, 1 }, { -1, 0 }, { 0, -1 } };
-
 /******************************************************************************/
 /*
- returns true if free for growing components
  */
 /******************************************************************************/
-inline bool Surface::allow_grow(int x, int y, guint32 ownclr)
+void Surface::propose_rings(const vector<frontier>* active,
+                            vector<ring_proposal>* proposals, int begin, int end)
 {
-    if (x <= 0 || y <= 0)
-        return false;
-    if (x >= cairo_surface->get_width() - 1)
-        return false;
-    if (y >= cairo_surface->get_height() - 1)
-        return false;
-
-    guint8* pixels = cairo_surface->get_data();
-    int stride = cairo_surface->get_stride();
+    vector<guint32> rows[3];
+    vector<unsigned char> foreign;
 
-    for (int i = 7; i >= 0; i--)
+    for (int j = begin; j < end; j++)
     {
-        int cx = x + offset8[i][0];
-        int cy = y + offset8[i][1];
+        ring_proposal& proposal = (*proposals)[j];
 
-        guint8* pixel = pixels + cx * 4 + cy * stride;
+        proposal.claims.clear();
+        proposal.rejected.clear();
+        proposal.contested.clear();
+        proposal.resolved.clear();
+        proposal.requeue = false;
 
-        // surrounding pixel != own color, not black -> other component!
-        if (PRC(pixel) != ownclr && (PRC(pixel) | OPAQUE) != BLACK)
-            return false;
-    }
+        for (int i = 0; i < 3; i++)
+            proposal.next[i].clear();
 
-    return true;
-}
+        BOOST_FOREACH(const pixel_run& run, (*active)[j].candidates.get_runs())
+        {
+            const unsigned int first_claim = proposal.claims.size();
 
-int growoff_o[3][3][2] = { { { 0, -1 }, { -1, -1 }, { -1, 0 } }, { { 1, -1 }, {
-            0, 0
-        }, { -1, 1 }
-    }, { { 1, 0 }, { 1, 1 }, { 0, 1 } }
-};
+            classify_candidates(*labels, run, (*active)[j].color, rows, foreign,
+                                proposal.claims, proposal.rejected);
 
-int growoff_i[3][3][2] = { { { -1, 0 }, { -1, 1 }, { 0, 1 } }, { { -1, -1 }, {
-            0, 0
-        }, { 1, 1 }
-    }, { { 0, -1 }, { 1, -1 }, { 1, 0 } }
-};
+            for (unsigned int i = first_claim; i < proposal.claims.size(); i++)
+            {
+                queue_around(rows, std::max(run.first - 1, 0), proposal.claims[i],
+                             proposal.next);
+                own_tiles(proposal.claims[i], ring_tag(j));
+            }
+        }
+    }
+}
 
 /******************************************************************************/
 /*
+ a free pixel takes the tag; a tag of a higher component is replaced
  */
 /******************************************************************************/
-void Surface::calculate_outline(const int x, const int y,
-                                vector<pair<int, int> >& outside, vector<pair<int, int> >& inside)
+void Surface::tag_rings(vector<ring_proposal>* proposals, int begin, int end)
 {
-    guint8* pixels = cairo_surface->get_data();
-    int stride = cairo_surface->get_stride();
-    int max_y = cairo_surface->get_height();
-
-    guint32 owncolor = PRC(pixels + x*4 + y*stride);
+    for (int j = begin; j < end; j++)
+    {
+        const guint32 tag = ring_tag(j);
 
-    int xstart = x;
-    int ystart = y;
+        BOOST_FOREACH(const pixel_run& run, (*proposals)[j].claims)
+        {
+            if (owns_tiles(run, tag))
+                continue;
 
-    run_to_border(xstart, ystart); //change xstart so that xstart++ would be outside of the component
-    int xout = xstart;
-    int yout = ystart;
-    int xin = xout - 1;
-    int yin = yout;
+            for (int x = run.first; x <= run.last; x++)
+            {
+                while (true)
+                {
+                    const guint32 pixel = labels->get(x, run.y);
 
-    outside.push_back(pair<int, int>(xout, yout));
+                    if ((pixel | OPAQUE) != BLACK && !(is_ring_tag(pixel) && pixel > tag))
+                        break;
+                    if (labels->compare_and_swap(x, run.y, pixel, tag))
+                        break;
+                }
+            }
+        }
+    }
+}
 
-    int blasts = 0;
+/******************************************************************************/
+/*
+ keeps in claims the tentative claims with no tag of a lower component in the
+ 3x3 pixels around them (including themselves), the others are contested
+ */
+/******************************************************************************/
+void Surface::check_rings(vector<ring_proposal>* proposals, int begin, int end)
+{
+    vector<guint32> rows[3];
+    vector<pixel_run> uncontested;
 
-    while (true)
+    for (int j = begin; j < end; j++)
     {
-        int i;
-        int steps = 0; // number of steps done in 1 iteration of the while loop
+        ring_proposal& proposal = (*proposals)[j];
+        const guint32 tag = ring_tag(j);
 
-        // step outside
-        for (i = 0; i < 8; i++)
-        {
-            int xoff = xout - xin + 1;
-            int yoff = yout - yin + 1;
-            int xnext = xin + growoff_o[xoff][yoff][0];
-            int ynext = yin + growoff_o[xoff][yoff][1];
+        uncontested.clear();
 
-            if (xnext == xstart && ynext == ystart)
+        BOOST_FOREACH(const pixel_run& run, proposal.claims)
+        {
+            if (owns_tiles(run, tag))
             {
-                outside.push_back(pair<int, int>(xout, yout));
-                outside.push_back(pair<int, int>(xstart, ystart));
-                return;
+                uncontested.push_back(run);
+                continue;
             }
 
-            if (xnext < 0 || ynext < 0 || xnext > stride || ynext > max_y)
+            // the claims are never on the image borders
+            const int first = run.first - 1;
+            const int length = run.last - run.first + 3;
+
+            for (int i = 0; i < 3; i++)
             {
-                save_debug_image("error_outerpath");
-                std::stringstream msg;
-                msg << "Outside path reaches image margins at " << xin << ","
-                    << yin << ")\n";
-                throw std::logic_error(msg.str());
-            }
+                if (int(rows[i].size()) < length)
+                    rows[i].resize(length);
 
-            guint8* next = pixels + xnext * 4 + ynext * stride;
+                labels->get_span(run.y - 1 + i, first, first + length, &rows[i][0]);
+            }
 
-            if (PRC(next) != owncolor)
+            for (int x = run.first; x <= run.last; x++)
             {
-                outside.push_back(pair<int, int>(xout, yout));
-                xout = xnext;
-                yout = ynext;
+                bool contested = rows[1][x - first] != tag;
+
+                for (int i = 0; i < 3; i++)
+                    for (int dx = -1; dx <= 1; dx++)
+                    {
+                        const guint32 pixel = rows[i][x + dx - first];
+
+                        if (is_ring_tag(pixel) && pixel < tag)
+                            contested = true;
+                    }
+
+                append_pixel(contested ? proposal.contested : uncontested, x, run.y);
             }
-            else
-                break;
         }
-        if (i == 8)
+
+        proposal.claims.swap(uncontested);
+    }
+}
+
+/******************************************************************************/
+/*
+ */
+/******************************************************************************/
+void Surface::commit_rings(const vector<frontier>* active,
+                           const vector<ring_proposal>* proposals, int begin, int end)
+{
+    for (int j = begin; j < end; j++)
+    {
+        BOOST_FOREACH(const pixel_run& run, (*proposals)[j].claims)
         {
-            save_debug_image("error_outsideoverstepping");
-            std::stringstream msg;
-            msg << "Outside over-stepping at in(" << xin << "," << yin << ")\n";
-            throw std::logic_error(msg.str());
+            labels->fill_span(run.y, run.first, run.last + 1, (*active)[j].color);
         }
+    }
+}
 
-        steps += i;
+/******************************************************************************/
+/*
+ the next candidates queued by propose_rings(), or the free pixels around
+ the final claims if some tentative ones were lost
+ */
+/******************************************************************************/
+void Surface::queue_rings(vector<frontier>* active,
+                          const vector<ring_proposal>* proposals, int begin, int end)
+{
+    vector<guint32> rows[3];
+    vector<pixel_run> next[3];
+    run_set claims;
 
-        // step inside
-        for (i = 0; i < 8; i++)
-        {
-            int xoff = xin - xout + 1;
-            int yoff = yin - yout + 1;
-            int xnext = xout + growoff_i[xoff][yoff][0];
-            int ynext = yout + growoff_i[xoff][yoff][1];
-            // next pixel  is checked clockwise
-            guint8* next = pixels + xnext * 4 + ynext * stride;
-            if (xnext < 0 || ynext < 0 || xnext > stride || ynext > max_y)
-            {
-                save_debug_image("error_innerpath");
-                std::stringstream msg;
-                msg << "Inside path reaches image margins at " << xin << ","
-                    << yin << ")\n";
-                throw std::logic_error(msg.str());
-            }
+    for (int j = begin; j < end; j++)
+    {
+        const ring_proposal& proposal = (*proposals)[j];
 
-            if (PRC(next) == owncolor)
-            {
-                inside.push_back(pair<int, int>(xin, yin));
-                xin = xnext;
-                yin = ynext;
-            }
-            else
-                break;
-        }
-        if (i == 8)
+        if (!proposal.requeue)
         {
-            save_debug_image("error_insideoverstepping");
-            std::stringstream msg;
-            msg << "Inside over-stepping at out(" << xout << "," << yout
-                << ")\n";
-            throw std::logic_error(msg.str());
+            (*active)[j].candidates.assign(proposal.next, 3);
+            continue;
         }
 
-        steps += i;
+        const vector<pixel_run> lists[2] = { proposal.claims, proposal.resolved };
 
-        // check whether we made any progress calculating the trace outline.
-        // if we haven't, our algorithm is deadlocked by stray pixels
-        // we try to resolve this by enforcing the algorithm's constraints
-        // for the components
-        if (steps == 0)
-        {
-            int changes = 0;
-            // test constraints for surrounding pixels, enforce if necessary
-            for (i = 0; i < 8; i++)
-            {
-                int cx = xin + offset8[i][0];
-                int cy = yin + offset8[i][1];
-                guint8* pixel = pixels + cx * 4 + cy * stride;
+        claims.assign(lists, 2);
 
-                if (allow_grow(cx, cy, owncolor))
-                {
-                    PRC(pixel) = owncolor;
-                    changes++;
-                }
+        for (int i = 0; i < 3; i++)
+            next[i].clear();
 
-                // if a component pixel can't be reached non-diagonally, clear it
-                // even if it was set just now
-                int j;
-                for (j = 0; j < 4; j++)
-                {
-                    if (PRC( pixels + (cx + offset4[j][0]) * 4
-                             + (cy + offset4[j][1]) * stride ) != BLACK)
-                        break;
-                }
-                if (j == 4)
-                {
-                    PRC(pixel) = BLACK;
-                    changes++;
-                }
-            }
-            if (allow_grow(xstart, ystart, owncolor))
-                PRC(pixels+xstart*4+ystart*stride) = owncolor;
+        BOOST_FOREACH(const pixel_run& run, claims.get_runs())
+        {
+            const int first = run.first - 1;
+            const int length = run.last - run.first + 3;
 
-            if (changes == 0)
+            for (int i = 0; i < 3; i++)
             {
-                PRC(pixels + xin*4 + yin*stride) |= RED;
-                PRC(pixels + xout*4 + yout*stride) |= BLUE;
-                save_debug_image("failed_repair");
-                std::stringstream msg;
-                msg << "Failed repairing @ (" << xin << "," << yin << ")\n";
-                throw std::logic_error(msg.str());
+                if (int(rows[i].size()) < length)
+                    rows[i].resize(length);
+
+                labels->get_span(run.y - 1 + i, first, first + length, &rows[i][0]);
             }
-            else
-                blasts++;
 
-            // start right at the beginning. still more efficient than keeping
-            // the history necessary to be able to continue next to the problem.
-            inside.clear();
-            outside.clear();
-            xstart = x;
-            ystart = y;
-            run_to_border(xstart, ystart);
-            xout = xstart;
-            yout = ystart;
-            xin = xout - 1;
-            yin = yout;
-            outside.push_back(pair<int, int>(xout, yout));
-            continue;
+            queue_around(rows, first, run, next);
         }
+
+        (*active)[j].candidates.assign(next, 3);
     }
+}
 
-    fprintf(stderr, "blasts: %d", blasts);
+/******************************************************************************/
+/*
+ */
+/******************************************************************************/
+void Surface::set_mask_area(const imulti_polygon& area)
+{
+    mask_area = shared_ptr<imulti_polygon>(new imulti_polygon(area));
 }
 
 /******************************************************************************/
 /*
  */
 /******************************************************************************/
-guint Surface::grow_a_component(int x, int y, int& contentions)
+void Surface::add_mask(shared_ptr<Surface> mask_surface)
 {
-    if (x < 0 || x >= cairo_surface->get_width() || y < 0
-            || y >= cairo_surface->get_height())
+    /* remember the outside, it will be tinted in an own color to block extension */
+    if (!blocked)
+        blocked = shared_ptr<bitplane>(new bitplane(copper->get_width(),
+                                                    copper->get_height()));
+
+    if (same_window(*mask_surface))
     {
-        std::stringstream msg;
-        msg << "grow_a_component(): invalid starting point: (" << x << "," << y
-            << ")";
-        throw std::logic_error(msg.str());
+        /* engrave only on the surface area */
+        copper->and_with(*mask_surface->copper);
+        blocked->or_not_with(*mask_surface->copper);
     }
+    else
+        parallel::for_chunks(copper->get_height(), boost::bind(&Surface::mask_window_rows,
+                             this, mask_surface.get(), _1, _2));
+}
 
-    contentions = 0;
+/******************************************************************************/
+/*
+ add_mask() on all the surfaces at once: every row of the mask is read once
+ and applied to all the surfaces covering the same window of the board while
+ it's in cache; the other ones are masked on their own
+ */
+/******************************************************************************/
+void Surface::add_mask(const vector<shared_ptr<Surface> >& surfaces,
+                       shared_ptr<Surface> mask_surface)
+{
+    const bitplane& mask = *mask_surface->copper;
+    vector<shared_ptr<Surface> > aligned;
 
-    vector<pair<int, int> > outside, inside;
-    calculate_outline(x, y, outside, inside);
+    BOOST_FOREACH(const shared_ptr<Surface>& surface, surfaces)
+    {
+        if (!surface->blocked)
+            surface->blocked = shared_ptr<bitplane>(new bitplane(surface->copper->get_width(),
+                                                                 surface->copper->get_height()));
 
-    guint8* pixels = cairo_surface->get_data();
-    int stride = cairo_surface->get_stride();
+        if (surface->same_window(*mask_surface))
+            aligned.push_back(surface);
+        else
+            parallel::for_chunks(surface->copper->get_height(),
+                                 boost::bind(&Surface::mask_window_rows, surface.get(),
+                                             mask_surface.get(), _1, _2));
+    }
 
-    unsigned int pixels_changed = 0;
+    if (!aligned.empty())
+        parallel::for_chunks(mask.get_height(),
+                             boost::bind(&Surface::mask_rows, &aligned, &mask, _1, _2));
+}
 
-    guint32 ownclr = PRC(pixels + x*4 + y*stride);
+/******************************************************************************/
+/*
+ */
+/******************************************************************************/
+void Surface::mask_rows(const vector<shared_ptr<Surface> >* surfaces,
+                        const bitplane* mask, int begin, int end)
+{
+    const int words = mask->get_words_per_row();
+    const uint32_t last_word = mask->last_word_mask();
 
-    for (unsigned int i = 0; i < outside.size(); i++)
+    for (int y = begin; y < end; y++)
     {
-        pair<int, int> coord = outside[i];
+        const uint32_t* mask_row = mask->get_row(y);
 
-        if (allow_grow(coord.first, coord.second, ownclr))
-        {
-            PRC(pixels + coord.first*4 + coord.second*stride) = ownclr;
-            pixels_changed++;
-        }
-        else
+        BOOST_FOREACH(const shared_ptr<Surface>& surface, *surfaces)
         {
-            contentions++;
+            uint32_t* blocked_row = surface->blocked->get_row(y);
+
+            row_kernels::and_words(surface->copper->get_row(y), mask_row, words);
+            row_kernels::or_not_words(blocked_row, mask_row, words);
+            blocked_row[words - 1] &= last_word;
         }
     }
-
-    return pixels_changed;
 }
 
 /******************************************************************************/
 /*
+ the rows of the mask are shifted to the window of this surface; what the
+ mask image doesn't cover is outside of the board
  */
 /******************************************************************************/
-void Surface::add_mask(shared_ptr<Surface> mask_surface)
+void Surface::mask_window_rows(const Surface* mask_surface, int begin, int end)
 {
-    Cairo::RefPtr<Cairo::ImageSurface> mask_cairo_surface =
-        mask_surface->cairo_surface;
+    const bitplane& mask = *mask_surface->copper;
+    const int words = copper->get_words_per_row();
+    const uint32_t last_word = copper->last_word_mask();
+    const int shift_x = offset_x - mask_surface->offset_x;
+    const int shift_y = offset_y - mask_surface->offset_y;
 
-    int max_x = cairo_surface->get_width();
-    int max_y = cairo_surface->get_height();
-    int stride = cairo_surface->get_stride();
+    vector<uint32_t> mask_row(words);
 
-    if (max_x != mask_cairo_surface->get_width()
-            || max_y != mask_cairo_surface->get_height()
-            || stride != mask_cairo_surface->get_stride())
+    for (int y = begin; y < end; y++)
     {
-        throw std::logic_error("Surface shapes don't match.");
-    }
+        const int mask_y = y + shift_y;
 
-    guint8* pixels = cairo_surface->get_data();
-    guint8* mask_pixels = mask_cairo_surface->get_data();
+        if (mask_y < 0 || mask_y >= mask.get_height())
+            std::fill(mask_row.begin(), mask_row.end(), 0);
+        else
+            row_kernels::shift_bits(mask.get_row(mask_y), mask.get_width(), shift_x,
+                                    &mask_row[0], copper->get_width());
 
-    for (int y = 0; y < max_y; y++)
-    {
-        for (int x = 0; x < max_x; x++)
-        {
-            PRC(pixels + x*4 + y*stride) &=
-                PRC(mask_pixels + x*4 + y*stride); /* engrave only on the surface area */
-            PRC(pixels + x*4 + y*stride) |=
-                (~PRC(mask_pixels + x*4 + y*stride) & (RED | BLUE)); /* tint the outiside in an own color to block extension */
-        }
+        uint32_t* blocked_row = blocked->get_row(y);
+
+        row_kernels::and_words(copper->get_row(y), &mask_row[0], words);
+        row_kernels::or_not_words(blocked_row, &mask_row[0], words);
+        blocked_row[words - 1] &= last_word;
     }
 }
 
@@ -658,34 +2347,42 @@ void Surface::add_mask(shared_ptr<Surface> mask_surface)
 
 /******************************************************************************/
 /*
+ the ARGB image is only built here: the labels are saved as they are, while
+ outside of the toolpath computation the bitplanes are drawn with the same
+ colors the labelling starts from
  */
 /******************************************************************************/
 void Surface::save_debug_image(string message)
 {
     static unsigned int debug_image_index = 0;
 
-    opacify(pixbuf);
-    pixbuf->save( build_filename(outputdir,
-                                 (boost::format("outp%1%_%2%.png") % debug_image_index % message).str() ),
-                  "png");
-    debug_image_index++;
-}
+    const int width = copper->get_width();
+    const int height = copper->get_height();
 
-/******************************************************************************/
-/*
- */
-/******************************************************************************/
-void Surface::opacify(Glib::RefPtr<Gdk::Pixbuf> pixbuf)
-{
+    Glib::RefPtr<Gdk::Pixbuf> pixbuf = Gdk::Pixbuf::create(Gdk::COLORSPACE_RGB,
+                                       true, 8, width, height);
     int stride = pixbuf->get_rowstride();
     guint8* pixels = pixbuf->get_pixels();
-    for (int y = 0; y < pixbuf->get_height(); y++)
+
+    for (int y = 0; y < height; y++)
     {
-        for (int x = 0; x < pixbuf->get_width(); x++)
+        for (int x = 0; x < width; x++)
         {
-            PRC(pixels + x*4 + y*stride) |= OPAQUE;
+            if (labels)
+                PRC(pixels + x*4 + y*stride) = labels->get(x, y) | OPAQUE;
+            else if (copper->get(x, y))
+                PRC(pixels + x*4 + y*stride) = WHITE;
+            else if (blocked && blocked->get(x, y))
+                PRC(pixels + x*4 + y*stride) = RED | BLUE;
+            else
+                PRC(pixels + x*4 + y*stride) = BLACK;
         }
     }
+
+    pixbuf->save( build_filename(outputdir,
+                                 (boost::format("outp%1%_%2%.png") % debug_image_index % message).str() ),
+                  "png");
+    debug_image_index++;
 }
 
 /******************************************************************************/
@@ -696,45 +2393,45 @@ void Surface::fill_outline(double linewidth)
 {
     /* paint everything white that can not be reached from outside the image */
 
-    int stride = pixbuf->get_rowstride();
-    guint8* pixels = pixbuf->get_pixels();
+    make_the_labels();
 
     /* in order to find out what is "outside", we need to walk "around' the image */
-    for (int x = 0; x < pixbuf->get_width(); x++)
+    for (int x = 0; x < labels->get_width(); x++)
     {
-        if (PRC(pixels + x*4 + 0*stride) != BLACK)
+        if (labels->get(x, 0) != BLACK)
             throw std::logic_error("Non-black pixel at top border");
-        if (PRC(pixels + x*4 + (pixbuf->get_height() - 1)*stride) != BLACK)
+        if (labels->get(x, labels->get_height() - 1) != BLACK)
             throw std::logic_error("Non-black pixel at bottom border");
     }
-    for (int y = 0; y < pixbuf->get_height(); y++)
+    for (int y = 0; y < labels->get_height(); y++)
     {
-        if (PRC(pixels + 0*4 + y*stride) != BLACK)
+        if (labels->get(0, y) != BLACK)
             throw std::logic_error("Non-black pixel at left border");
-        if (PRC(pixels + (pixbuf->get_width() - 1)*4 + y*stride) != BLACK)
+        if (labels->get(labels->get_width() - 1, y) != BLACK)
             throw std::logic_error("Non-black pixel at right border");
     }
 
     fill_a_component(0, 0, BLUE);
 
+    // the anti-aliased rendering doesn't match the filled outline
+    coverage.reset();
+
     /* everything else (that is, the area of the board) will be black
      *
      * saving the line where black starts for later when we need something
      * black so grow's run_to_border can work.
      */
+    vector<unsigned char> rows_with_black(labels->get_height(), 0);
+    parallel::for_chunks(labels->get_height(),
+                         boost::bind(&Surface::blacken_rows, this, &rows_with_black, _1, _2));
+
     int first_line_with_black = 0;
-    for (int y = 0; y < pixbuf->get_height(); y++)
+    for (int y = 0; y < labels->get_height(); y++)
     {
-        for (int x = 0; x < pixbuf->get_width(); x++)
+        if (rows_with_black[y])
         {
-            if (PRC(pixels + x*4 + y*stride) != BLUE)
-            {
-                PRC(pixels + x*4 + y*stride) = BLACK;
-                if (first_line_with_black == 0)
-                {
-                    first_line_with_black = y;
-                }
-            }
+            first_line_with_black = y;
+            break;
         }
     }
 
@@ -766,18 +2463,50 @@ void Surface::fill_outline(double linewidth)
         throw std::logic_error(
             "Shrinking the outline collided with something while there should not be anything.");
 
-    for (int y = 0; y < pixbuf->get_height(); y++)
+    parallel::for_chunks(labels->get_height(),
+                         boost::bind(&Surface::board_area_rows, this, _1, _2));
+
+    labels.reset();
+    save_debug_image("outline_filled");
+}
+
+/******************************************************************************/
+/*
+ paints BLACK the pixels that aren't BLUE. BLACK is the background of the
+ labels, so no tile gets allocated and the rows can be split arbitrarily
+ */
+/******************************************************************************/
+void Surface::blacken_rows(vector<unsigned char>* rows_with_black, int begin, int end)
+{
+    const int width = labels->get_width();
+    vector<guint32> pixels(width);
+    vector<uint32_t> bits(copper->get_words_per_row());
+
+    for (int y = begin; y < end; y++)
     {
-        for (int x = 0; x < pixbuf->get_width(); x++)
-        {
-            if (PRC(pixels + x*4 + y*stride) == BLUE)
-                PRC(pixels + x*4 + y*stride) = BLACK;
-            else
-                PRC(pixels + x*4 + y*stride) = WHITE;
-        }
+        labels->get_span(y, 0, width, &pixels[0]);
+        row_kernels::not_equal_bits(&pixels[0], width, BLUE, &bits[0]);
+
+        (*rows_with_black)[y] = std::count(bits.begin(), bits.end(), 0u) != int(bits.size());
+        fill_runs(*labels, y, &bits[0], BLACK);
     }
+}
 
-    save_debug_image("outline_filled");
+/******************************************************************************/
+/*
+ the copper of the filled outline is everything but the BLUE outside
+ */
+/******************************************************************************/
+void Surface::board_area_rows(int begin, int end)
+{
+    const int width = labels->get_width();
+    vector<guint32> pixels(width);
+
+    for (int y = begin; y < end; y++)
+    {
+        labels->get_span(y, 0, width, &pixels[0]);
+        row_kernels::not_equal_bits(&pixels[0], width, BLUE, copper->get_row(y));
+    }
 }
 
 /******************************************************************************/
@@ -39,11 +39,19 @@ using Glib::ustring;
 #include "coord.hpp"
 #include "mill.hpp"
 #include "gerberimporter.hpp"
+#include "raster.hpp"
+#include "distance_transform.hpp"
+#include "run_set.hpp"
 
 struct surface_exception: virtual std::exception, virtual boost::exception
 {
 };
 
+// the layer doesn't fit in the memory budget
+struct memory_exception: virtual surface_exception
+{
+};
+
 /******************************************************************************/
 /*
  */
@@ -53,13 +61,31 @@ class Surface: virtual public boost::noncopyable
 public:
     Surface(guint dpi, ivalue_t min_x, ivalue_t max_x, ivalue_t min_y,
             ivalue_t max_y, string outputdir);
-    void render(boost::shared_ptr<LayerImporter> importer)
+    // Only the part of the board image covering the region of interest (and
+    // the processing margin around it) is allocated; the coordinates are
+    // still the ones of the whole board.
+    Surface(guint dpi, ivalue_t min_x, ivalue_t max_x, ivalue_t min_y,
+            ivalue_t max_y, ivalue_t roi_min_x, ivalue_t roi_max_x,
+            ivalue_t roi_min_y, ivalue_t roi_max_y, string outputdir);
+    // antialias also keeps the anti-aliased coverage, for the sub-pixel
+    // contours; a band_memory budget (in bytes) renders the layer in bands
+    // that fit in it, and throws memory_exception if the narrowest bands
+    // don't
+    void render(boost::shared_ptr<LayerImporter> importer, bool antialias,
+                size_t band_memory = 0)
     throw (import_exception);
+    // bytes of the planes of the whole layer needed by the toolpaths of mill
+    // (bit planes, labels, coverage, growth), if all of them are allocated;
+    // masked if a mask will be added
+    size_t get_plane_bytes(shared_ptr<RoutingMill> mill, bool masked);
 
     boost::shared_ptr<Surface> deep_copy();
 
     void save_debug_image(string);
 
+    // with an Isolator having a refine_dpi higher than the dpi, the areas
+    // where the components come close are computed again at refine_dpi;
+    // with offset_passes, only the first pass is grown and traced
     vector<shared_ptr<icoords> > get_toolpath(shared_ptr<RoutingMill> mill,
             bool mirror, bool mirror_absolute);
     vector<unsigned int> get_bridges( shared_ptr<Cutter> cutter, shared_ptr<icoords> toolpath );
@@ -75,56 +101,191 @@ public:
     ;
 
     void add_mask(shared_ptr<Surface>);
+    // same as calling add_mask(mask_surface) on each surface, in one pass
+    static void add_mask(const vector<shared_ptr<Surface> >& surfaces,
+                         shared_ptr<Surface> mask_surface);
     void fill_outline(double linewidth);
+    // the area add_mask() leaves, for the passes computed by offsetting
+    void set_mask_area(const imulti_polygon& area);
 
 protected:
-    Glib::RefPtr<Gdk::Pixbuf> pixbuf;
-    Cairo::RefPtr<Cairo::ImageSurface> cairo_surface;
+    // occupancy of the rendered layer, 1 bit per pixel
+    shared_ptr<bitplane> copper;
+    // area excluded by add_mask(), NULL if there is none
+    shared_ptr<bitplane> blocked;
+    // anti-aliased coverage of the rendered layer, NULL if not antialiased
+    shared_ptr<coverageplane> coverage;
+    // component colors, only allocated while the toolpaths are computed
+    shared_ptr<labelplane> labels;
+    // the rendered layer, to render the refined windows
+    shared_ptr<LayerImporter> importer;
+    // polygons of the area left by the mask, NULL if not set
+    shared_ptr<imulti_polygon> mask_area;
 
     static const int procmargin = 10;
 
     const ivalue_t dpi;
     const ivalue_t min_x, max_x, min_y, max_y;
     const int zero_x, zero_y;
+    // position of the image in the one of the whole board, and the area of
+    // the board it covers
+    int offset_x, offset_y;
+    ivalue_t roi_min_x, roi_max_x, roi_min_y, roi_max_y;
     const string outputdir;
 
     void make_the_surface(unsigned int width, unsigned int height);
+    void make_the_labels();
+    // number of bands rendered at once, prepared by the importer
+    unsigned int get_renderers(LayerImporter* importer, int band_stride,
+                               size_t band_memory);
+    // rows of the image rendered at once by each renderer
+    int get_band_rows(int band_stride, size_t band_memory, unsigned int renderers);
+    void render_bands(LayerImporter* importer, bool antialias, int band_rows,
+                      bool parallel_threshold, int begin, int end);
+
+    vector<shared_ptr<icoords> > grow_and_trace(shared_ptr<RoutingMill> mill,
+            int passes, bool mirrored, ivalue_t mirror_axis, int& contentions);
+    // adaptive refinement of the toolpaths, before they are mirrored
+    void refine(shared_ptr<RoutingMill> mill, int passes, guint refine_dpi,
+                vector<shared_ptr<icoords> >& toolpath, int& contentions);
+    // the extra passes from the areas enclosed by the toolpaths of the first
+    // one, before they are mirrored
+    void offset_passes(shared_ptr<RoutingMill> mill, int extra_passes,
+                       vector<shared_ptr<icoords> >& toolpath, int& contentions);
+    void crowded_rows(vector<unsigned char>* crowded, int begin, int end);
+    void clear_margins();
+    // the mask of a refined window, from the one of the layer it refines
+    void copy_mask(Surface& layer);
+
+    // row workers of the whole image passes, run through parallel::for_chunks
+    void threshold_rows(const vector<unsigned char>* band, int band_stride, int top,
+                        int begin, int end);
+    void label_rows(int begin, int end);
+    void blacken_rows(vector<unsigned char>* rows_with_black, int begin, int end);
+    void board_area_rows(int begin, int end);
+    static void mask_rows(const vector<shared_ptr<Surface> >* surfaces,
+                          const bitplane* mask, int begin, int end);
+    // same as mask_rows, with the mask image placed elsewhere in the board
+    void mask_window_rows(const Surface* mask_surface, int begin, int end);
+    bool same_window(const Surface& other) const
+    {
+        return copper->same_shape(*other.copper) && offset_x == other.offset_x &&
+               offset_y == other.offset_y;
+    }
 
     // Image Processing Methods
 
-    inline ivalue_t xpt2i(int xpt)
+    inline ivalue_t xpt2i(double xpt)
     {
-        return ivalue_t(xpt - zero_x) / ivalue_t(dpi);
+        return ivalue_t(xpt + offset_x - zero_x) / ivalue_t(dpi);
     }
-    inline ivalue_t ypt2i(int ypt)
+    inline ivalue_t ypt2i(double ypt)
     {
-        return ivalue_t(ypt - zero_y) / ivalue_t(dpi);
+        return ivalue_t(ypt + offset_y - zero_y) / ivalue_t(dpi);
     }
 
     inline int xi2pt(ivalue_t xi)
     {
-        return int(xi * ivalue_t(dpi)) + zero_x;
+        return int(xi * ivalue_t(dpi)) + zero_x - offset_x;
     }
     inline int yi2pt(ivalue_t yi)
     {
-        return int(yi * ivalue_t(dpi)) + zero_y;
+        return int(yi * ivalue_t(dpi)) + zero_y - offset_y;
     }
 
-    std::vector<std::pair<int, int> > fill_all_components();
+    std::vector<std::pair<int, int> > fill_all_components(vector<run_set>* runs = NULL);
     void fill_a_component(int x, int y, guint32 argb);
     unsigned int grow_a_component(int x, int y, int& contentions);
+
+    // pixels a growing component will try to claim with its next ring
+    struct frontier
+    {
+        guint32 color;
+        run_set candidates;
+    };
+    unsigned int grow_frontier(frontier& component, int& contentions);
+    // scratch buffers of grow_frontier()
+    vector<guint32> growth_rows[3];
+    vector<unsigned char> growth_foreign;
+    vector<pixel_run> growth_claims;
+    vector<pixel_run> growth_rejected;
+    vector<pixel_run> growth_next[3];
+
+    // one ring of all the components, on several threads
+    unsigned int grow_frontiers(vector<frontier>& active, int& contentions);
+    // what a component does with a ring grown concurrently with the others
+    struct ring_proposal
+    {
+        vector<pixel_run> claims;       // tentative, then the uncontested ones
+        vector<pixel_run> rejected;     // candidates contended by other components
+        vector<pixel_run> contested;    // claims near the ones of a lower component
+        vector<pixel_run> resolved;     // contested claims kept
+        vector<pixel_run> next[3];      // free pixels around the claims
+        bool requeue;                   // true if claims were lost
+    };
+    vector<ring_proposal> growth_proposals;
+    // component claiming pixels in or next to each tile of the labels
+    vector<guint32> growth_tile_owners;
+    int growth_tiles_per_row;
+    void own_tiles(const pixel_run& claim, guint32 tag);
+    bool owns_tiles(const pixel_run& claim, guint32 tag) const;
+    void propose_rings(const vector<frontier>* active,
+                       vector<ring_proposal>* proposals, int begin, int end);
+    void tag_rings(vector<ring_proposal>* proposals, int begin, int end);
+    void check_rings(vector<ring_proposal>* proposals, int begin, int end);
+    void commit_rings(const vector<frontier>* active,
+                      const vector<ring_proposal>* proposals, int begin, int end);
+    void queue_rings(vector<frontier>* active,
+                     const vector<ring_proposal>* proposals, int begin, int end);
     inline bool allow_grow(int x, int y, guint32 ownclr);
 
+    // tracer state at the beginning of a step, to resume after a repair
+    struct trace_checkpoint
+    {
+        int xin, yin;
+        int xout, yout;
+        size_t outside_size;
+    };
+    // scratch buffers of the tracer; every thread tracing needs its own
+    struct tracer_state
+    {
+        vector<trace_checkpoint> checkpoints;
+        vector<std::pair<int, int> > outside;
+        vector<std::pair<double, double> > contour;
+    };
+    tracer_state serial_tracer;
+    // number of stray pixel repairs done by the tracer
+    unsigned int blasts;
+
     void run_to_border(int& x, int& y);
-    void calculate_outline(int x, int y, vector<std::pair<int, int> >& outside,
-                           vector<std::pair<int, int> >& inside);
+    // Traces the outline of the component at x, y into state.outside. Only
+    // the repairs write the labels: without repair the tracer is read-only
+    // and returns false where it would repair or report an error.
+    bool calculate_outline(int x, int y, tracer_state& state, bool repair = true);
+    void calculate_subpixel_outline(int x, int y, const distance_transform& edt,
+                                    double radius,
+                                    vector<std::pair<double, double> >& contour);
 
-    // Misc. Functions
-    static void opacify(Glib::RefPtr<Gdk::Pixbuf> pixbuf);
+    // one pass of get_toolpath(): each component is traced, converted and
+    // simplified into its own slot of paths, so the order of the toolpaths
+    // doesn't depend on the threads
+    struct trace_job
+    {
+        shared_ptr<RoutingMill> mill;
+        bool mirrored;
+        ivalue_t mirror_axis;
+        const distance_transform* edt;      // sub-pixel contours only
+        double radius;
+        const vector<std::pair<int, int> >* components;
+        vector<shared_ptr<icoords> > paths;
+        // components that need a repair, traced serially afterwards
+        vector<unsigned char> deferred;
+    };
+    void trace_components(trace_job* job, int begin, int end);
+    bool trace_component(trace_job& job, int i, tracer_state& state, bool repair);
 
-    guint32 clr;
+    guint32 clr;    // number of colors handed out so far
     guint32 get_an_unused_color();
-    std::vector<guint32> usedcolors;
 };
 
 #endif // SURFACE_H
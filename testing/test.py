@@ -1,12 +1,38 @@
-
 import sys
+import glob
 import subprocess
 import threading
 
 testProjects = ['./gerbv_example/dan', \
                     './gerbv_example/am-test', \
                     './gerbv_example/eaglecad1', \
-                    './gerbv_example/jj']
+                    './gerbv_example/jj', \
+                    './gerbv_example/image-params', \
+                    './gerbv_example/wedge']
+
+# the runs of the option matrix: a name, the options added to the ones of the
+# millproject, and the earlier run whose output must be the same (None if the
+# run only has to succeed, or the exit status of a run that must fail)
+optionMatrix = [('default', [], None),
+                ('edt', ['--growth-engine=edt'], None),
+                ('threads1', ['--threads=1'], 'default'),
+                ('threads8', ['--threads=8'], 'default'),
+                ('subpixel', ['--contour-mode=subpixel'], None),
+                ('passes', ['--extra-passes=2'], None),
+                ('bitplane', ['--growth-engine=bitplane'], 'default'),
+                ('bitplane-passes', ['--growth-engine=bitplane', '--extra-passes=2'], 'passes'),
+                ('subpixel-threads1', ['--contour-mode=subpixel', '--threads=1'], 'subpixel'),
+                ('subpixel-threads8', ['--contour-mode=subpixel', '--threads=8'], 'subpixel'),
+                ('passes-threads1', ['--extra-passes=2', '--threads=1'], 'passes'),
+                ('passes-threads8', ['--extra-passes=2', '--threads=8'], 'passes'),
+                ('refine', ['--dpi=500', '--refine-dpi=2000'], None),
+                ('mmap-scratch', ['--mmap-scratch'], 'default'),
+                ('vector', ['--growth-engine=vector'], None),
+                ('offset-passes', ['--extra-passes=2', '--offset-passes'], None),
+                ('native', ['--gerber-parser=native'], None),
+                ('scanline', ['--gerber-parser=native', '--rasteriser=scanline'], None),
+                ('max-memory', ['--max-memory=4096'], 'default'),
+                ('max-memory-exceeded', ['--max-memory=1', '--dpi=2000'], 53)]
 
 class Builder(threading.Thread):
     def __init__(self, project_dir, output_dir_name ):
@@ -17,11 +43,14 @@ class Builder(threading.Thread):
     def run(self):
         build_project( self._project_dir, self._output_dir_name )
 
-def build_project( project_dir, output_dir_name ):
+# options are passed on the command line, overriding the ones of the millproject;
+# returns the exit status of pcb2gcode
+def build_project( project_dir, output_dir_name, options = [] ):
     prog_path = subprocess.check_output('pwd')[0:-1] + '/../pcb2gcode' 
-    subprocess.Popen( args=prog_path, cwd=project_dir ).wait()
+    ret = subprocess.Popen( args=[prog_path] + options, cwd=project_dir ).wait()
     subprocess.Popen( args='mkdir -p '+output_dir_name+' && mv *.ngc '+output_dir_name, \
                           cwd=project_dir, shell=True ).wait()
+    return ret
 
 def check_project( project_dir ):
     ret = subprocess.call(['diff', '-q', project_dir+'/old', project_dir+'/new'])
@@ -32,7 +61,35 @@ def check_project( project_dir ):
         print 'No differences found.'
 
 def clean_project( project_dir ):
-    subprocess.call(['rm', '-rf', project_dir+'/old', project_dir+'/new', project_dir+'/*.png'])
+    subprocess.call(['rm', '-rf', project_dir+'/old', project_dir+'/new', \
+                         project_dir+'/matrix', project_dir+'/*.png'])
+
+# runs the option matrix on a project, one run after the other as they all
+# write their output in the project directory
+class MatrixRunner(threading.Thread):
+    def __init__(self, project_dir ):
+        threading.Thread.__init__(self)
+        self._project_dir = project_dir
+        self.errors = []
+
+    def run(self):
+        for name, options, same_as in optionMatrix:
+            output_dir = self._project_dir + '/matrix/' + name
+            subprocess.call(['rm', '-rf', output_dir])
+
+            status = build_project( self._project_dir, 'matrix/' + name, options )
+
+            if isinstance(same_as, int):
+                if status != same_as:
+                    self.errors.append(name + ': pcb2gcode returned ' + str(status) + \
+                                       ' instead of ' + str(same_as))
+            elif status != 0:
+                self.errors.append(name + ': pcb2gcode failed')
+            elif not glob.glob(output_dir + '/*.ngc'):
+                self.errors.append(name + ': no output')
+            elif same_as and subprocess.call(['diff', '-q', \
+                    self._project_dir + '/matrix/' + same_as, output_dir]) != 0:
+                self.errors.append(name + ': the output differs from the one of ' + same_as)
 
 
 def build_projects( output_dir_name ):
@@ -51,6 +108,25 @@ def check_projects():
         print 'Checking ' + project
         check_project( project )
 
+def check_matrix():
+    runners = []
+    for project in testProjects:
+        print 'Running the option matrix on ' + project
+        runner = MatrixRunner( project )
+        runners.append(runner)
+        runner.start()
+
+    failures = 0
+    for runner in runners:
+        runner.join()
+        for error in runner.errors:
+            print 'ERROR: ' + runner._project_dir + ': ' + error
+            failures += 1
+
+    if failures != 0:
+        sys.exit(1)
+    print 'All the runs of the option matrix passed.'
+
 def clean_projects():
     for project in testProjects:
         print 'Cleaning up.'
@@ -62,5 +138,7 @@ elif sys.argv[1] == 'buildnew':
     build_projects('new')
 elif sys.argv[1] == 'cmp':
     check_projects()
+elif sys.argv[1] == 'matrix':
+    check_matrix()
 elif sys.argv[1] == 'clean':
     clean_projects()
@@ -0,0 +1,497 @@
+/*
+ * This file is part of pcb2gcode.
+ *
+ * Copyright (C) 2016 the pcb2gcode developers
+ *
+ * pcb2gcode is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * pcb2gcode is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with pcb2gcode.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "vector_isolation.hpp"
+#include "parallel.hpp"
+#include "tsp_solver.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <iterator>
+using std::cerr;
+
+#include <boost/foreach.hpp>
+
+namespace bg = boost::geometry;
+namespace bgi = boost::geometry::index;
+
+namespace
+{
+
+unsigned int find_root(vector<unsigned int>& parent, unsigned int i)
+{
+    while (parent[i] != i)
+    {
+        parent[i] = parent[parent[i]];
+        i = parent[i];
+    }
+
+    return i;
+}
+
+// steps of claim_area() between half the narrowest gap and the radius
+const int claim_steps = 16;
+
+// the offset of the area, or the area itself if the distance is within the
+// tolerance
+void grow_by(const ipolygon& area, double distance, imulti_polygon& result)
+{
+    if (distance > vector_isolation::get_tolerance())
+        vector_isolation::offset(area, distance, result);
+    else
+    {
+        result.clear();
+        result.push_back(area);
+    }
+}
+
+}
+
+/******************************************************************************/
+/*
+ */
+/******************************************************************************/
+vector_isolation::vector_isolation(const imulti_polygon& copper, ivalue_t min_x,
+                                   ivalue_t max_x, bool isolated) :
+    min_x(min_x), max_x(max_x), isolated(isolated), components(copper)
+{
+    vector<indexed_box> boxes;
+
+    for (unsigned int i = 0; i < components.size(); i++)
+        boxes.push_back(indexed_box(bg::return_envelope<ibox>(components[i]), i));
+
+    // the packing constructor builds a better balanced tree than inserting
+    box_tree packed(boxes.begin(), boxes.end());
+    envelopes.swap(packed);
+}
+
+/******************************************************************************/
+/*
+ */
+/******************************************************************************/
+void vector_isolation::set_mask(const imulti_polygon& area)
+{
+    mask = shared_ptr<imulti_polygon>(new imulti_polygon(area));
+}
+
+/******************************************************************************/
+/*
+ */
+/******************************************************************************/
+vector<shared_ptr<icoords> > vector_isolation::get_toolpath(shared_ptr<RoutingMill> mill,
+        bool mirrored, bool mirror_absolute)
+{
+    Isolator* iso = dynamic_cast<Isolator*>(mill.get());
+    const int extra_passes = iso ? iso->extra_passes : 0;
+    const ivalue_t mirror_axis = mirror_absolute ? min_x : ((min_x + max_x) / 2);
+
+    unsigned int contentions = 0;
+    unsigned int failures = 0;
+    vector<shared_ptr<icoords> > toolpath;
+
+    for (int pass = 0; pass <= extra_passes; pass++)
+        contentions += grow(mill->tool_diameter / 2 * (pass + 1), mill->optimise,
+                            toolpath, failures);
+
+    if (mirrored)
+    {
+        BOOST_FOREACH(shared_ptr<icoords>& path, toolpath)
+        {
+            BOOST_FOREACH(icoordpair& point, *path)
+            {
+                point.first = 2 * mirror_axis - point.first;
+            }
+        }
+    }
+
+    if (contentions)
+    {
+        cerr << "\nWarning: pcb2gcode hasn't been able to fulfill all"
+             << " clearance requirements and tried a best effort approach"
+             << " instead. You may want to check the g-code output and"
+             << " possibly use a smaller milling width.\n";
+    }
+
+    if (failures)
+    {
+        cerr << "\nWarning: the vector engine couldn't isolate " << failures
+             << " copper areas, which have no toolpath. You may want to use"
+             << " another growth engine.\n";
+    }
+
+    tsp_solver::nearest_neighbour(toolpath, std::make_pair(0, 0), get_tolerance());
+
+    return toolpath;
+}
+
+/******************************************************************************/
+/*
+ */
+/******************************************************************************/
+unsigned int vector_isolation::grow(double radius, bool optimise,
+                                    vector<shared_ptr<icoords> >& toolpath,
+                                    unsigned int& failures)
+{
+    unsigned int contentions = 0;
+
+    grow_job job;
+    job.radius = radius;
+    job.areas.resize(components.size());
+    job.contentions.resize(components.size(), 0);
+    job.failed.resize(components.size(), false);
+
+    // the offsets of the isolation areas are both the starting point of their
+    // own growth and what their neighbours must keep out of
+    if (isolated)
+    {
+        job.offsets.resize(components.size());
+        parallel::for_batches(components.size(),
+                              boost::bind(&vector_isolation::offset_components, this,
+                                          &job, _1, _2));
+    }
+
+    parallel::for_batches(components.size(),
+                          boost::bind(&vector_isolation::grow_components, this,
+                                      &job, _1, _2));
+
+    for (unsigned int i = 0; i < components.size(); i++)
+    {
+        contentions += job.contentions[i];
+        failures += job.failed[i];
+
+        // the mask or the neighbours can split an area in several parts
+        BOOST_FOREACH(const ipolygon& area, job.areas[i])
+        {
+            shared_ptr<icoords> outline(new icoords(area.outer().begin(),
+                                                    area.outer().end()));
+
+            if (optimise)
+            {
+                shared_ptr<icoords> outline_optimised(new icoords());
+
+                bg::simplify(*outline, *outline_optimised, get_tolerance());
+                outline = outline_optimised;
+            }
+
+            toolpath.push_back(outline);
+        }
+    }
+
+    return contentions;
+}
+
+/******************************************************************************/
+/*
+ */
+/******************************************************************************/
+void vector_isolation::offset_components(grow_job* job, int begin, int end)
+{
+    for (int i = begin; i < end; i++)
+    {
+        try
+        {
+            offset(components[i], job->radius, job->offsets[i]);
+        }
+        catch (const std::exception&)
+        {
+            job->offsets[i].clear();
+        }
+    }
+}
+
+/******************************************************************************/
+/*
+ Boost.Geometry throws on the inputs it can't handle, and the workers of
+ parallel::for_batches mustn't
+ */
+/******************************************************************************/
+void vector_isolation::grow_components(grow_job* job, int begin, int end)
+{
+    for (int i = begin; i < end; i++)
+    {
+        try
+        {
+            grow_component(*job, i);
+        }
+        catch (const std::exception&)
+        {
+            job->areas[i].clear();
+            job->failed[i] = true;
+        }
+    }
+}
+
+/******************************************************************************/
+/*
+ the area of a contended component only has the points nearer to it than to
+ its neighbours (see claim_area()). An isolation area stops where the offset
+ of the neighbour begins instead
+ */
+/******************************************************************************/
+void vector_isolation::grow_component(grow_job& job, unsigned int i)
+{
+    const ipolygon& component = components[i];
+    imulti_polygon area;
+    imulti_polygon rest;
+
+    // an area whose offset failed has no toolpath
+    if (isolated && job.offsets[i].empty())
+    {
+        job.failed[i] = true;
+        return;
+    }
+
+    ibox reach = bg::return_envelope<ibox>(component);
+    reach.min_corner().first -= 2 * job.radius;
+    reach.min_corner().second -= 2 * job.radius;
+    reach.max_corner().first += 2 * job.radius;
+    reach.max_corner().second += 2 * job.radius;
+
+    vector<indexed_box> neighbours;
+    envelopes.query(bgi::intersects(reach), std::back_inserter(neighbours));
+
+    vector<contender> contended;
+
+    BOOST_FOREACH(const indexed_box& neighbour, neighbours)
+    {
+        const unsigned int j = neighbour.second;
+
+        if (j == i)
+            continue;
+
+        const double gap = bg::distance(component, components[j]);
+
+        if (gap >= 2 * job.radius)
+            continue;
+
+        contended.push_back(contender(j, gap));
+
+        if (j > i)
+            job.contentions[i]++;
+    }
+
+    if (isolated)
+    {
+        area = job.offsets[i];
+
+        BOOST_FOREACH(const contender& neighbour, contended)
+        {
+            bg::difference(area, job.offsets[neighbour.first], rest);
+            area.swap(rest);
+            rest.clear();
+        }
+
+        // the offsets of the neighbours can reach into the area itself
+        bg::union_(area, component, rest);
+        area.swap(rest);
+        rest.clear();
+    }
+    else if (contended.empty())
+        offset(component, job.radius, area);
+    else
+        claim_area(i, job.radius, contended, area);
+
+    if (mask)
+    {
+        bg::intersection(area, *mask, rest);
+        area.swap(rest);
+    }
+
+    job.areas[i].swap(area);
+}
+
+/******************************************************************************/
+/*
+ the points within radius of the component that are nearer to it than to
+ any contended neighbour. The component and its neighbours are grown
+ together in steps, like the rings of the raster engines, and each step of
+ the component only keeps what the neighbours haven't reached at the same
+ distance; nothing is nearer to a neighbour than half the narrowest gap, so
+ the steps start there. The area stops where its distance is within a step
+ of the one of a neighbour, always on its own side of the middle of the gaps.
+ This is not the exact (Voronoi) split: a point nearer to the component by
+ less than a step can be reached by both in the same step, and left to
+ neither. Each step costs one offset of the component and one of each
+ neighbour it reaches.
+ */
+/******************************************************************************/
+void vector_isolation::claim_area(unsigned int i, double radius,
+                                  const vector<contender>& contended,
+                                  imulti_polygon& result) const
+{
+    double start = radius;
+
+    BOOST_FOREACH(const contender& neighbour, contended)
+    {
+        start = std::min(start, neighbour.second / 2);
+    }
+
+    const int steps = std::max(1, std::min(claim_steps,
+                                           int(ceil((radius - start) / get_tolerance()))));
+    vector<imulti_polygon> claimed(1);
+
+    grow_by(components[i], start, claimed.front());
+
+    for (int k = 1; k <= steps; k++)
+    {
+        const double distance = start + (radius - start) * k / steps;
+        imulti_polygon step;
+        imulti_polygon rest;
+
+        grow_by(components[i], distance, step);
+
+        BOOST_FOREACH(const contender& neighbour, contended)
+        {
+            // the two offsets don't meet yet
+            if (neighbour.second >= 2 * distance)
+                continue;
+
+            imulti_polygon reached;
+
+            grow_by(components[neighbour.first], distance, reached);
+            bg::difference(step, reached, rest);
+            step.swap(rest);
+            rest.clear();
+        }
+
+        claimed.push_back(imulti_polygon());
+        claimed.back().swap(step);
+    }
+
+    merge_pairs(claimed);
+    result.swap(claimed.front());
+}
+
+/******************************************************************************/
+/*
+ */
+/******************************************************************************/
+int vector_isolation::get_circle_sides(double radius, double tolerance)
+{
+    if (radius <= tolerance)
+        return 8;
+
+    return std::max(8, int(ceil(M_PI / acos(1 - tolerance / radius))));
+}
+
+/******************************************************************************/
+/*
+ most shapes of a layer (pads, vias) don't overlap any other one: only the
+ clusters of shapes with overlapping envelopes go through boolean operations
+ */
+/******************************************************************************/
+void vector_isolation::unite(vector<imulti_polygon>& shapes, imulti_polygon& result)
+{
+    vector<indexed_box> boxes;
+    vector<unsigned int> parent(shapes.size());
+
+    for (unsigned int i = 0; i < shapes.size(); i++)
+    {
+        parent[i] = i;
+
+        if (!shapes[i].empty())
+            boxes.push_back(indexed_box(bg::return_envelope<ibox>(shapes[i]), i));
+    }
+
+    const box_tree tree(boxes.begin(), boxes.end());
+    vector<indexed_box> overlapping;
+
+    BOOST_FOREACH(const indexed_box& box, boxes)
+    {
+        overlapping.clear();
+        tree.query(bgi::intersects(box.first), std::back_inserter(overlapping));
+
+        BOOST_FOREACH(const indexed_box& other, overlapping)
+        {
+            const unsigned int a = find_root(parent, box.second);
+            const unsigned int b = find_root(parent, other.second);
+
+            parent[std::max(a, b)] = std::min(a, b);
+        }
+    }
+
+    // the shapes of each cluster, in their order
+    vector<vector<unsigned int> > clusters(shapes.size());
+
+    BOOST_FOREACH(const indexed_box& box, boxes)
+    {
+        clusters[find_root(parent, box.second)].push_back(box.second);
+    }
+
+    result.clear();
+
+    BOOST_FOREACH(const vector<unsigned int>& cluster, clusters)
+    {
+        if (cluster.empty())
+            continue;
+
+        vector<imulti_polygon> merged;
+
+        BOOST_FOREACH(unsigned int i, cluster)
+        {
+            merged.push_back(imulti_polygon());
+            merged.back().swap(shapes[i]);
+        }
+
+        merge_pairs(merged);
+        result.insert(result.end(), merged.front().begin(), merged.front().end());
+    }
+
+    shapes.clear();
+}
+
+/******************************************************************************/
+/*
+ unites the shapes two by two, so that the sizes of the operands stay
+ balanced; the union is left in the first one
+ */
+/******************************************************************************/
+void vector_isolation::merge_pairs(vector<imulti_polygon>& shapes)
+{
+    while (shapes.size() > 1)
+    {
+        vector<imulti_polygon> merged((shapes.size() + 1) / 2);
+
+        for (unsigned int i = 0; i + 1 < shapes.size(); i += 2)
+            bg::union_(shapes[i], shapes[i + 1], merged[i / 2]);
+
+        if (shapes.size() % 2)
+            merged.back().swap(shapes.back());
+
+        shapes.swap(merged);
+    }
+}
+
+/******************************************************************************/
+/*
+ */
+/******************************************************************************/
+void vector_isolation::offset(const ipolygon& area, double distance,
+                              imulti_polygon& result)
+{
+    namespace bs = boost::geometry::strategy::buffer;
+
+    const int sides = get_circle_sides(distance, get_tolerance());
+
+    result.clear();
+    bg::buffer(area, result, bs::distance_symmetric<double>(distance),
+               bs::side_straight(), bs::join_round(sides), bs::end_round(sides),
+               bs::point_circle(sides));
+}
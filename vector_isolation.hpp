@@ -0,0 +1,130 @@
+/*
+ * This file is part of pcb2gcode.
+ *
+ * Copyright (C) 2016 the pcb2gcode developers
+ *
+ * pcb2gcode is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * pcb2gcode is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with pcb2gcode.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef VECTOR_ISOLATION_HPP
+#define VECTOR_ISOLATION_HPP
+
+#include <vector>
+using std::vector;
+
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+using boost::shared_ptr;
+
+#include <boost/geometry/index/rtree.hpp>
+
+#include "coord.hpp"
+#include "mill.hpp"
+
+/******************************************************************************/
+/*
+ Isolation of a layer from its copper polygons, without rasterising it.
+
+ Every connected copper area (a polygon, holes included) is offset by the
+ milling radius of each pass, and the outer rings of the offset areas are
+ the toolpaths. Where two areas are closer than twice the radius, each one
+ only grows over the points nearer to it than to the other, so the paths
+ run along the middle of the gap between the areas like the ones of the
+ raster engines; the number of such pairs is reported as contentions. The
+ holes are not isolated from inside, the areas inside them being components
+ of their own.
+
+ The curves are approximated by polygons within get_tolerance(). The split
+ of a contended gap is approximate too (see claim_area()): a point whose
+ distances from the two areas differ by less than a step of the split,
+ (radius - narrowest gap / 2) / 16 or get_tolerance() if larger, can be left
+ to neither of them: the paths stop short of the middle of the gap, by up to
+ half a step where the areas face each other.
+
+ The areas can also be the isolation areas of a raster engine, enclosed by
+ its first toolpaths: the extra passes then offset them by the milling
+ radius for each pass. Each area is kept out of the offsets of its
+ neighbours, so it never reaches farther into their gaps than the previous
+ passes did, and is never shrunk.
+ */
+/******************************************************************************/
+class vector_isolation: boost::noncopyable
+{
+public:
+    // copper (or the isolation areas, if isolated) in board coordinates;
+    // min_x and max_x are the ones of the board, for the mirroring
+    vector_isolation(const imulti_polygon& copper, ivalue_t min_x, ivalue_t max_x,
+                     bool isolated = false);
+
+    // in inches
+    static double get_tolerance()
+    {
+        return 0.0001;
+    }
+
+    // the isolation areas are clipped to area (e.g. the board outline)
+    void set_mask(const imulti_polygon& area);
+
+    vector<shared_ptr<icoords> > get_toolpath(shared_ptr<RoutingMill> mill,
+            bool mirrored, bool mirror_absolute);
+
+    // Appends the outlines of the areas grown by radius to toolpath, in board
+    // coordinates, and returns the number of contended neighbours; the areas
+    // that couldn't be grown are added to failures.
+    unsigned int grow(double radius, bool optimise,
+                      vector<shared_ptr<icoords> >& toolpath, unsigned int& failures);
+
+    // number of sides of the regular polygon inscribed in a circle of the
+    // given radius whose sides are within tolerance from it
+    static int get_circle_sides(double radius, double tolerance);
+    // union of all the shapes; shapes is emptied
+    static void unite(vector<imulti_polygon>& shapes, imulti_polygon& result);
+    // outset (positive distance) of the geometry, with round joins within
+    // get_tolerance()
+    static void offset(const ipolygon& area, double distance, imulti_polygon& result);
+
+protected:
+    typedef std::pair<ibox, unsigned int> indexed_box;
+    typedef boost::geometry::index::rtree<indexed_box,
+            boost::geometry::index::quadratic<16> > box_tree;
+
+    const ivalue_t min_x;
+    const ivalue_t max_x;
+    const bool isolated;
+    imulti_polygon components;
+    box_tree envelopes;
+    shared_ptr<imulti_polygon> mask;
+
+    // one pass: each component is grown into its own slot, so the order of
+    // the toolpaths doesn't depend on the threads
+    struct grow_job
+    {
+        double radius;
+        vector<imulti_polygon> offsets;     // of all the areas, if isolated
+        vector<imulti_polygon> areas;
+        vector<unsigned int> contentions;   // neighbours with a higher index
+        vector<unsigned char> failed;
+    };
+    void offset_components(grow_job* job, int begin, int end);
+    void grow_components(grow_job* job, int begin, int end);
+    void grow_component(grow_job& job, unsigned int i);
+    // a contended neighbour and its distance
+    typedef std::pair<unsigned int, double> contender;
+    void claim_area(unsigned int i, double radius, const vector<contender>& contended,
+                    imulti_polygon& result) const;
+
+    static void merge_pairs(vector<imulti_polygon>& shapes);
+};
+
+#endif // VECTOR_ISOLATION_HPP